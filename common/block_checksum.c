@@ -0,0 +1,39 @@
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./block_checksum.h"
+
+uint32_t calculate_weak_checksum(const uint8_t *data, size_t size) {
+	// a is the sum of the bytes, b the sum of the prefix sums, both modulo
+	// 2^16
+	uint32_t a = 0;
+	uint32_t b = 0;
+	for (size_t i = 0; i < size; ++i) {
+		a += data[i];
+		b += (uint32_t)(size - i) * data[i];
+	}
+	return (a & 0xFFFF) | (b << 16);
+}
+
+uint32_t roll_weak_checksum(uint32_t checksum, uint8_t removed, uint8_t added,
+							size_t size) {
+	uint32_t a = checksum & 0xFFFF;
+	uint32_t b = checksum >> 16;
+	a = (a - removed + added) & 0xFFFF;
+	b = (b - (uint32_t)size * removed + a) & 0xFFFF;
+	return a | (b << 16);
+}
+
+uint64_t calculate_strong_checksum(const uint8_t *data, size_t size) {
+	uint8_t hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_size;
+	if (!EVP_Digest(data, size, hash, &hash_size, EVP_sha256(), NULL)) {
+		return 0;
+	}
+	uint64_t checksum = 0;
+	for (size_t i = 0; i < STRONG_CHECKSUM_SIZE; ++i) {
+		checksum = checksum << 8 | hash[i];
+	}
+	return checksum;
+}
@@ -0,0 +1,38 @@
+#ifndef BLOCK_CHECKSUM_H
+#define BLOCK_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Checksums of the blocks of a file the receiver already has, against which
+// the sender encodes a delta. The weak checksum is the rolling one of rsync,
+// so the sender can slide it over its file a byte at a time, and the strong
+// checksum confirms its matches.
+#define STRONG_CHECKSUM_SIZE 8
+// Weak checksum (32 bits) followed by the strong checksum
+#define BLOCK_SIGNATURE_SIZE (4 + STRONG_CHECKSUM_SIZE)
+// Block signatures sent in one packet, 960 bytes of signatures
+#define SIGNATURES_PER_PACKET 80
+
+// Instructions of a delta, all numbers are big-endian
+// Copy instruction, block index (32 bits) and block count (32 bits)
+#define DELTA_COPY_INSTRUCTION 0x01
+#define DELTA_COPY_INSTRUCTION_SIZE 9
+// Literal instruction, length (32 bits) and as many bytes of data
+#define DELTA_LITERAL_INSTRUCTION 0x02
+#define DELTA_LITERAL_INSTRUCTION_SIZE 5
+// Stored chunk instruction, SHA-256 (256 bits) of a chunk of the receiver's
+// chunk store
+#define DELTA_STORED_CHUNK_INSTRUCTION 0x03
+#define DELTA_STORED_CHUNK_INSTRUCTION_SIZE 33
+
+uint32_t calculate_weak_checksum(const uint8_t *data, size_t size);
+
+// Slides the weak checksum of size bytes one byte forward
+uint32_t roll_weak_checksum(uint32_t checksum, uint8_t removed, uint8_t added,
+							size_t size);
+
+// The first STRONG_CHECKSUM_SIZE bytes of the SHA-256 of the block
+uint64_t calculate_strong_checksum(const uint8_t *data, size_t size);
+
+#endif // BLOCK_CHECKSUM_H
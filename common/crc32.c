@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./crc32.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                               \
+	(defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRC32_PCLMUL
+#define CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CRC32_PCLMUL
+#define CRC32_PCLMUL_TARGET
+#endif
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+#define CRC32_SLICE_COUNT 16
+// Below this the folding setup costs more than it saves
+#define CRC32_PCLMUL_MIN_LENGTH 64
+#define BENCHMARK_BYTES (64 * 1024 * 1024)
+#define BENCHMARK_MAX_SIZE 65536
+
+static uint32_t crc32_tables[CRC32_SLICE_COUNT][256];
+static crc32_function_t selected_function;
+static const char *selected_name;
+
+static uint32_t load_little_endian_32(const uint8_t *data) {
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 |
+		   (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static uint32_t update_crc32_bitwise(uint32_t crc, const uint8_t *data,
+									 size_t length) {
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++) {
+			if (crc & 1) {
+				crc = (crc >> 1) ^ CRC32_POLYNOMIAL;
+			} else {
+				crc >>= 1;
+			}
+		}
+	}
+	return ~crc;
+}
+
+// Works on the inverted value, the slicing kernels finish their tails with it
+static uint32_t update_crc32_bytes(uint32_t crc, const uint8_t *data,
+								   size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		crc = (crc >> 8) ^ crc32_tables[0][(crc ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+static uint32_t update_crc32_slice_by_8(uint32_t crc, const uint8_t *data,
+										size_t length) {
+	crc = ~crc;
+	while (length >= 8) {
+		uint32_t low = load_little_endian_32(data) ^ crc;
+		uint32_t high = load_little_endian_32(data + 4);
+		crc = crc32_tables[7][low & 0xFF] ^ crc32_tables[6][(low >> 8) & 0xFF] ^
+			  crc32_tables[5][(low >> 16) & 0xFF] ^ crc32_tables[4][low >> 24] ^
+			  crc32_tables[3][high & 0xFF] ^
+			  crc32_tables[2][(high >> 8) & 0xFF] ^
+			  crc32_tables[1][(high >> 16) & 0xFF] ^ crc32_tables[0][high >> 24];
+		data += 8;
+		length -= 8;
+	}
+	return ~update_crc32_bytes(crc, data, length);
+}
+
+static uint32_t update_crc32_slice_by_16(uint32_t crc, const uint8_t *data,
+										 size_t length) {
+	crc = ~crc;
+	while (length >= 16) {
+		uint32_t word_0 = load_little_endian_32(data) ^ crc;
+		uint32_t word_1 = load_little_endian_32(data + 4);
+		uint32_t word_2 = load_little_endian_32(data + 8);
+		uint32_t word_3 = load_little_endian_32(data + 12);
+		// Byte i of the block is advanced by the 15 - i bytes after it
+		crc = crc32_tables[15][word_0 & 0xFF] ^
+			  crc32_tables[14][(word_0 >> 8) & 0xFF] ^
+			  crc32_tables[13][(word_0 >> 16) & 0xFF] ^
+			  crc32_tables[12][word_0 >> 24] ^
+			  crc32_tables[11][word_1 & 0xFF] ^
+			  crc32_tables[10][(word_1 >> 8) & 0xFF] ^
+			  crc32_tables[9][(word_1 >> 16) & 0xFF] ^
+			  crc32_tables[8][word_1 >> 24] ^ crc32_tables[7][word_2 & 0xFF] ^
+			  crc32_tables[6][(word_2 >> 8) & 0xFF] ^
+			  crc32_tables[5][(word_2 >> 16) & 0xFF] ^
+			  crc32_tables[4][word_2 >> 24] ^ crc32_tables[3][word_3 & 0xFF] ^
+			  crc32_tables[2][(word_3 >> 8) & 0xFF] ^
+			  crc32_tables[1][(word_3 >> 16) & 0xFF] ^
+			  crc32_tables[0][word_3 >> 24];
+		data += 16;
+		length -= 16;
+	}
+	return ~update_crc32_bytes(crc, data, length);
+}
+
+#ifdef CRC32_PCLMUL
+// Folds four 128-bit lanes at once by carry-less multiplication and reduces
+// the result by Barrett reduction, as in Intel's "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction". length has to be at least
+// 64 and a multiple of 16, crc is the inverted value.
+static CRC32_PCLMUL_TARGET uint32_t fold_crc32_pclmul(uint32_t crc,
+													   const uint8_t *data,
+													   size_t length) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+	const __m128i polynomial = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i low_32_mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	data += 64;
+	length -= 64;
+
+	while (length >= 64) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+						   _mm_loadu_si128((const __m128i *)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+						   _mm_loadu_si128((const __m128i *)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+						   _mm_loadu_si128((const __m128i *)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+						   _mm_loadu_si128((const __m128i *)(data + 0x30)));
+		data += 64;
+		length -= 64;
+	}
+
+	// Fold the four lanes into one and then the remaining 16 byte blocks
+	__m128i lanes[3] = {x2, x3, x4};
+	for (int i = 0; i < 3; i++) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+	}
+	while (length >= 16) {
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(
+													 (const __m128i *)data)),
+						   x5);
+		data += 16;
+		length -= 16;
+	}
+
+	// Fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, low_32_mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, low_32_mask);
+	x2 = _mm_clmulepi64_si128(x2, polynomial, 0x10);
+	x2 = _mm_and_si128(x2, low_32_mask);
+	x2 = _mm_clmulepi64_si128(x2, polynomial, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t update_crc32_pclmul(uint32_t crc, const uint8_t *data,
+									size_t length) {
+	if (length < CRC32_PCLMUL_MIN_LENGTH) {
+		return update_crc32_slice_by_16(crc, data, length);
+	}
+	size_t folded_length = length & ~(size_t)15;
+	crc = ~fold_crc32_pclmul(~crc, data, folded_length);
+	return update_crc32_slice_by_16(crc, data + folded_length,
+									length - folded_length);
+}
+
+static int is_pclmul_supported(void) {
+#ifdef _MSC_VER
+	int registers[4];
+	__cpuid(registers, 1);
+	unsigned int ecx = (unsigned int)registers[2];
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+#endif
+	// PCLMULQDQ is bit 1 and SSE4.1 bit 19
+	return (ecx & (1u << 1)) && (ecx & (1u << 19));
+}
+#endif
+
+static int is_always_supported(void) { return 1; }
+
+static const crc32_implementation_t crc32_implementations[] = {
+	{"bitwise", update_crc32_bitwise, is_always_supported},
+	{"slice-by-8", update_crc32_slice_by_8, is_always_supported},
+	{"slice-by-16", update_crc32_slice_by_16, is_always_supported},
+#ifdef CRC32_PCLMUL
+	{"pclmul", update_crc32_pclmul, is_pclmul_supported},
+#endif
+};
+
+#define CRC32_IMPLEMENTATION_COUNT                                             \
+	(sizeof(crc32_implementations) / sizeof(crc32_implementations[0]))
+
+void init_crc32(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLYNOMIAL : crc >> 1;
+		}
+		crc32_tables[0][i] = crc;
+	}
+	// Table k advances a byte by k more zero bytes
+	for (int k = 1; k < CRC32_SLICE_COUNT; k++) {
+		for (int i = 0; i < 256; i++) {
+			uint32_t previous = crc32_tables[k - 1][i];
+			crc32_tables[k][i] =
+				(previous >> 8) ^ crc32_tables[0][previous & 0xFF];
+		}
+	}
+
+	// The implementations are listed from the slowest to the fastest
+	for (size_t i = 0; i < CRC32_IMPLEMENTATION_COUNT; i++) {
+		if (crc32_implementations[i].is_supported()) {
+			selected_function = crc32_implementations[i].function;
+			selected_name = crc32_implementations[i].name;
+		}
+	}
+}
+
+const char *get_crc32_implementation_name(void) {
+	return selected_name != NULL ? selected_name : "bitwise";
+}
+
+uint32_t update_crc32(uint32_t crc, const uint8_t *data, size_t length) {
+	if (selected_function == NULL) {
+		return update_crc32_bitwise(crc, data, length);
+	}
+	return selected_function(crc, data, length);
+}
+
+uint32_t calculate_crc32(const uint8_t *data, size_t length) {
+	return update_crc32(0, data, length);
+}
+
+int benchmark_crc32(void) {
+	if (selected_function == NULL) {
+		init_crc32();
+	}
+
+	uint8_t *buffer = malloc(BENCHMARK_MAX_SIZE + 1);
+	if (buffer == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		return 1;
+	}
+	for (size_t i = 0; i < BENCHMARK_MAX_SIZE + 1; i++) {
+		buffer[i] = (uint8_t)rand();
+	}
+
+	// Every length up to a few folds and both alignments have to agree
+	int failed = 0;
+	for (size_t i = 0; i < CRC32_IMPLEMENTATION_COUNT; i++) {
+		const crc32_implementation_t *implementation =
+			&crc32_implementations[i];
+		if (!implementation->is_supported()) {
+			printf("%-12s not supported by this CPU\n", implementation->name);
+			continue;
+		}
+		for (size_t offset = 0; offset < 2; offset++) {
+			for (size_t length = 0; length <= 1024; length++) {
+				if (implementation->function(0x12345678, buffer + offset,
+											 length) !=
+					update_crc32_bitwise(0x12345678, buffer + offset, length)) {
+					fprintf(stderr, "%s differs from the reference for %zu "
+									"bytes!\n",
+							implementation->name, length);
+					failed = 1;
+					break;
+				}
+			}
+		}
+		if (implementation->function(0, (const uint8_t *)"123456789", 9) !=
+			0xCBF43926) {
+			fprintf(stderr, "%s fails the check value!\n",
+					implementation->name);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		free(buffer);
+		return 1;
+	}
+
+	const size_t sizes[] = {64, 1472, BENCHMARK_MAX_SIZE};
+	printf("%-12s %12s %12s %12s\n", "MB/s", "64 B", "1472 B", "64 kB");
+	for (size_t i = 0; i < CRC32_IMPLEMENTATION_COUNT; i++) {
+		const crc32_implementation_t *implementation =
+			&crc32_implementations[i];
+		if (!implementation->is_supported()) {
+			continue;
+		}
+		printf("%-12s", implementation->name);
+		for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			// The reference is far slower, keep its run short
+			size_t total = implementation->function == update_crc32_bitwise
+							   ? BENCHMARK_BYTES / 16
+							   : BENCHMARK_BYTES;
+			size_t rounds = total / sizes[j];
+			uint32_t crc = 0;
+			clock_t start = clock();
+			for (size_t round = 0; round < rounds; round++) {
+				crc = implementation->function(crc, buffer, sizes[j]);
+			}
+			double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+			// Using the result keeps the loop from being optimized out
+			buffer[0] ^= (uint8_t)crc;
+			printf(" %12.1f",
+				   seconds > 0 ? rounds * sizes[j] / seconds / 1e6 : 0.0);
+		}
+		printf("\n");
+	}
+	printf("Selected implementation: %s\n", get_crc32_implementation_name());
+
+	free(buffer);
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 with the reflected polynomial 0xEDB88320 (the one of zlib and
+// Ethernet) shared by the sender and the receiver. Every packet carries it, so
+// next to the bit at a time reference there are table driven slice-by-8 and
+// slice-by-16 kernels and a PCLMULQDQ folding kernel. init_crc32() picks the
+// fastest one the CPU supports; until it is called the reference is used.
+typedef uint32_t (*crc32_function_t)(uint32_t crc, const uint8_t *data,
+									 size_t length);
+
+typedef struct {
+	const char *name;
+	crc32_function_t function;
+	int (*is_supported)(void);
+} crc32_implementation_t;
+
+// Builds the tables and selects the implementation, call before starting any
+// threads
+void init_crc32(void);
+
+const char *get_crc32_implementation_name(void);
+
+// Continues crc (0 to start) over data, like zlib's crc32()
+uint32_t update_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+uint32_t calculate_crc32(const uint8_t *data, size_t length);
+
+// Checks every supported implementation against the reference and prints its
+// throughput for packet sized and large buffers, returns 0 on success
+int benchmark_crc32(void);
+
+#endif // CRC32_H
@@ -3,6 +3,7 @@ pkgs.mkShell rec {
   buildInputs = with pkgs; [
     zlib
     openssl
+    cmake
   ];
   LD_LIBRARY_PATH = "${pkgs.lib.makeLibraryPath buildInputs}";
 }
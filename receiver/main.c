@@ -1,26 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <windows.h>
+#include <string.h>
+#include <stdbool.h>
 #include "receiver.h"
 #include "logger.h"
+#include "../common/crc32.h"
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
+    // The receiver serves any number of senders until it is stopped, unless told to exit once the first sender's files are written
+    bool exit_when_saved = argc > 1 && strcmp(argv[1], "-e") == 0;
+    int first_argument = exit_when_saved ? 2 : 1;
+
+    // Every packet is answered to the address it came from, the reply port is only the one the answers are sent from
+    if (argc - first_argument != 2) {
         fprintf(stderr, "Not enough arguments given!\n");
-        fprintf(stderr, "Usage: %s <receiver_port> <target_ip_address> <sender_port>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-e] <receiver_port> <reply_port>\n", argv[0]);
+        fprintf(stderr, "  -e  exit once every file of the first sender, or of its manifest, is written\n");
         return EXIT_FAILURE;
     }
 
-    int receiver_port = atoi(argv[1]);
-    char *sender_ip_address = argv[2];
-    int sender_port = atoi(argv[3]);
+    int receiver_port = atoi(argv[first_argument]);
+    int reply_port = atoi(argv[first_argument + 1]);
 
     printf("Receiver Port: %d\n", receiver_port);
-    printf("Sender IP Address: %s\n", sender_ip_address);
-    printf("Sender Port: %d\n\n", sender_port);
+    printf("Reply Port: %d\n", reply_port);
+
+    // Select the fastest CRC-32 implementation of this CPU
+    init_crc32();
+    printf("CRC-32: %s\n\n", get_crc32_implementation_name());
 
     // Loop until new transmission is successful
-    while (!new_transmission(receiver_port, sender_ip_address, sender_port)) {
+    while (!new_transmission(receiver_port, reply_port, exit_when_saved)) {
         fprintf(stderr, "Failed to receive transmission. Retrying...\n");
     }
     return EXIT_SUCCESS;
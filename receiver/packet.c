@@ -7,11 +7,12 @@
 #include "packet.h"
 #include "sender.h"
 #include "receiver.h"
+#include "utils.h"
 #include "logger.h"
 
 // Calculate SHA-256 hash from the data packets in the transmission structure, using non deprecated OpenSSL functions
 void calculate_sha256_from_packets(transmission_t *trans, unsigned char *output_hash) {
-    if (!trans || !trans->data_packets || trans->total_packet_count == 0) {
+    if (!trans || (!trans->data_packets && !trans->part_file) || trans->total_packet_count == 0) {
         fprintf(stderr, "Invalid transmission structure, or empty data\n");
         return;
     }
@@ -23,17 +24,26 @@ void calculate_sha256_from_packets(transmission_t *trans, unsigned char *output_
         return;
     }
 
-    // Initialize SHA-256 context
-    if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1) {
+    // Continue the running hash of the data packets received in order, only the rest is read back
+    uint32_t first_index = 0;
+    if (trans->running_hash) {
+        if (EVP_MD_CTX_copy_ex(mdctx, trans->running_hash) != 1) {
+            fprintf(stderr, "EVP_MD_CTX_copy_ex failed\n");
+            EVP_MD_CTX_free(mdctx);
+            return;
+        }
+        first_index = trans->hashed_packet_count;
+    } else if (EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) != 1) {
         fprintf(stderr, "EVP_DigestInit_ex failed\n");
         EVP_MD_CTX_free(mdctx);
         return;
     }
 
     // Process each data packet
-    for (uint32_t i = 0; i < trans->total_packet_count; i++) {
-        if (trans->data_packets[i] != NULL) {
-            if (EVP_DigestUpdate(mdctx, trans->data_packets[i], trans->packet_sizes[i]) != 1) {
+    for (uint32_t i = first_index; i < trans->total_packet_count; i++) {
+        if (is_data_packet_received(trans, i)) {
+            const uint8_t *data = load_data_packet(trans, i);
+            if (!data || EVP_DigestUpdate(mdctx, data, get_data_packet_size(trans, i)) != 1) {
                 fprintf(stderr, "EVP_DigestUpdate failed\n");
                 EVP_MD_CTX_free(mdctx);
                 return;
@@ -51,9 +61,742 @@ void calculate_sha256_from_packets(transmission_t *trans, unsigned char *output_
     EVP_MD_CTX_free(mdctx);
 }
 
-int process_packet_start_0x00(uint8_t *buffer, transmission_t **trans) {
+bool hash_with_prefix(uint8_t prefix, const uint8_t *first, size_t first_size, const uint8_t *second, size_t second_size, unsigned char *output_hash) {
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    if (mdctx == NULL) {
+        fprintf(stderr, "Failed to create EVP_MD_CTX\n");
+        return false;
+    }
+    bool result = EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) == 1 &&
+                  EVP_DigestUpdate(mdctx, &prefix, 1) == 1 &&
+                  EVP_DigestUpdate(mdctx, first, first_size) == 1 &&
+                  EVP_DigestUpdate(mdctx, second, second_size) == 1 &&
+                  EVP_DigestFinal_ex(mdctx, output_hash, NULL) == 1;
+    if (!result) {
+        fprintf(stderr, "Tree hash calculation failed\n");
+    }
+    EVP_MD_CTX_free(mdctx);
+    return result;
+}
+
+void hash_tree_hash_leaf(transmission_t *trans, uint32_t leaf, unsigned char *output_hash) {
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
+    if (mdctx == NULL) {
+        fprintf(stderr, "Failed to create EVP_MD_CTX\n");
+        return;
+    }
+
+    uint8_t prefix = 0x00;
+    EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL);
+    EVP_DigestUpdate(mdctx, &prefix, 1);
+    uint32_t end = (leaf + 1) * TREE_HASH_LEAF_PACKET_COUNT;
+    for (uint32_t i = leaf * TREE_HASH_LEAF_PACKET_COUNT; i < end && i < trans->total_packet_count; i++) {
+        const uint8_t *data = is_data_packet_received(trans, i) ? load_data_packet(trans, i) : NULL;
+        if (data) {
+            EVP_DigestUpdate(mdctx, data, get_data_packet_size(trans, i));
+        }
+    }
+    EVP_DigestFinal_ex(mdctx, output_hash, NULL);
+    EVP_MD_CTX_free(mdctx);
+}
+
+void calculate_tree_hash_from_packets(transmission_t *trans, unsigned char *output_hash) {
+    // Leaves with packets still missing were not hashed yet, the root will not match then anyway
+    for (uint32_t leaf = 0; leaf < trans->leaf_count; leaf++) {
+        if (trans->leaf_packet_counts[leaf] < TREE_HASH_LEAF_PACKET_COUNT) {
+            hash_tree_hash_leaf(trans, leaf, trans->leaf_hashes[leaf]);
+        }
+    }
+
+    // Combine pairs level by level on a copy, an odd node is carried up as is
+    uint32_t node_count = trans->leaf_count;
+    uint8_t (*nodes)[SHA256_DIGEST_LENGTH] = malloc((size_t)node_count * SHA256_DIGEST_LENGTH);
+    if (!nodes) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return;
+    }
+    memcpy(nodes, trans->leaf_hashes, (size_t)node_count * SHA256_DIGEST_LENGTH);
+    while (node_count > 1) {
+        for (uint32_t i = 0; i < node_count / 2; i++) {
+            if (!hash_with_prefix(0x01, nodes[2 * i], SHA256_DIGEST_LENGTH, nodes[2 * i + 1], SHA256_DIGEST_LENGTH, nodes[i])) {
+                free(nodes);
+                return;
+            }
+        }
+        if (node_count % 2) {
+            memcpy(nodes[node_count / 2], nodes[node_count - 1], SHA256_DIGEST_LENGTH);
+        }
+        node_count = (node_count + 1) / 2;
+    }
+    memcpy(output_hash, nodes[0], SHA256_DIGEST_LENGTH);
+    free(nodes);
+}
+
+bool is_data_packet_received(transmission_t *t, uint32_t packet_index) {
+    if (t->part_file) {
+        if (packet_index / 8 >= t->received_capacity) {
+            return false;
+        }
+        return t->received_packets[packet_index / 8] & (1 << (packet_index % 8));
+    }
+    return t->data_packets[packet_index] != NULL;
+}
+
+bool is_packet_count_known(transmission_t *t) {
+    return !(t->flags & STREAM_FLAG) || t->total_packet_count != UNKNOWN_PACKET_COUNT;
+}
+
+void set_packet_count(transmission_t *t, uint32_t packet_count, size_t last_packet_size) {
+    t->total_packet_count = packet_count;
+    t->stripes[0].end_index = packet_count;
+    t->last_packet_size = last_packet_size;
+    printf("Transmission %u ends after %u packets\n", t->transmission_id, packet_count);
+}
+
+bool reserve_data_packet(transmission_t *t, uint32_t packet_index) {
+    size_t capacity = t->received_capacity;
+    while (packet_index / 8 >= capacity) {
+        capacity *= 2;
+    }
+    if (capacity == t->received_capacity) {
+        return true;
+    }
+    uint8_t *received_packets = realloc(t->received_packets, capacity);
+    if (!received_packets) {
+        fprintf(stderr, "Memory allocation failed for the received packets of a stream\n");
+        return false;
+    }
+    memset(&received_packets[t->received_capacity], 0, capacity - t->received_capacity);
+    t->received_packets = received_packets;
+    t->received_capacity = capacity;
+    return true;
+}
+
+size_t get_data_packet_size(transmission_t *t, uint32_t packet_index) {
+    if (t->part_file) {
+        return packet_index + 1 == t->total_packet_count ? t->last_packet_size : t->chunk_size;
+    }
+    return t->packet_sizes[packet_index];
+}
+
+const uint8_t *load_data_packet(transmission_t *t, uint32_t packet_index) {
+    if (!t->part_file) {
+        return (const uint8_t *)t->data_packets[packet_index];
+    }
+    size_t data_size = get_data_packet_size(t, packet_index);
+    if (!read_file_at(t->part_file, (uint64_t)packet_index * t->chunk_size, t->packet_buffer, data_size)) {
+        fprintf(stderr, "Failed to read packet %u back from the part file\n", packet_index);
+        return NULL;
+    }
+    return t->packet_buffer;
+}
+
+bool is_plain_file_name(const char *file_name) {
+    // A drive letter or a separator of either platform could reach any file, so only a base name is allowed
+    return file_name[0] != '\0' && strcmp(file_name, ".") != 0 && strcmp(file_name, "..") != 0 &&
+           strpbrk(file_name, "/\\:") == NULL;
+}
+
+void get_part_path(transmission_t *t, char *path, size_t path_size) {
+    // Named by the transmission too, as senders may send files of the same name at once
+    snprintf(path, path_size, "%s.%08x%s", t->file_name, t->transmission_id, PART_FILE_SUFFIX);
+}
+
+stripe_t *get_stripe(transmission_t *trans, uint32_t packet_index) {
+    return &trans->stripes[packet_index / trans->stripe_length];
+}
+
+void fill_selective_acknowledgment_bitmap(transmission_t *trans, stripe_t *stripe, uint32_t start_index, uint8_t *bitmap, uint16_t bitmap_size) {
+    memset(bitmap, 0, bitmap_size);
+    for (uint32_t i = 0; i < (uint32_t)bitmap_size * 8; i++) {
+        uint32_t packet_index = start_index + i;
+        if (packet_index >= stripe->end_index) {
+            break;
+        }
+        if (is_data_packet_received(trans, packet_index)) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+bool selective_acknowledgment_due(stripe_t *stripe) {
+    if (stripe->pending_ack_count >= SACK_FREQUENCY) {
+        return true;
+    }
+    // Do not make the sender wait for the delayed acknowledgment on the last packets
+    return stripe->cumulative_index >= stripe->end_index;
+}
+
+const uint8_t *decompress_data(transmission_t *t, uint8_t compression, const uint8_t *data, size_t data_size, size_t *decompressed_size) {
+    if (!t->decompressed_data) {
+        t->decompressed_data = malloc(t->chunk_size > 0 ? t->chunk_size : 1);
+        if (!t->decompressed_data) {
+            fprintf(stderr, "Memory allocation failed for decompression\n");
+            return NULL;
+        }
+    }
+
+    if (compression == ZLIB_COMPRESSION) {
+        // Every chunk is a raw deflate stream of its own
+        if (!t->zlib_initialized) {
+            memset(&t->zlib_stream, 0, sizeof(t->zlib_stream));
+            if (inflateInit2(&t->zlib_stream, -MAX_WBITS) != Z_OK) {
+                fprintf(stderr, "Failed to init zlib decompression\n");
+                return NULL;
+            }
+            t->zlib_initialized = true;
+        } else if (inflateReset(&t->zlib_stream) != Z_OK) {
+            return NULL;
+        }
+        t->zlib_stream.next_in = (Bytef *)data;
+        t->zlib_stream.avail_in = (uInt)data_size;
+        t->zlib_stream.next_out = t->decompressed_data;
+        t->zlib_stream.avail_out = t->chunk_size;
+        if (inflate(&t->zlib_stream, Z_FINISH) != Z_STREAM_END) {
+            return NULL;
+        }
+        *decompressed_size = t->chunk_size - t->zlib_stream.avail_out;
+        return t->decompressed_data;
+    }
+#ifdef HAVE_ZSTD
+    if (compression == ZSTD_COMPRESSION) {
+        if (!t->zstd_context) {
+            t->zstd_context = ZSTD_createDCtx();
+            if (!t->zstd_context) {
+                fprintf(stderr, "Failed to create zstd context\n");
+                return NULL;
+            }
+        }
+        size_t size = ZSTD_decompressDCtx(t->zstd_context, t->decompressed_data, t->chunk_size, data, data_size);
+        if (ZSTD_isError(size)) {
+            return NULL;
+        }
+        *decompressed_size = size;
+        return t->decompressed_data;
+    }
+#endif
+    fprintf(stderr, "Error: Unsupported compression method %u\n", compression);
+    return NULL;
+}
+
+bool store_data_packet(transmission_t *t, uint32_t packet_index, const uint8_t *data, size_t data_size) {
+    if (t->part_file) {
+        if (!reserve_data_packet(t, packet_index)) {
+            return false;
+        }
+        // Written at its offset right away, so that memory use does not grow with the file
+        if (!write_file_at(t->part_file, (uint64_t)packet_index * t->chunk_size, data, data_size)) {
+            fprintf(stderr, "Failed to write packet %u to the part file\n", packet_index);
+            return false;
+        }
+        t->received_packets[packet_index / 8] |= (uint8_t)(1 << (packet_index % 8));
+        if (packet_index + 1 == t->total_packet_count) {
+            t->last_packet_size = data_size;
+        }
+    } else {
+        t->data_packets[packet_index] = malloc(data_size > 0 ? data_size : 1);
+        if (!t->data_packets[packet_index]) {
+            fprintf(stderr, "Memory allocation failed for packet %u\n", packet_index);
+            return false;
+        }
+
+        memcpy(t->data_packets[packet_index], data, data_size);
+        t->packet_sizes[packet_index] = data_size;
+    }
+    t->file_size += data_size;
+    t->current_packet_count++;
+    if (packet_index >= t->received_end_index) {
+        t->received_end_index = packet_index + 1;
+    }
+    stripe_t *stripe = get_stripe(t, packet_index);
+    if (stripe->pending_ack_count++ == 0) {
+        stripe->first_pending_time = get_monotonic_milliseconds();
+    }
+
+    // Hash the tree hash leaf as soon as it is complete instead of the whole file at the end
+    if (t->leaf_count > 0) {
+        uint32_t leaf = packet_index / TREE_HASH_LEAF_PACKET_COUNT;
+        if (++t->leaf_packet_counts[leaf] == TREE_HASH_LEAF_PACKET_COUNT) {
+            hash_tree_hash_leaf(t, leaf, t->leaf_hashes[leaf]);
+        }
+    }
+
+    // Advance the cumulative index past every packet of the stripe received in order
+    while (stripe->cumulative_index < stripe->end_index && is_data_packet_received(t, stripe->cumulative_index)) {
+        stripe->cumulative_index++;
+    }
+
+    // Hash the packets received in order right away, so that the end packet does not have to read the whole file back
+    while (t->running_hash && t->hashed_packet_count < stripe->cumulative_index) {
+        uint32_t index = t->hashed_packet_count;
+        const uint8_t *packet_data = index == packet_index ? data : load_data_packet(t, index);
+        if (!packet_data || EVP_DigestUpdate(t->running_hash, packet_data, get_data_packet_size(t, index)) != 1) {
+            fprintf(stderr, "Failed to hash packet %u\n", index);
+            return false;
+        }
+        t->hashed_packet_count++;
+    }
+    return true;
+}
+
+void free_parity_packet(transmission_t *t, size_t parity_slot) {
+    free(t->parity_packets[parity_slot]);
+    t->parity_packets[parity_slot] = NULL;
+}
+
+bool reserve_parity_slot(transmission_t *t, size_t parity_slot) {
+    size_t slot_count = t->parity_slot_count > 0 ? t->parity_slot_count : t->fec_parity_count;
+    while (parity_slot >= slot_count) {
+        slot_count *= 2;
+    }
+    if (slot_count == t->parity_slot_count) {
+        return true;
+    }
+    char **parity_packets = realloc(t->parity_packets, slot_count * sizeof(char *));
+    if (parity_packets) {
+        t->parity_packets = parity_packets;
+    }
+    size_t *parity_sizes = realloc(t->parity_sizes, slot_count * sizeof(size_t));
+    if (parity_sizes) {
+        t->parity_sizes = parity_sizes;
+    }
+    uint16_t *length_parities = realloc(t->length_parities, slot_count * sizeof(uint16_t));
+    if (length_parities) {
+        t->length_parities = length_parities;
+    }
+    if (!parity_packets || !parity_sizes || !length_parities) {
+        fprintf(stderr, "Memory allocation failed for parity packets\n");
+        return false;
+    }
+    // Only the parity data pointers are read before a parity packet fills its slot
+    memset(&t->parity_packets[t->parity_slot_count], 0, (slot_count - t->parity_slot_count) * sizeof(char *));
+    t->parity_slot_count = slot_count;
+    return true;
+}
+
+bool recover_data_packet(transmission_t *t, uint32_t group, uint8_t parity_index) {
+    size_t parity_slot = (size_t)group * t->fec_parity_count + parity_index;
+    if (parity_slot >= t->parity_slot_count || t->parity_packets[parity_slot] == NULL) {
+        return true;
+    }
+
+    // The parity covers every fec_parity_count-th packet of the group
+    uint32_t group_start_index = group * t->fec_group_size;
+    uint32_t group_end_index = group_start_index + t->fec_group_size;
+    if (group_end_index > t->total_packet_count) {
+        group_end_index = t->total_packet_count;
+    }
+    // Packets past the end of a stream would pass for lost ones until a packet past the group shows that it is whole
+    if (!is_packet_count_known(t) && t->received_end_index <= group_end_index) {
+        return true;
+    }
+
+    uint32_t missing_index = 0;
+    int missing_count = 0;
+    for (uint32_t i = group_start_index + parity_index; i < group_end_index; i += t->fec_parity_count) {
+        if (!is_data_packet_received(t, i)) {
+            missing_index = i;
+            missing_count++;
+        }
+    }
+    if (missing_count == 0) {
+        free_parity_packet(t, parity_slot);
+        return true;
+    }
+    if (missing_count > 1) {
+        return true;  // wait for more data packets or the retransmission
+    }
+
+    // XOR the parity with every received packet it covers
+    size_t parity_size = t->parity_sizes[parity_slot];
+    uint8_t *data = (uint8_t *)t->parity_packets[parity_slot];
+    uint16_t data_size = t->length_parities[parity_slot];
+    for (uint32_t i = group_start_index + parity_index; i < group_end_index; i += t->fec_parity_count) {
+        if (i == missing_index) {
+            continue;
+        }
+        const uint8_t *packet_data = load_data_packet(t, i);
+        if (!packet_data) {
+            return false;
+        }
+        size_t packet_size = get_data_packet_size(t, i);
+        for (size_t j = 0; j < packet_size && j < parity_size; j++) {
+            data[j] ^= packet_data[j];
+        }
+        data_size ^= (uint16_t)packet_size;
+    }
+    if (data_size > parity_size) {
+        fprintf(stderr, "Error: Parity of group %u does not match its data packets\n", group);
+        free_parity_packet(t, parity_slot);
+        return true;
+    }
+
+    bool stored = store_data_packet(t, missing_index, data, data_size);
+    free_parity_packet(t, parity_slot);
+    if (stored) {
+        t->recovered_packet_count++;
+        printf("PID: [%u] recovered from parity LEFT: %u\n", missing_index, t->total_packet_count - t->current_packet_count);
+    }
+    return stored;
+}
+
+bool recover_group(transmission_t *t, uint32_t group) {
+    for (uint8_t parity_index = 0; parity_index < t->fec_parity_count; parity_index++) {
+        if (!recover_data_packet(t, group, parity_index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void drop_range(transmission_t *t, uint32_t range) {
+    uint32_t begin = range * TREE_HASH_LEAF_PACKET_COUNT;
+    uint32_t end = begin + TREE_HASH_LEAF_PACKET_COUNT;
+    for (uint32_t i = begin; i < end && i < t->total_packet_count; i++) {
+        if (!is_data_packet_received(t, i)) {
+            continue;
+        }
+        t->file_size -= get_data_packet_size(t, i);
+        t->current_packet_count--;
+        if (t->part_file) {
+            t->received_packets[i / 8] &= (uint8_t)~(1 << (i % 8));
+        } else {
+            free(t->data_packets[i]);
+            t->data_packets[i] = NULL;
+            t->packet_sizes[i] = 0;
+        }
+    }
+    if (t->leaf_count > 0) {
+        t->leaf_packet_counts[range] = 0;
+    }
+    stripe_t *stripe = get_stripe(t, begin);
+    if (stripe->cumulative_index > begin) {
+        stripe->cumulative_index = begin;
+    }
+    // The running hash can not take the dropped packets back, it starts over as they are received again
+    if (t->running_hash && t->hashed_packet_count > begin) {
+        EVP_DigestInit_ex(t->running_hash, EVP_sha256(), NULL);
+        t->hashed_packet_count = 0;
+    }
+}
+
+void get_chunk_path(const uint8_t *hash, char *path, size_t path_size) {
+    int length = snprintf(path, path_size, "%s/", CHUNK_STORE_DIRECTORY);
+    for (int i = 0; i < SHA256_DIGEST_LENGTH && length + 2 < (int)path_size; i++) {
+        length += snprintf(&path[length], path_size - length, "%02x", hash[i]);
+    }
+}
+
+bool store_chunk(const uint8_t *data, size_t data_size) {
+    // The chunk is stored under the hash of the data received, so a damaged chunk can not pass for the one the sender meant
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    if (EVP_Digest(data, data_size, hash, NULL, EVP_sha256(), NULL) != 1) {
+        return false;
+    }
+    char chunk_path[128];
+    get_chunk_path(hash, chunk_path, sizeof(chunk_path));
+    FILE *chunk = fopen(chunk_path, "rb");
+    if (chunk) {
+        fclose(chunk);
+        return true;
+    }
+
+    // Written under a temporary name first, so that an interrupted write does not leave a truncated chunk behind
+    _mkdir(CHUNK_STORE_DIRECTORY);
+    char part_path[136];
+    snprintf(part_path, sizeof(part_path), "%s.part", chunk_path);
+    chunk = fopen(part_path, "wb");
+    if (!chunk) {
+        fprintf(stderr, "Failed to create chunk %s\n", part_path);
+        return false;
+    }
+    bool written = fwrite(data, 1, data_size, chunk) == data_size;
+    written = fclose(chunk) == 0 && written;
+    if (!written || rename(part_path, chunk_path) != 0) {
+        fprintf(stderr, "Failed to store chunk %s\n", chunk_path);
+        remove(part_path);
+        return false;
+    }
+    return true;
+}
+
+uint8_t *apply_delta(transmission_t *t, uint32_t file_size) {
+    // The instructions may span data packets, so they are joined first
+    size_t delta_size = 0;
+    for (uint32_t i = 0; i < t->total_packet_count; i++) {
+        if (t->data_packets[i] == NULL) {
+            return NULL;
+        }
+        delta_size += t->packet_sizes[i];
+    }
+    uint8_t *delta = malloc(delta_size > 0 ? delta_size : 1);
+    uint8_t *file_data = malloc(file_size > 0 ? file_size : 1);
+    if (!delta || !file_data) {
+        fprintf(stderr, "Memory allocation failed for delta\n");
+        free(delta);
+        free(file_data);
+        return NULL;
+    }
+    size_t delta_offset = 0;
+    for (uint32_t i = 0; i < t->total_packet_count; i++) {
+        memcpy(&delta[delta_offset], t->data_packets[i], t->packet_sizes[i]);
+        delta_offset += t->packet_sizes[i];
+    }
+
+    // Copied blocks are read from the existing file, which is overwritten only after it has been rebuilt, it is opened by the first copy
+    FILE *existing_file = NULL;
+    bool valid = true;
+    size_t position = 0;
+    size_t file_offset = 0;
+    while (valid && position < delta_size) {
+        if (delta[position] == DELTA_COPY_INSTRUCTION && delta_size - position >= DELTA_COPY_INSTRUCTION_SIZE) {
+            uint64_t block_offset = (uint64_t)read_uint32(&delta[position + 1]) * t->chunk_size;
+            uint64_t size = (uint64_t)read_uint32(&delta[position + 5]) * t->chunk_size;
+            if (!existing_file) {
+                existing_file = fopen(t->file_name, "rb");
+            }
+            valid = existing_file != NULL && size <= file_size - file_offset &&
+                    _fseeki64(existing_file, (int64_t)block_offset, SEEK_SET) == 0 &&
+                    fread(&file_data[file_offset], 1, size, existing_file) == size;
+            file_offset += size;
+            position += DELTA_COPY_INSTRUCTION_SIZE;
+        } else if (delta[position] == DELTA_LITERAL_INSTRUCTION && delta_size - position >= DELTA_LITERAL_INSTRUCTION_SIZE) {
+            uint32_t size = read_uint32(&delta[position + 1]);
+            position += DELTA_LITERAL_INSTRUCTION_SIZE;
+            valid = size <= delta_size - position && size <= file_size - file_offset;
+            if (valid) {
+                memcpy(&file_data[file_offset], &delta[position], size);
+                // Every literal of a deduplicated file is a chunk missing from the chunk store, a later stored chunk instruction may refer to it already
+                if (t->flags & DEDUP_FLAG) {
+                    store_chunk(&delta[position], size);
+                }
+            }
+            file_offset += size;
+            position += size;
+        } else if (delta[position] == DELTA_STORED_CHUNK_INSTRUCTION && delta_size - position >= DELTA_STORED_CHUNK_INSTRUCTION_SIZE) {
+            char chunk_path[128];
+            get_chunk_path(&delta[position + 1], chunk_path, sizeof(chunk_path));
+            FILE *chunk = fopen(chunk_path, "rb");
+            valid = chunk != NULL && _fseeki64(chunk, 0, SEEK_END) == 0;
+            if (valid) {
+                int64_t size = _ftelli64(chunk);
+                valid = size >= 0 && (uint64_t)size <= file_size - file_offset &&
+                        _fseeki64(chunk, 0, SEEK_SET) == 0 &&
+                        fread(&file_data[file_offset], 1, (size_t)size, chunk) == (size_t)size;
+                file_offset += size;
+            }
+            if (chunk) {
+                fclose(chunk);
+            }
+            position += DELTA_STORED_CHUNK_INSTRUCTION_SIZE;
+        } else {
+            valid = false;
+        }
+    }
+
+    if (existing_file) {
+        fclose(existing_file);
+    }
+    free(delta);
+    if (!valid || file_offset != file_size) {
+        fprintf(stderr, "Delta instructions do not match the existing file %s or the chunk store\n", t->file_name);
+        free(file_data);
+        return NULL;
+    }
+    return file_data;
+}
+
+void free_transmission(transmission_t **trans) {
+    transmission_t *t = *trans;
+    for (uint32_t i = 0; t->data_packets && i < t->total_packet_count; i++) {
+        free(t->data_packets[i]);
+    }
+    // The part file of a transmission which did not finish is not needed anymore
+    if (t->part_file) {
+        char part_path[MAX_PART_PATH_LENGTH];
+        get_part_path(t, part_path, sizeof(part_path));
+        fclose(t->part_file);
+        remove(part_path);
+    }
+    free(t->received_packets);
+    free(t->packet_buffer);
+    EVP_MD_CTX_free(t->running_hash);
+    for (size_t i = 0; i < t->parity_slot_count; i++) {
+        free(t->parity_packets[i]);
+    }
+    free(t->range_states);
+    free(t->decompressed_data);
+    if (t->zlib_initialized) {
+        inflateEnd(&t->zlib_stream);
+    }
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(t->zstd_context);
+#endif
+    free(t->leaf_hashes);
+    free(t->leaf_packet_counts);
+    free(t->parity_packets);
+    free(t->parity_sizes);
+    free(t->length_parities);
+    free(t->data_packets);
+    free(t->packet_sizes);
+    free(t);
+    *trans = NULL;
+}
+
+uint16_t read_uint16(const uint8_t *buffer) {
+    return (uint16_t)(buffer[0] << 8 | buffer[1]);
+}
+
+uint32_t read_uint32(const uint8_t *buffer) {
+    return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 | (uint32_t)buffer[2] << 8 | buffer[3];
+}
+
+uint64_t read_uint64(const uint8_t *buffer) {
+    return (uint64_t)read_uint32(&buffer[0]) << 32 | read_uint32(&buffer[4]);
+}
+
+int parse_packet(const uint8_t *buffer, size_t recv_len, packet_view_t *packet) {
+    if (recv_len < PACKET_HEADER_LEN + CRC32_LEN) {
+        return PACKET_MALFORMED;
+    }
+
+    // The header is read even from a corrupted packet so that it can be answered by a negative acknowledgment
+    packet->packet_type = buffer[0];
+    packet->transmission_id = read_uint32(&buffer[1]);
+    packet->content = &buffer[PACKET_HEADER_LEN];
+    packet->content_length = recv_len - PACKET_HEADER_LEN - CRC32_LEN;
+    if (!validate_crc32(buffer, recv_len - CRC32_LEN, read_uint32(&buffer[recv_len - CRC32_LEN]))) {
+        return PACKET_CORRUPTED;
+    }
+
+    const uint8_t *content = packet->content;
+    size_t length = packet->content_length;
+    switch (packet->packet_type) {
+        case TRANSMISSION_START_PACKET_TYPE: {
+            // 4 total packet count, 2 chunk size, 1 flags, 4 stripe length if the file is sent in stripes, file name
+            start_packet_view_t *start = &packet->as.start;
+            if (length < 7) {
+                return PACKET_MALFORMED;
+            }
+            start->total_packet_count = read_uint32(&content[0]);
+            start->chunk_size = read_uint16(&content[4]);
+            start->flags = content[6];
+            size_t file_name_offset = 7;
+            start->stripe_length = 0;
+            if (start->flags & STRIPE_FLAG) {
+                if (length < 11) {
+                    return PACKET_MALFORMED;
+                }
+                start->stripe_length = read_uint32(&content[7]);
+                file_name_offset += sizeof(uint32_t);
+            }
+            start->file_name = (const char *)&content[file_name_offset];
+            start->file_name_length = strnlen(start->file_name, length - file_name_offset);
+            break;
+        }
+        case TRANSMISSION_DATA_PACKET_TYPE:
+            // 4 index, data
+            if (length < 4) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.data.index = read_uint32(&content[0]);
+            packet->as.data.compression = NO_COMPRESSION;
+            packet->as.data.data = &content[4];
+            packet->as.data.data_size = length - 4;
+            break;
+        case TRANSMISSION_COMPRESSED_PACKET_TYPE:
+            // 4 index, 1 compression method, compressed data
+            if (length < 5) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.data.index = read_uint32(&content[0]);
+            packet->as.data.compression = content[4];
+            packet->as.data.data = &content[5];
+            packet->as.data.data_size = length - 5;
+            break;
+        case TRANSMISSION_END_PACKET_TYPE:
+            // 4 file size, or 8 with LARGE_FILE_FLAG, SHA-256
+            if (length < 4 + SHA256_DIGEST_LENGTH) {
+                return PACKET_MALFORMED;
+            }
+            if (length >= 8 + SHA256_DIGEST_LENGTH) {
+                packet->as.end.file_size = read_uint64(&content[0]);
+                packet->as.end.file_hash = &content[8];
+            } else {
+                packet->as.end.file_size = read_uint32(&content[0]);
+                packet->as.end.file_hash = &content[4];
+            }
+            break;
+        case TRANSMISSION_PARITY_PACKET_TYPE:
+            // 4 group start, 2 group size, 1 count, 1 index, 2 length parity, data
+            if (length < 10) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.parity.group_start_index = read_uint32(&content[0]);
+            packet->as.parity.group_size = read_uint16(&content[4]);
+            packet->as.parity.parity_count = content[6];
+            packet->as.parity.parity_index = content[7];
+            packet->as.parity.length_parity = read_uint16(&content[8]);
+            packet->as.parity.data = &content[10];
+            packet->as.parity.data_size = length - 10;
+            break;
+        case TRANSMISSION_DIGESTS_PACKET_TYPE:
+            // 1 repair round, 4 first range index, 2 range count, digests
+            if (length < 7) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.digests.repair_round = content[0];
+            packet->as.digests.first_range_index = read_uint32(&content[1]);
+            packet->as.digests.range_count = read_uint16(&content[5]);
+            packet->as.digests.digests = &content[7];
+            if (packet->as.digests.range_count > MAX_RANGE_DIGEST_COUNT ||
+                length < 7 + (size_t)packet->as.digests.range_count * SHA256_DIGEST_LENGTH) {
+                return PACKET_MALFORMED;
+            }
+            break;
+        case TRANSMISSION_SIGNATURE_REQUEST_PACKET_TYPE:
+            // 4 first block index, 2 block size, file name
+            if (length < 6) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.signature_request.first_block_index = read_uint32(&content[0]);
+            packet->as.signature_request.block_size = read_uint16(&content[4]);
+            packet->as.signature_request.file_name = (const char *)&content[6];
+            packet->as.signature_request.file_name_length = strnlen(packet->as.signature_request.file_name, length - 6);
+            break;
+        case TRANSMISSION_CHUNK_QUERY_PACKET_TYPE:
+            // 4 first chunk index, 1 chunk count, hashes
+            if (length < 5) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.chunk_query.first_chunk_index = read_uint32(&content[0]);
+            packet->as.chunk_query.chunk_count = content[4];
+            packet->as.chunk_query.hashes = &content[5];
+            if (packet->as.chunk_query.chunk_count > MAX_CHUNK_HASH_COUNT ||
+                length < 5 + (size_t)packet->as.chunk_query.chunk_count * SHA256_DIGEST_LENGTH) {
+                return PACKET_MALFORMED;
+            }
+            break;
+        case TRANSMISSION_MANIFEST_PACKET_TYPE:
+            // 4 file count
+            if (length < 4) {
+                return PACKET_MALFORMED;
+            }
+            packet->as.manifest.file_count = read_uint32(&content[0]);
+            break;
+    }
+    return PACKET_VALID;
+}
+
+int process_packet_start_0x00(const packet_view_t *packet, transmission_t **trans) {
+    // The sender gave up repairing the previous transmission and sends the file once again
+    if (*trans && (*trans)->repairing) {
+        printf("Dropping transmission %u which failed to be repaired\n", (*trans)->transmission_id);
+        free_transmission(trans);
+    }
+
     if (*trans) {
-        fprintf(stderr, "Error: Received start packet while another transmission is in progress.\n");
+        printf("Start packet of transmission %u received again\n", (*trans)->transmission_id);
         return CONTINUE_TRANSMISSION;
     }
 
@@ -65,24 +808,151 @@ int process_packet_start_0x00(uint8_t *buffer, transmission_t **trans) {
     }
 
     // Save the transmission ID, total packet count, and file name
-    memcpy(&(*trans)->transmission_id, &buffer[1], sizeof(uint32_t));
-    memcpy(&(*trans)->total_packet_count, &buffer[5], sizeof(uint32_t));
-    strncpy((*trans)->file_name, (char *)&buffer[9], sizeof((*trans)->file_name) - 1);
-    (*trans)->file_name[sizeof((*trans)->file_name) - 1] = '\0';
+    const start_packet_view_t *start = &packet->as.start;
+    (*trans)->transmission_id = packet->transmission_id;
+    (*trans)->total_packet_count = start->total_packet_count;
+    (*trans)->chunk_size = start->chunk_size;
+    (*trans)->flags = start->flags;
+    (*trans)->stripe_length = start->stripe_length;
+    size_t file_name_length = start->file_name_length;
+    if (file_name_length > sizeof((*trans)->file_name) - 1) {
+        file_name_length = sizeof((*trans)->file_name) - 1;
+    }
+    memcpy((*trans)->file_name, start->file_name, file_name_length);
+    (*trans)->file_name[file_name_length] = '\0';
+    if (!is_plain_file_name((*trans)->file_name)) {
+        fprintf(stderr, "Error: File name %s is not a plain file name\n", (*trans)->file_name);
+        free(*trans);
+        *trans = NULL;
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
 
-    (*trans)->transmission_id = ntohl((*trans)->transmission_id);
-    (*trans)->total_packet_count = ntohl((*trans)->total_packet_count);
+    // A stream is written to its part file like a large file, neither the tree hash nor stripes nor a delta can be laid out without its length
+    if ((*trans)->flags & STREAM_FLAG) {
+        if (!((*trans)->flags & LARGE_FILE_FLAG) || ((*trans)->flags & (TREE_HASH_FLAG | STRIPE_FLAG | DELTA_FLAG | DEDUP_FLAG)) || (*trans)->chunk_size == 0) {
+            fprintf(stderr, "Error: Invalid flags 0x%02x or chunk size of a stream\n", (*trans)->flags);
+            free(*trans);
+            *trans = NULL;
+            return CONTINUE_TRANSMISSION_NO_ACK;
+        }
+        (*trans)->total_packet_count = UNKNOWN_PACKET_COUNT;
+        printf("Transmission Start: ID %u, Packets unknown, Chunk size %u, File %s\n", (*trans)->transmission_id, (*trans)->chunk_size, (*trans)->file_name);
+    } else {
+        printf("Transmission Start: ID %u, Packets %u, Chunk size %u, File %s\n", (*trans)->transmission_id, (*trans)->total_packet_count, (*trans)->chunk_size, (*trans)->file_name);
+    }
 
-    printf("Transmission Start: ID %u, Packets %u, File %s\n", (*trans)->transmission_id, (*trans)->total_packet_count, (*trans)->file_name);
+    // Without stripes the whole file is a single stripe
+    if (!((*trans)->flags & STRIPE_FLAG) || (*trans)->stripe_length == 0) {
+        (*trans)->stripe_length = (*trans)->total_packet_count > 0 ? (*trans)->total_packet_count : 1;
+    }
+    uint32_t stripe_count = (uint32_t)(((uint64_t)(*trans)->total_packet_count + (*trans)->stripe_length - 1) / (*trans)->stripe_length);
+    if (stripe_count > MAX_STRIPE_COUNT) {
+        fprintf(stderr, "Error: %u stripes, at most %d are supported\n", stripe_count, MAX_STRIPE_COUNT);
+        free(*trans);
+        *trans = NULL;
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+    (*trans)->stripe_count = stripe_count;
 
-    (*trans)->data_packets = calloc((*trans)->total_packet_count, sizeof(char *));
-    (*trans)->packet_sizes = calloc((*trans)->total_packet_count, sizeof(size_t));
+    // The file is rebuilt in its part file instead of memory, only a delta needs all of its instructions in memory
+    bool delta = (*trans)->flags & (DELTA_FLAG | DEDUP_FLAG);
+    if (((*trans)->flags & LARGE_FILE_FLAG) && delta) {
+        fprintf(stderr, "Error: A large file can not be sent as a delta\n");
+        free(*trans);
+        *trans = NULL;
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+    (*trans)->data_packets = NULL;
+    (*trans)->packet_sizes = NULL;
+    (*trans)->part_file = NULL;
+    (*trans)->received_packets = NULL;
+    (*trans)->received_capacity = 0;
+    (*trans)->received_end_index = 0;
+    (*trans)->last_packet_size = 0;
+    (*trans)->packet_buffer = NULL;
+    (*trans)->running_hash = NULL;
+    (*trans)->hashed_packet_count = 0;
+    if (!delta) {
+        char part_path[MAX_PART_PATH_LENGTH];
+        get_part_path(*trans, part_path, sizeof(part_path));
+        (*trans)->part_file = fopen(part_path, "w+b");
+        (*trans)->received_capacity = (*trans)->flags & STREAM_FLAG ? STREAM_BITMAP_INITIAL_SIZE : ((size_t)(*trans)->total_packet_count + 7) / 8 + 1;
+        (*trans)->received_packets = calloc((*trans)->received_capacity, sizeof(uint8_t));
+        (*trans)->packet_buffer = malloc((*trans)->chunk_size > 0 ? (*trans)->chunk_size : 1);
+        if (!(*trans)->part_file) {
+            fprintf(stderr, "Failed to create the part file %s\n", part_path);
+            free((*trans)->received_packets);
+            free((*trans)->packet_buffer);
+            free(*trans);
+            *trans = NULL;
+            return CONTINUE_TRANSMISSION_NO_ACK;
+        }
+    } else {
+        (*trans)->data_packets = calloc((*trans)->total_packet_count, sizeof(char *));
+        (*trans)->packet_sizes = calloc((*trans)->total_packet_count, sizeof(size_t));
+    }
     (*trans)->file_size = 0;
     (*trans)->current_packet_count = 0;
+    for (uint8_t i = 0; i < (*trans)->stripe_count; i++) {
+        stripe_t *stripe = &(*trans)->stripes[i];
+        stripe->cumulative_index = i * (*trans)->stripe_length;
+        stripe->end_index = stripe->cumulative_index + (*trans)->stripe_length;
+        if (stripe->end_index > (*trans)->total_packet_count) {
+            stripe->end_index = (*trans)->total_packet_count;
+        }
+        stripe->pending_ack_count = 0;
+        stripe->reply_port = 0;
+    }
+    (*trans)->fec_group_size = 0;
+    (*trans)->fec_parity_count = 0;
+    (*trans)->parity_packets = NULL;
+    (*trans)->parity_sizes = NULL;
+    (*trans)->length_parities = NULL;
+    (*trans)->parity_slot_count = 0;
+    (*trans)->recovered_packet_count = 0;
+    (*trans)->leaf_count = 0;
+    (*trans)->leaf_hashes = NULL;
+    (*trans)->leaf_packet_counts = NULL;
+    (*trans)->repairing = false;
+    (*trans)->repair_round = 0;
+    (*trans)->range_states = NULL;
+    (*trans)->decompressed_data = NULL;
+    (*trans)->zlib_initialized = false;
+#ifdef HAVE_ZSTD
+    (*trans)->zstd_context = NULL;
+#endif
+    if (delta ? !(*trans)->data_packets || !(*trans)->packet_sizes : !(*trans)->received_packets || !(*trans)->packet_buffer) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return STOP_TRANSMISSION;
+    }
+    // Reserve the disk space up to the last data packet, whose size is not known yet, so that a full disk shows now and not halfway through
+    if ((*trans)->part_file && is_packet_count_known(*trans) && (*trans)->total_packet_count > 1 &&
+        !preallocate_file((*trans)->part_file, (uint64_t)((*trans)->total_packet_count - 1) * (*trans)->chunk_size)) {
+        fprintf(stderr, "Failed to preallocate %llu bytes for %s\n",
+            (unsigned long long)((*trans)->total_packet_count - 1) * (*trans)->chunk_size, (*trans)->file_name);
+        return STOP_TRANSMISSION;
+    }
+    // The SHA-256 of the file follows the data packets as they arrive in order, the tree hash hashes its leaves instead
+    if ((*trans)->part_file && !((*trans)->flags & TREE_HASH_FLAG)) {
+        (*trans)->running_hash = EVP_MD_CTX_new();
+        if (!(*trans)->running_hash || EVP_DigestInit_ex((*trans)->running_hash, EVP_sha256(), NULL) != 1) {
+            fprintf(stderr, "Failed to create EVP_MD_CTX\n");
+            return STOP_TRANSMISSION;
+        }
+    }
+    if ((*trans)->flags & TREE_HASH_FLAG) {
+        (*trans)->leaf_count = ((*trans)->total_packet_count + TREE_HASH_LEAF_PACKET_COUNT - 1) / TREE_HASH_LEAF_PACKET_COUNT;
+        (*trans)->leaf_hashes = calloc((*trans)->leaf_count, SHA256_DIGEST_LENGTH);
+        (*trans)->leaf_packet_counts = calloc((*trans)->leaf_count, sizeof(uint16_t));
+        if (!(*trans)->leaf_hashes || !(*trans)->leaf_packet_counts) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return STOP_TRANSMISSION;
+        }
+    }
     return CONTINUE_TRANSMISSION;
 }
 
-int process_packet_data_0x01(uint8_t *buffer, transmission_t **trans, ssize_t recv_len, uint32_t *packet_index_address) {
+int process_packet_data_0x01(const packet_view_t *packet, transmission_t **trans) {
     if (!*trans) {
         fprintf(stderr, "Error: Received data packet before transmission start.\n");
         return CONTINUE_TRANSMISSION_NO_ACK;
@@ -90,23 +960,17 @@ int process_packet_data_0x01(uint8_t *buffer, transmission_t **trans, ssize_t re
 
     transmission_t *t = *trans;  // cleaner to dereference once
 
-    // Save the transmission ID and packet index
-    uint32_t transmission_id, packet_index;
-    memcpy(&transmission_id, &buffer[1], sizeof(uint32_t));
-    memcpy(&packet_index, &buffer[5], sizeof(uint32_t));
-
-    transmission_id = ntohl(transmission_id);
-    packet_index = ntohl(packet_index);
-    *packet_index_address = packet_index;
+    uint32_t transmission_id = packet->transmission_id;
+    uint32_t packet_index = packet->as.data.index;
 
     if (packet_index >= t->total_packet_count) {
         fprintf(stderr, "Error: Packet index %u out of bounds\n", packet_index);
         return CONTINUE_TRANSMISSION_NO_ACK;
     }
 
-    if (t->data_packets[packet_index] != NULL) {
+    if (is_data_packet_received(t, packet_index)) {
         printf("Packet %u already received, sending acknowledgment\n", packet_index);
-        return CONTINUE_TRANSMISSION;
+        return CONTINUE_TRANSMISSION_DUPLICATE;
     }
 
     if (transmission_id != t->transmission_id) {
@@ -114,53 +978,333 @@ int process_packet_data_0x01(uint8_t *buffer, transmission_t **trans, ssize_t re
         return CONTINUE_TRANSMISSION_NO_ACK;
     }
 
-    // Load the data
-    size_t data_size = recv_len - 13;  // 1 byte type, 4 ID, 4 index, 4 CRC32
-    t->data_packets[packet_index] = malloc(data_size);
-    if (!t->data_packets[packet_index]) {
-        fprintf(stderr, "Memory allocation failed for packet %u\n", packet_index);
+    // Load the data, the hashes cover the decompressed data
+    const uint8_t *data = packet->as.data.data;
+    size_t data_size = packet->as.data.data_size;
+    if (packet->as.data.compression != NO_COMPRESSION) {
+        data = decompress_data(t, packet->as.data.compression, data, data_size, &data_size);
+        if (!data) {
+            fprintf(stderr, "Error: Packet %u failed to be decompressed\n", packet_index);
+            return CONTINUE_TRANSMISSION_NO_ACK;
+        }
+    }
+    if (data_size > t->chunk_size) {
+        fprintf(stderr, "Error: Packet %u carries %zu bytes, more than the chunk size %u\n", packet_index, data_size, t->chunk_size);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+    // The first data packet shorter than the chunk size is the last one of a stream
+    if (!is_packet_count_known(t) && data_size < t->chunk_size) {
+        if (packet_index < t->received_end_index) {
+            fprintf(stderr, "Error: Packet %u ends the stream before packets received past it\n", packet_index);
+            return CONTINUE_TRANSMISSION_NO_ACK;
+        }
+        set_packet_count(t, packet_index + 1, data_size);
+    }
+    // Packets are written at multiples of the chunk size into the part file
+    if (t->part_file && data_size != t->chunk_size && packet_index + 1 != t->total_packet_count) {
+        fprintf(stderr, "Error: Packet %u carries %zu bytes, the chunk size %u was expected\n", packet_index, data_size, t->chunk_size);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+    if (!store_data_packet(t, packet_index, data, data_size)) {
         return STOP_TRANSMISSION;
     }
 
-    memcpy(t->data_packets[packet_index], &buffer[9], data_size);
-    t->packet_sizes[packet_index] = data_size;
-    t->file_size += data_size;
-    t->current_packet_count++;
-
     printf("PID: [%u] LEFT: %u TID: %u\n", packet_index, t->total_packet_count - t->current_packet_count, transmission_id);
+
+    // The packet may complete a parity group with one other packet missing
+    if (t->fec_group_size > 0) {
+        uint32_t group = packet_index / t->fec_group_size;
+        uint8_t parity_index = (packet_index % t->fec_group_size) % t->fec_parity_count;
+        if (!is_packet_count_known(t)) {
+            // The previous group of a stream can be recovered only once a packet past it arrives
+            if (!recover_group(t, group) || (group > 0 && !recover_group(t, group - 1))) {
+                return STOP_TRANSMISSION;
+            }
+        } else if (!recover_data_packet(t, group, parity_index)) {
+            return STOP_TRANSMISSION;
+        }
+    }
+    return CONTINUE_TRANSMISSION;
+}
+
+int process_packet_parity_0x07(const packet_view_t *packet, transmission_t **trans) {
+    if (!*trans) {
+        fprintf(stderr, "Error: Received parity packet before transmission start.\n");
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    transmission_t *t = *trans;
+
+    // The group described by the parity
+    uint32_t transmission_id = packet->transmission_id;
+    uint32_t group_start_index = packet->as.parity.group_start_index;
+    uint16_t group_size = packet->as.parity.group_size;
+    uint8_t parity_count = packet->as.parity.parity_count;
+    uint8_t parity_index = packet->as.parity.parity_index;
+
+    if (transmission_id != t->transmission_id) {
+        fprintf(stderr, "Error: Transmission ID mismatch. Got %u, expected %u\n", transmission_id, t->transmission_id);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    if (group_size == 0 || parity_count == 0 || parity_count > group_size || parity_index >= parity_count ||
+        group_start_index % group_size != 0 || group_start_index >= t->total_packet_count) {
+        fprintf(stderr, "Error: Invalid parity packet of group starting at %u\n", group_start_index);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    // The first parity packet tells us the shape of the groups
+    if (t->fec_group_size == 0) {
+        // The parity arrays of a stream grow with it
+        t->fec_group_size = group_size;
+        t->fec_parity_count = parity_count;
+        if (is_packet_count_known(t)) {
+            uint32_t group_count = (t->total_packet_count + group_size - 1) / group_size;
+            t->parity_packets = calloc((size_t)group_count * parity_count, sizeof(char *));
+            t->parity_sizes = calloc((size_t)group_count * parity_count, sizeof(size_t));
+            t->length_parities = calloc((size_t)group_count * parity_count, sizeof(uint16_t));
+            if (!t->parity_packets || !t->parity_sizes || !t->length_parities) {
+                fprintf(stderr, "Memory allocation failed for parity packets\n");
+                return STOP_TRANSMISSION;
+            }
+            t->parity_slot_count = (size_t)group_count * parity_count;
+        }
+    } else if (group_size != t->fec_group_size || parity_count != t->fec_parity_count) {
+        fprintf(stderr, "Error: Parity group shape changed during the transmission\n");
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    size_t data_size = packet->as.parity.data_size;
+    if (data_size > t->chunk_size) {
+        fprintf(stderr, "Error: Parity packet carries %zu bytes, more than the chunk size %u\n", data_size, t->chunk_size);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    uint32_t group = group_start_index / group_size;
+    size_t parity_slot = (size_t)group * parity_count + parity_index;
+    if (!reserve_parity_slot(t, parity_slot)) {
+        return STOP_TRANSMISSION;
+    }
+    if (t->parity_packets[parity_slot] != NULL) {
+        return CONTINUE_TRANSMISSION;
+    }
+    t->parity_packets[parity_slot] = malloc(data_size > 0 ? data_size : 1);
+    if (!t->parity_packets[parity_slot]) {
+        fprintf(stderr, "Memory allocation failed for parity packet\n");
+        return STOP_TRANSMISSION;
+    }
+    memcpy(t->parity_packets[parity_slot], packet->as.parity.data, data_size);
+    t->parity_sizes[parity_slot] = data_size;
+    t->length_parities[parity_slot] = packet->as.parity.length_parity;
+
+    if (!recover_data_packet(t, group, parity_index)) {
+        return STOP_TRANSMISSION;
+    }
+    return CONTINUE_TRANSMISSION;
+}
+
+int process_packet_digests_0x08(const packet_view_t *packet, transmission_t **trans, uint8_t *bitmap) {
+    if (!*trans || !(*trans)->repairing) {
+        fprintf(stderr, "Error: Received range digests packet without a transmission to repair.\n");
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    transmission_t *t = *trans;
+
+    if (packet->transmission_id != t->transmission_id) {
+        fprintf(stderr, "Error: Transmission ID mismatch. Got %u, expected %u\n", packet->transmission_id, t->transmission_id);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    // The digest count is checked against the packet length by the parser
+    uint8_t repair_round = packet->as.digests.repair_round;
+    uint32_t first_range_index = packet->as.digests.first_range_index;
+    uint16_t range_count = packet->as.digests.range_count;
+
+    uint32_t total_range_count = (t->total_packet_count + TREE_HASH_LEAF_PACKET_COUNT - 1) / TREE_HASH_LEAF_PACKET_COUNT;
+    if (first_range_index >= total_range_count || range_count > total_range_count - first_range_index) {
+        fprintf(stderr, "Error: Malformed range digests packet\n");
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    if (!t->range_states) {
+        t->range_states = calloc(total_range_count, sizeof(uint8_t));
+        if (!t->range_states) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return STOP_TRANSMISSION;
+        }
+    }
+    if (repair_round != t->repair_round) {
+        t->repair_round = repair_round;
+        memset(t->range_states, RANGE_UNCHECKED, total_range_count);
+    }
+
+    // A resent range digests packet gets the same answer, its ranges may be partially received again by now
+    memset(bitmap, 0, (MAX_RANGE_DIGEST_COUNT + 7) / 8);
+    for (uint16_t i = 0; i < range_count; i++) {
+        uint32_t range = first_range_index + i;
+        if (t->range_states[range] == RANGE_UNCHECKED) {
+            unsigned char range_hash[SHA256_DIGEST_LENGTH];
+            hash_tree_hash_leaf(t, range, range_hash);
+            if (memcmp(range_hash, &packet->as.digests.digests[i * SHA256_DIGEST_LENGTH], SHA256_DIGEST_LENGTH) == 0) {
+                t->range_states[range] = RANGE_INTACT;
+            } else {
+                printf("Range %u is damaged\n", range);
+                drop_range(t, range);
+                t->range_states[range] = RANGE_DAMAGED;
+            }
+        }
+        if (t->range_states[range] == RANGE_DAMAGED) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    return CONTINUE_TRANSMISSION;
+}
+
+int process_packet_signature_request_0x0C(const packet_view_t *packet, uint32_t *file_size, uint8_t *signatures, uint8_t *signature_count) {
+    const signature_request_packet_view_t *request = &packet->as.signature_request;
+    *file_size = 0;
+    *signature_count = 0;
+    if (request->block_size == 0) {
+        fprintf(stderr, "Error: Malformed signature request packet\n");
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    char file_name[1024];
+    size_t file_name_length = request->file_name_length;
+    if (file_name_length > sizeof(file_name) - 1) {
+        file_name_length = sizeof(file_name) - 1;
+    }
+    memcpy(file_name, request->file_name, file_name_length);
+    file_name[file_name_length] = '\0';
+    if (!is_plain_file_name(file_name)) {
+        fprintf(stderr, "Error: File name %s is not a plain file name\n", file_name);
+        return CONTINUE_TRANSMISSION_NO_ACK;
+    }
+
+    // Without an existing file the answer carries no signatures and the sender sends the whole file
+    FILE *file = fopen(file_name, "rb");
+    if (!file) {
+        printf("No existing file %s to send the block signatures of\n", file_name);
+        return CONTINUE_TRANSMISSION;
+    }
+    if (_fseeki64(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return CONTINUE_TRANSMISSION;
+    }
+    // A copy too large for the 32-bit size of the answer is treated as missing, a large file is never sent as a delta anyway
+    int64_t copy_size = _ftelli64(file);
+    if (copy_size < 0 || copy_size > UINT32_MAX) {
+        printf("Existing file %s is too large to send the block signatures of\n", file_name);
+        fclose(file);
+        return CONTINUE_TRANSMISSION;
+    }
+    *file_size = (uint32_t)copy_size;
+
+    // Only the full blocks have signatures
+    uint32_t block_count = *file_size / request->block_size;
+    if (request->first_block_index < block_count) {
+        uint32_t count = block_count - request->first_block_index;
+        if (count > SIGNATURES_PER_PACKET) {
+            count = SIGNATURES_PER_PACKET;
+        }
+        uint8_t *block = malloc(request->block_size);
+        if (!block) {
+            fprintf(stderr, "Memory allocation failed\n");
+            fclose(file);
+            return STOP_TRANSMISSION;
+        }
+        if (_fseeki64(file, (int64_t)request->first_block_index * request->block_size, SEEK_SET) == 0) {
+            for (uint32_t i = 0; i < count && fread(block, 1, request->block_size, file) == request->block_size; i++) {
+                uint8_t *signature = &signatures[i * BLOCK_SIGNATURE_SIZE];
+                uint32_t weak_checksum = calculate_weak_checksum(block, request->block_size);
+                uint64_t strong_checksum = calculate_strong_checksum(block, request->block_size);
+                for (int j = 0; j < 4; j++) {
+                    signature[j] = (uint8_t)(weak_checksum >> (24 - 8 * j));
+                }
+                for (int j = 0; j < STRONG_CHECKSUM_SIZE; j++) {
+                    signature[4 + j] = (uint8_t)(strong_checksum >> (8 * (STRONG_CHECKSUM_SIZE - 1 - j)));
+                }
+                (*signature_count)++;
+            }
+        }
+        free(block);
+    }
+    fclose(file);
     return CONTINUE_TRANSMISSION;
 }
 
-int process_packet_end_0x02(uint8_t *buffer, transmission_t **trans, boolean *file_saved) {
-    if (*file_saved) {
-        return STOP_TRANSMISSION_SUCCESS;
+int process_packet_chunk_query_0x0E(const packet_view_t *packet, uint8_t *bitmap) {
+    const chunk_query_packet_view_t *query = &packet->as.chunk_query;
+    memset(bitmap, 0, (MAX_CHUNK_HASH_COUNT + 7) / 8);
+    for (uint8_t i = 0; i < query->chunk_count; i++) {
+        char chunk_path[128];
+        get_chunk_path(&query->hashes[i * SHA256_DIGEST_LENGTH], chunk_path, sizeof(chunk_path));
+        FILE *chunk = fopen(chunk_path, "rb");
+        if (chunk) {
+            fclose(chunk);
+        } else {
+            bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
+        }
     }
+    return CONTINUE_TRANSMISSION;
+}
 
+int process_packet_end_0x02(const packet_view_t *packet, transmission_t **trans) {
     if (!*trans) {
         fprintf(stderr, "Error: Received end packet before transmission start.\n");
         return CONTINUE_TRANSMISSION_NO_ACK;
     }
 
-    // Save the transmission ID and file size
-    memcpy(&(*trans)->file_size, &buffer[5], sizeof(uint32_t));
-    (*trans)->file_size = ntohl((*trans)->file_size);
-    memcpy((*trans)->file_hash, &buffer[9], SHA256_DIGEST_LENGTH);
+    // Save the file size and hash
+    (*trans)->file_size = packet->as.end.file_size;
+    memcpy((*trans)->file_hash, packet->as.end.file_hash, SHA256_DIGEST_LENGTH);
+
+    // The end packet tells the length of a stream, a mismatch with the data packets received shows in the hash
+    if ((*trans)->flags & STREAM_FLAG) {
+        uint64_t packet_count = (*trans)->file_size / (*trans)->chunk_size + 1;
+        if (packet_count >= UNKNOWN_PACKET_COUNT) {
+            fprintf(stderr, "Error: Stream of %llu bytes has too many packets\n", (unsigned long long)(*trans)->file_size);
+            return CONTINUE_TRANSMISSION_NO_ACK;
+        }
+        if (packet_count != (*trans)->total_packet_count) {
+            set_packet_count(*trans, (uint32_t)packet_count, (*trans)->file_size % (*trans)->chunk_size);
+        }
+    }
 
     printf("File hash received\n");
     printf("Transmission ID: %u\n", (*trans)->transmission_id);
-    printf("File Size: %u\n", (*trans)->file_size);
+    printf("File Size: %llu\n", (unsigned long long)(*trans)->file_size);
 
-    printf("End Packet: File Size: %u bytes, SHA-256: ", (*trans)->file_size);
+    printf("End Packet: File Size: %llu bytes, SHA-256: ", (unsigned long long)(*trans)->file_size);
     for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
         printf("%02x", (*trans)->file_hash[i]);
     }
     printf("\n");
 
-    // Validate SHA
+    // The file is rebuilt in memory next to the delta, both have to fit the memory budget of the session checked at the start
+    if (((*trans)->flags & (DELTA_FLAG | DEDUP_FLAG)) &&
+        (uint64_t)(*trans)->total_packet_count * (*trans)->chunk_size + (*trans)->file_size > SESSION_MEMORY_BUDGET) {
+        fprintf(stderr, "Error: Refusing to rebuild the file of %llu bytes of transmission %u, more than the memory budget of a session\n",
+            (unsigned long long)(*trans)->file_size, (*trans)->transmission_id);
+        return STOP_TRANSMISSION;
+    }
+
+    // Validate SHA, a delta is applied to the existing file or the chunk store first and the file it rebuilds is checked
     unsigned char file_hash[SHA256_DIGEST_LENGTH];
-    calculate_sha256_from_packets(*trans, file_hash);
+    memset(file_hash, 0, SHA256_DIGEST_LENGTH);
+    uint8_t *file_data = NULL;
+    bool hash_computed = true;
+    if ((*trans)->flags & (DELTA_FLAG | DEDUP_FLAG)) {
+        file_data = apply_delta(*trans, (uint32_t)(*trans)->file_size);
+        hash_computed = file_data && EVP_Digest(file_data, (*trans)->file_size, file_hash, NULL, EVP_sha256(), NULL) == 1;
+    } else if ((*trans)->leaf_count > 0) {
+        calculate_tree_hash_from_packets(*trans, file_hash);
+    } else {
+        calculate_sha256_from_packets(*trans, file_hash);
+    }
 
-    if (memcmp((*trans)->file_hash, file_hash, SHA256_DIGEST_LENGTH) != 0) {
+    if (!hash_computed || memcmp((*trans)->file_hash, file_hash, SHA256_DIGEST_LENGTH) != 0) {
         fprintf(stderr, "SHA-256 hash mismatch or packets missing\n");
         printf("Expected: ");
         for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
@@ -174,28 +1318,53 @@ int process_packet_end_0x02(uint8_t *buffer, transmission_t **trans, boolean *fi
         }
         printf("\n");
 
+        // Keep the data, the sender compares range digests next and resends only the damaged ranges
+        free(file_data);
+        (*trans)->repairing = true;
         return SHA256_MISSMATCH;
     }
 
-    FILE *file = fopen((*trans)->file_name, "wb");
-    if (!file) {
-        fprintf(stderr, "File creation failed\n");
-        return STOP_TRANSMISSION;
-    }
-
-    for (uint32_t i = 0; i < (*trans)->total_packet_count; i++) {
-        fwrite((*trans)->data_packets[i], 1, (*trans)->packet_sizes[i], file);
-        free((*trans)->data_packets[i]);
+    // The part file already holds the whole file, it replaces the existing one at once so that either of them is always there
+    if ((*trans)->part_file) {
+        char part_path[MAX_PART_PATH_LENGTH];
+        get_part_path(*trans, part_path, sizeof(part_path));
+        bool closed = fclose((*trans)->part_file) == 0;
+        (*trans)->part_file = NULL;
+        if (!closed || !replace_file(part_path, (*trans)->file_name)) {
+            fprintf(stderr, "Failed to rename %s to %s, the part file is kept\n", part_path, (*trans)->file_name);
+            return STOP_TRANSMISSION;
+        }
+    } else {
+        // Only the file rebuilt from a delta is kept in memory, it goes through a part file too so that the existing one is replaced whole or not at all
+        char part_path[MAX_PART_PATH_LENGTH];
+        get_part_path(*trans, part_path, sizeof(part_path));
+        FILE *file = fopen(part_path, "wb");
+        if (!file) {
+            fprintf(stderr, "File creation failed\n");
+            free(file_data);
+            return STOP_TRANSMISSION;
+        }
+        bool written = fwrite(file_data, 1, (*trans)->file_size, file) == (*trans)->file_size;
+        written = fflush(file) == 0 && written;
+        written = fclose(file) == 0 && written;
+        free(file_data);
+        if (!written) {
+            fprintf(stderr, "Failed to write %s\n", part_path);
+            remove(part_path);
+            return STOP_TRANSMISSION;
+        }
+        if (!replace_file(part_path, (*trans)->file_name)) {
+            fprintf(stderr, "Failed to rename %s to %s, the part file is kept\n", part_path, (*trans)->file_name);
+            return STOP_TRANSMISSION;
+        }
     }
 
-    *file_saved = true;
     printf("File has been written successfully\n");
 
-    fclose(file);
-    free((*trans)->data_packets);
-    free((*trans)->packet_sizes);
-    free(*trans);
-    *trans = NULL;
+    if ((*trans)->fec_group_size > 0) {
+        printf("Data packets recovered from parity: %u\n", (*trans)->recovered_packet_count);
+    }
+    free_transmission(trans);
 
     return STOP_TRANSMISSION_SUCCESS;
 }
@@ -2,36 +2,304 @@
 #define PACKET_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <openssl/sha.h>
-#include <winsock2.h>
+#include <openssl/evp.h>
+#include "platform.h"
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #define TRANSMISSION_START_PACKET_TYPE 0x00 // Packet type for transmission start
 #define TRANSMISSION_DATA_PACKET_TYPE 0x01  // Packet type for data
 #define TRANSMISSION_END_PACKET_TYPE 0x02   // Packet type for transmission end
 #define TRANSMISSION_SHA_PACKET_TYPE 0x03   // Packet type for acknowledgment
 #define TRANSMISSION_ACK_PACKET_TYPE 0x04   // Packet type for error
+#define TRANSMISSION_SACK_PACKET_TYPE 0x05  // Packet type for selective acknowledgment
+#define TRANSMISSION_PROBE_PACKET_TYPE 0x06 // Packet type for path MTU probe
+#define TRANSMISSION_PARITY_PACKET_TYPE 0x07 // Packet type for FEC parity
+#define TRANSMISSION_DIGESTS_PACKET_TYPE 0x08 // Packet type for range digests
+#define TRANSMISSION_REPAIR_PACKET_TYPE 0x09 // Packet type for repair request
+#define TRANSMISSION_MANIFEST_PACKET_TYPE 0x0A // Packet type for batch manifest
+#define TRANSMISSION_COMPRESSED_PACKET_TYPE 0x0B // Packet type for compressed data
+#define TRANSMISSION_SIGNATURE_REQUEST_PACKET_TYPE 0x0C // Packet type for block signature request
+#define TRANSMISSION_SIGNATURES_PACKET_TYPE 0x0D // Packet type for block signatures
+#define TRANSMISSION_CHUNK_QUERY_PACKET_TYPE 0x0E // Packet type for chunk store query
+#define TRANSMISSION_MISSING_CHUNKS_PACKET_TYPE 0x0F // Packet type for chunks missing from the chunk store
+
+#define NO_COMPRESSION 0                 // Compression method of raw data
+#define ZLIB_COMPRESSION 1               // Raw deflate stream
+#define ZSTD_COMPRESSION 2               // Zstandard frame, only with HAVE_ZSTD
+
+#define TREE_HASH_FLAG 0x01              // Start packet flag for tree hash verification
+#define STRIPE_FLAG 0x02                 // Start packet flag for a file sent in stripes
+#define DELTA_FLAG 0x04                  // Start packet flag for a delta against the existing file
+#define DEDUP_FLAG 0x08                  // Start packet flag for a delta against the chunk store
+#define LARGE_FILE_FLAG 0x10             // Start packet flag for a file whose end packet carries a 64-bit size, its data packets carry no delta
+#define STREAM_FLAG 0x20                 // Start packet flag for a file of unknown length, always with LARGE_FILE_FLAG, its length is known only from its end packet or its last data packet
+#define UNKNOWN_PACKET_COUNT UINT32_MAX  // Total packet count of a stream until its length is known
+#define STREAM_BITMAP_INITIAL_SIZE 1024  // Bytes of the bitmap of the received data packets of a stream, doubled whenever a data packet does not fit
+#define MAX_STRIPE_COUNT 8               // Stripes of one transmission
+#define TREE_HASH_LEAF_PACKET_COUNT 64   // Data packets hashed together into one tree hash leaf
+#define MAX_RANGE_DIGEST_COUNT 30        // Range digests in one range digests packet
+#define MAX_CHUNK_HASH_COUNT 30          // Chunk hashes in one chunk query packet
+#define CHUNK_STORE_DIRECTORY "chunk_store" // Chunks received with DEDUP_FLAG, one file named by its SHA-256 each
+#define PART_FILE_SUFFIX ".part"         // Appended with the transmission ID to the name of a file while it is being received
+#define MAX_PART_PATH_LENGTH 1048        // File name, a dot, the transmission ID in hex and PART_FILE_SUFFIX
+
+#define PACKET_HEADER_LEN 5              // Packet type and transmission ID, the CRC-32 (CRC32_LEN) follows the content
+
+#define PACKET_VALID 0                   // Packet parsed
+#define PACKET_CORRUPTED 1               // CRC-32 mismatch, only the header of the packet can be read
+#define PACKET_MALFORMED 2               // Packet too short for its type
+
+#define RANGE_UNCHECKED 0                // Range not compared in the current repair round
+#define RANGE_INTACT 1                   // Range matching its digest
+#define RANGE_DAMAGED 2                  // Range dropped to be resent
+
+// Content of the start packet (0x00)
+typedef struct {
+    uint32_t total_packet_count;
+    uint16_t chunk_size;
+    uint8_t flags;
+    uint32_t stripe_length;      // 0 unless the file is sent in stripes
+    const char *file_name;       // Not terminated, points into the receive buffer
+    size_t file_name_length;
+} start_packet_view_t;
+
+// Content of the data packet (0x01) or the compressed data packet (0x0B)
+typedef struct {
+    uint32_t index;
+    uint8_t compression;         // Compression method of the data, NO_COMPRESSION for data packets
+    const uint8_t *data;         // Points into the receive buffer
+    size_t data_size;
+} data_packet_view_t;
+
+// Content of the end packet (0x02)
+typedef struct {
+    uint64_t file_size;          // 64-bit with LARGE_FILE_FLAG, 32-bit otherwise
+    const uint8_t *file_hash;    // SHA256_DIGEST_LENGTH bytes in the receive buffer
+} end_packet_view_t;
+
+// Content of the parity packet (0x07)
+typedef struct {
+    uint32_t group_start_index;
+    uint16_t group_size;
+    uint8_t parity_count;
+    uint8_t parity_index;
+    uint16_t length_parity;
+    const uint8_t *data;         // Points into the receive buffer
+    size_t data_size;
+} parity_packet_view_t;
+
+// Content of the range digests packet (0x08)
+typedef struct {
+    uint8_t repair_round;
+    uint32_t first_range_index;
+    uint16_t range_count;
+    const uint8_t *digests;      // range_count digests in the receive buffer
+} digests_packet_view_t;
+
+// Content of the signature request packet (0x0C)
+typedef struct {
+    uint32_t first_block_index;
+    uint16_t block_size;
+    const char *file_name;       // Not terminated, points into the receive buffer
+    size_t file_name_length;
+} signature_request_packet_view_t;
+
+// Content of the chunk query packet (0x0E)
+typedef struct {
+    uint32_t first_chunk_index;
+    uint8_t chunk_count;
+    const uint8_t *hashes;       // chunk_count SHA-256 hashes in the receive buffer
+} chunk_query_packet_view_t;
+
+// Content of the manifest packet (0x0A)
+typedef struct {
+    uint32_t file_count;
+} manifest_packet_view_t;
+
+// Received packet parsed in place, valid only as long as the receive buffer
+typedef struct {
+    uint8_t packet_type;
+    uint32_t transmission_id;
+    const uint8_t *content;      // Content between the header and the CRC-32
+    size_t content_length;
+    union {
+        start_packet_view_t start;
+        data_packet_view_t data;
+        end_packet_view_t end;
+        parity_packet_view_t parity;
+        digests_packet_view_t digests;
+        manifest_packet_view_t manifest;
+        signature_request_packet_view_t signature_request;
+        chunk_query_packet_view_t chunk_query;
+    } as;                        // Decoded content of the packet types the receiver handles
+} packet_view_t;
+
+// Contiguous part of the file whose data packets are sent and acknowledged on their own
+typedef struct {
+    uint32_t end_index;          // Index of the first data packet past the stripe
+    uint32_t cumulative_index;   // Index of the first data packet of the stripe not yet received
+    int pending_ack_count;       // Data packets received since the last selective acknowledgment
+    uint64_t first_pending_time; // Milliseconds since the system start when the first of them arrived
+    uint16_t reply_port;         // Port the stripe is sent from, 0 unless the file is sent in stripes
+} stripe_t;
 
 typedef struct {
     uint32_t transmission_id;    // Unique ID for the transmission
     uint32_t total_packet_count; // Total number of packets expected
-    size_t *packet_sizes;        // Array to hold sizes of each packet
+    uint16_t chunk_size;         // Data size of every data packet but the last one
+    uint8_t flags;               // Start packet flags
+    size_t *packet_sizes;        // Array to hold sizes of each packet, NULL unless the data packets carry a delta
     char file_name[1024];        // Name of the file being transmitted
-    char **data_packets;         // Array of pointers to hold the data packets
+    char **data_packets;         // Array of pointers to hold the data packets, NULL unless they carry a delta
     int current_packet_count;    // Current number of packets received
-    uint32_t file_size;          // Size of the file being transmitted
+    uint64_t file_size;          // Size of the file being transmitted
+    FILE *part_file;             // File preallocated at the start that the data packets are written to at their offsets, NULL if they carry a delta
+    uint8_t *received_packets;   // Bitmap of the data packets written to the part file
+    size_t received_capacity;    // Bytes of the bitmap, it grows as the data packets of a stream arrive
+    uint32_t received_end_index; // Index past the highest data packet received
+    size_t last_packet_size;     // Data size of the last data packet, all others in the part file are chunk sized
+    uint8_t *packet_buffer;      // Chunk sized buffer the data packets are read back into from the part file
+    EVP_MD_CTX *running_hash;    // SHA-256 of the data packets received in order so far, NULL with the tree hash or without the part file
+    uint32_t hashed_packet_count; // Data packets covered by the running hash
     unsigned char file_hash[SHA256_DIGEST_LENGTH]; // SHA-256 hash of the file
+    uint32_t stripe_length;      // Data packets per stripe, the total packet count unless the file is sent in stripes
+    uint8_t stripe_count;
+    stripe_t stripes[MAX_STRIPE_COUNT];
+    uint16_t fec_group_size;     // Data packets per parity group, 0 until the first parity packet arrives
+    uint8_t fec_parity_count;    // Parity packets per group
+    char **parity_packets;       // Parity data indexed by group * fec_parity_count + parity index
+    size_t *parity_sizes;        // Array to hold sizes of each parity data
+    uint16_t *length_parities;   // XOR of the data sizes covered by each parity
+    size_t parity_slot_count;    // Slots of the parity arrays, they grow as the parity packets of a stream arrive
+    uint32_t recovered_packet_count; // Data packets rebuilt from parity
+    uint32_t leaf_count;         // Tree hash leaves, 0 unless the file is verified by a tree hash
+    uint8_t (*leaf_hashes)[SHA256_DIGEST_LENGTH]; // Leaf hashes computed as soon as their data packets are complete
+    uint16_t *leaf_packet_counts; // Data packets received in each leaf
+    bool repairing;              // Set once the file hash does not match
+    uint8_t repair_round;        // Repair round the range states belong to
+    uint8_t *range_states;       // State of each range in the repair round, NULL before the first repair
+    uint8_t *decompressed_data;  // Chunk sized buffer, NULL until the first compressed data packet
+    bool zlib_initialized;
+    z_stream zlib_stream;        // Reset for every compressed data packet
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zstd_context;     // NULL until the first zstd compressed data packet
+#endif
 } transmission_t;
 
 // Function to calculate SHA-256 hash from the data packets in the transmission structure
 void calculate_sha256_from_packets(transmission_t *trans, unsigned char *output_hash);
 
+// Function to hash two byte strings preceded by a prefix byte, leaves and inner nodes of the tree hash use different prefixes so that one can not pass for the other
+bool hash_with_prefix(uint8_t prefix, const uint8_t *first, size_t first_size, const uint8_t *second, size_t second_size, unsigned char *output_hash);
+
+// Function to hash the data packets of the tree hash leaf, which is also a range of a repair
+void hash_tree_hash_leaf(transmission_t *trans, uint32_t leaf, unsigned char *output_hash);
+
+// Function to calculate the tree hash root from the leaf hashes in the transmission structure
+void calculate_tree_hash_from_packets(transmission_t *trans, unsigned char *output_hash);
+
+// Function to tell whether the data packet has been received
+bool is_data_packet_received(transmission_t *t, uint32_t packet_index);
+
+// Function to tell whether the total packet count is known, it is not for a stream until its end packet or last data packet
+bool is_packet_count_known(transmission_t *t);
+
+// Function to set the total packet count of a stream once its length is known, the last data packet holds the rest of file_size
+void set_packet_count(transmission_t *t, uint32_t packet_count, size_t last_packet_size);
+
+// Function to grow the bitmap of the received data packets of a stream to cover the data packet, returns false on allocation failure
+bool reserve_data_packet(transmission_t *t, uint32_t packet_index);
+
+// Function to get the data size of a received data packet
+size_t get_data_packet_size(transmission_t *t, uint32_t packet_index);
+
+// Function to get the data of a received data packet, read back from the part file into the packet buffer unless it carries a delta, returns NULL if it could not be read
+const uint8_t *load_data_packet(transmission_t *t, uint32_t packet_index);
+
+// Function to tell whether the file name names a file in the working directory, not a path leading out of it
+bool is_plain_file_name(const char *file_name);
+
+// Function to build the path of the part file the file is received into
+void get_part_path(transmission_t *t, char *path, size_t path_size);
+
+// Function to find the stripe the data packet belongs to
+stripe_t *get_stripe(transmission_t *trans, uint32_t packet_index);
+
+// Function to fill the selective acknowledgment bitmap of the data packets of the stripe starting at start_index
+void fill_selective_acknowledgment_bitmap(transmission_t *trans, stripe_t *stripe, uint32_t start_index, uint8_t *bitmap, uint16_t bitmap_size);
+
+// Function to decide whether the received data packets of the stripe should be confirmed right away
+bool selective_acknowledgment_due(stripe_t *stripe);
+
+// Function to decompress the data of a compressed data packet into the chunk sized buffer of the transmission, returns NULL if it is corrupted
+const uint8_t *decompress_data(transmission_t *t, uint8_t compression, const uint8_t *data, size_t data_size, size_t *decompressed_size);
+
+// Function to store the data of a received or recovered data packet
+bool store_data_packet(transmission_t *t, uint32_t packet_index, const uint8_t *data, size_t data_size);
+
+// Function to free the parity data once it is not needed anymore
+void free_parity_packet(transmission_t *t, size_t parity_slot);
+
+// Function to grow the parity arrays of a stream to cover the parity slot, returns false on allocation failure
+bool reserve_parity_slot(transmission_t *t, size_t parity_slot);
+
+// Function to rebuild the data packet covered by the parity if it is the only one missing, returns false only on allocation failure
+bool recover_data_packet(transmission_t *t, uint32_t group, uint8_t parity_index);
+
+// Function to rebuild the data packets covered by every parity of the group, returns false only on allocation failure
+bool recover_group(transmission_t *t, uint32_t group);
+
+// Function to drop the data packets of a damaged range so that they are received again
+void drop_range(transmission_t *t, uint32_t range);
+
+// Function to build the path of the chunk with the SHA-256 hash in the chunk store
+void get_chunk_path(const uint8_t *hash, char *path, size_t path_size);
+
+// Function to add the chunk to the chunk store under its SHA-256 hash, returns false if it could not be written
+bool store_chunk(const uint8_t *data, size_t data_size);
+
+// Function to rebuild the file from the delta instructions in the data packets and the existing file or the chunk store, returns NULL if they do not add up to file_size bytes
+uint8_t *apply_delta(transmission_t *t, uint32_t file_size);
+
+// Function to free the transmission structure with all of its data
+void free_transmission(transmission_t **trans);
+
+// Function to read a big-endian 16-bit number
+uint16_t read_uint16(const uint8_t *buffer);
+
+// Function to read a big-endian 32-bit number
+uint32_t read_uint32(const uint8_t *buffer);
+
+// Function to read a big-endian 64-bit number
+uint64_t read_uint64(const uint8_t *buffer);
+
+// Function to validate the CRC-32 of the received packet once and parse it in place without copying, returns PACKET_VALID, PACKET_CORRUPTED or PACKET_MALFORMED
+int parse_packet(const uint8_t *buffer, size_t recv_len, packet_view_t *packet);
+
 // Function to process the start packet (0x00) and initialize the transmission structure
-int process_packet_start_0x00(uint8_t *buffer, transmission_t **trans);
+int process_packet_start_0x00(const packet_view_t *packet, transmission_t **trans);
+
+// Function to process the data packet (0x01) or the compressed data packet (0x0B) and store the data in the transmission structure
+int process_packet_data_0x01(const packet_view_t *packet, transmission_t **trans);
+
+// Function to process the parity packet (0x07) and rebuild a lost data packet from it
+int process_packet_parity_0x07(const packet_view_t *packet, transmission_t **trans);
+
+// Function to process the range digests packet (0x08) and fill the repair request bitmap of the damaged ranges
+int process_packet_digests_0x08(const packet_view_t *packet, transmission_t **trans, uint8_t *bitmap);
+
+// Function to process the signature request packet (0x0C) and fill the block signatures of the existing file, which need no transmission
+int process_packet_signature_request_0x0C(const packet_view_t *packet, uint32_t *file_size, uint8_t *signatures, uint8_t *signature_count);
 
-// Function to process the data packet (0x01) and store the data in the transmission structure
-int process_packet_data_0x01(uint8_t *buffer, transmission_t **trans, ssize_t recv_len, uint32_t *packet_index_address);
+// Function to process the chunk query packet (0x0E) and fill the bitmap of the chunks missing from the chunk store, which need no transmission
+int process_packet_chunk_query_0x0E(const packet_view_t *packet, uint8_t *bitmap);
 
 // Function to process the end packet (0x02) and finalize the transmission structure
-int process_packet_end_0x02(uint8_t *buffer, transmission_t **trans, boolean *file_saved);
+int process_packet_end_0x02(const packet_view_t *packet, transmission_t **trans);
 
 #endif //PACKET_H
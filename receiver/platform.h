@@ -0,0 +1,46 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// The receiver is written against Winsock, elsewhere its names are mapped to POSIX sockets and files
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket close
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define _mkdir(path) mkdir(path, 0755)
+#endif
+
+// Function to get the milliseconds since an unspecified point in time, it never goes back
+uint64_t get_monotonic_milliseconds(void);
+
+// Function to reserve the disk space of the first size bytes of the file, returns false if it does not fit
+bool preallocate_file(FILE *file, uint64_t size);
+
+// Function to write the data at the offset of the file, returns false if it could not be written whole
+bool write_file_at(FILE *file, uint64_t offset, const uint8_t *data, size_t size);
+
+// Function to read size bytes at the offset of the file, returns false if they could not be read whole
+bool read_file_at(FILE *file, uint64_t offset, uint8_t *data, size_t size);
+
+// Function to move the file to the target path in one step, replacing the file there if any, returns false if it could not be moved
+bool replace_file(const char *path, const char *target_path);
+
+#endif //PLATFORM_H
@@ -2,8 +2,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <winsock2.h>
-#include <windows.h>
 #include <openssl/sha.h>
 
 #include "packet.h"
@@ -12,60 +10,302 @@
 #include "utils.h"
 #include "logger.h"
 
-DWORD WINAPI spawn(LPVOID lpParam) {
-    printf("Exiting program after 10 seconds.\n");
-    Sleep(10000);
-    ExitProcess(0);
-    return 0;
+uint32_t get_session_slot(uint32_t sender_address, uint32_t transmission_id) {
+    // Mix the whole key, consecutive IDs or addresses would otherwise fill neighbouring slots
+    uint64_t key = ((uint64_t)sender_address << 32) | transmission_id;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key & (SESSION_TABLE_SIZE - 1);
 }
 
-int handle_packet(SOCKET sockfd, SOCKET clientfd, const char *sender_ip_address, uint16_t sender_port, transmission_t **trans, boolean *file_saved) {
-    struct sockaddr_in client_addr;
-    int addr_len = sizeof(client_addr);
-    uint8_t buffer[BUFFER_SIZE];
+session_t *find_session(session_table_t *table, uint32_t sender_address, uint32_t transmission_id) {
+    uint32_t slot = get_session_slot(sender_address, transmission_id);
+    while (table->sessions[slot].used) {
+        session_t *session = &table->sessions[slot];
+        if (session->sender_address == sender_address && session->transmission_id == transmission_id) {
+            return session;
+        }
+        slot = (slot + 1) & (SESSION_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
 
-    // Receive the packet
-    ssize_t recv_len = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&client_addr, &addr_len);
-    if (recv_len < MIN_RECEIVE_LEN) {
-        fprintf(stderr, "Received Packed corrupted/failed\n");
-        return CONTINUE_TRANSMISSION;
+void remove_session(session_table_t *table, session_t *session) {
+    if (session->trans) {
+        free_transmission(&session->trans);
     }
+    session->used = false;
+    table->session_count--;
 
-    uint8_t packet_type = buffer[0];
-    uint32_t received_crc;
-    memcpy(&received_crc, &buffer[recv_len - CRC32_LEN], 4);
-    received_crc = ntohl(received_crc);
+    // Move the following sessions of the probe sequence back into the hole, so that no lookup stops at it
+    uint32_t hole = (uint32_t)(session - table->sessions);
+    uint32_t slot = hole;
+    while (true) {
+        slot = (slot + 1) & (SESSION_TABLE_SIZE - 1);
+        if (!table->sessions[slot].used) {
+            break;
+        }
+        uint32_t home = get_session_slot(table->sessions[slot].sender_address, table->sessions[slot].transmission_id);
+        if (((slot - home) & (SESSION_TABLE_SIZE - 1)) >= ((slot - hole) & (SESSION_TABLE_SIZE - 1))) {
+            table->sessions[hole] = table->sessions[slot];
+            table->sessions[slot].used = false;
+            hole = slot;
+        }
+    }
+}
 
+session_t *add_session(session_table_t *table, uint32_t sender_address, uint32_t transmission_id, uint64_t now) {
+    if (table->session_count >= MAX_SESSION_COUNT) {
+        // Make room by dropping the longest idle session which is not receiving a file or whose repair the sender gave up on
+        session_t *evicted = NULL;
+        for (int i = 0; i < SESSION_TABLE_SIZE; i++) {
+            session_t *session = &table->sessions[i];
+            if (session->used && (!session->trans || session->trans->repairing) &&
+                (!evicted || session->last_activity < evicted->last_activity)) {
+                evicted = session;
+            }
+        }
+        if (!evicted) {
+            return NULL;
+        }
+        remove_session(table, evicted);
+    }
 
-	uint32_t transmission_id = 0;
-    if (trans && *trans) {
-       transmission_id = (*trans)->transmission_id;
+    uint32_t slot = get_session_slot(sender_address, transmission_id);
+    while (table->sessions[slot].used) {
+        slot = (slot + 1) & (SESSION_TABLE_SIZE - 1);
     }
+    session_t *session = &table->sessions[slot];
+    memset(session, 0, sizeof(*session));
+    session->used = true;
+    session->sender_address = sender_address;
+    session->transmission_id = transmission_id;
+    session->last_activity = now;
+    table->session_count++;
+    return session;
+}
 
-    // validate the CRC-32 checksum
-    if (!check_packet_crc32(buffer, recv_len, sender_ip_address, sender_port, clientfd, packet_type, received_crc, transmission_id)) {
-        fprintf(stderr, "CRC-32 validation failed for packet type %u\n", packet_type);
-        return CONTINUE_TRANSMISSION;
+void remove_idle_sessions(session_table_t *table, uint64_t now) {
+    for (int i = 0; i < SESSION_TABLE_SIZE;) {
+        session_t *session = &table->sessions[i];
+        if (session->used && now - session->last_activity > SESSION_IDLE_TIMEOUT_MS) {
+            if (session->trans) {
+                fprintf(stderr, "Dropping transmission %u, no packet for %d ms\n", session->transmission_id, SESSION_IDLE_TIMEOUT_MS);
+            }
+            remove_session(table, session);
+            continue; // Another session may have moved into the slot
+        }
+        i++;
+    }
+}
+
+void sweep_sessions(session_table_t *table, uint64_t now) {
+    if (now - table->last_sweep >= SESSION_SWEEP_INTERVAL_MS) {
+        remove_idle_sessions(table, now);
+        table->last_sweep = now;
+    }
+}
+
+bool all_files_saved(session_table_t *table) {
+    uint32_t expected_file_count = table->announced_file_count > 0 ? table->announced_file_count : 1;
+    if (table->saved_file_count < expected_file_count) {
+        return false;
+    }
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++) {
+        if (table->sessions[i].used && table->sessions[i].trans) {
+            return false;
+        }
     }
+    return true;
+}
 
+void send_delayed_acknowledgments(SOCKET clientfd, session_table_t *table, uint64_t now) {
+    char sender_ip_address[16];
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++) {
+        session_t *session = &table->sessions[i];
+        transmission_t *t = session->used ? session->trans : NULL;
+        for (uint8_t j = 0; t && j < t->stripe_count; j++) {
+            stripe_t *stripe = &t->stripes[j];
+            // Another sender keeping the socket busy must not hold back the acknowledgment of a stripe with few packets in flight
+            if (stripe->pending_ack_count > 0 && now - stripe->first_pending_time >= SACK_DELAY_MS) {
+                struct in_addr address;
+                address.s_addr = session->sender_address;
+                strcpy(sender_ip_address, inet_ntoa(address));
+                send_selective_acknowledgment(clientfd, sender_ip_address, session->reply_port, t, stripe);
+            }
+        }
+    }
+}
+
+int get_acknowledgment_timeout(session_table_t *table, uint64_t now) {
+    uint64_t deadline = now + SESSION_SWEEP_INTERVAL_MS;
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++) {
+        session_t *session = &table->sessions[i];
+        transmission_t *t = session->used ? session->trans : NULL;
+        for (uint8_t j = 0; t && j < t->stripe_count; j++) {
+            stripe_t *stripe = &t->stripes[j];
+            if (stripe->pending_ack_count > 0 && stripe->first_pending_time + SACK_DELAY_MS < deadline) {
+                deadline = stripe->first_pending_time + SACK_DELAY_MS;
+            }
+        }
+    }
+    return deadline > now ? (int)(deadline - now) : 0;
+}
 
+int handle_packet(SOCKET clientfd, session_table_t *table, const uint8_t *buffer, size_t recv_len, const struct sockaddr_in *client_addr, uint64_t now) {
+    char sender_ip_address[16];
 
+    // Every packet is answered to the address it came from, so that any number of senders can be served
+    strcpy(sender_ip_address, inet_ntoa(client_addr->sin_addr));
+    uint16_t sender_port = ntohs(client_addr->sin_port);
+
+    // The packet is parsed in place, its view points into the buffer
+    packet_view_t packet;
+    int parse_result = parse_packet(buffer, recv_len, &packet);
+    if (parse_result == PACKET_MALFORMED) {
+        fprintf(stderr, "Received Packed corrupted/failed\n");
+        return CONTINUE_TRANSMISSION;
+    }
+    if (parse_result == PACKET_CORRUPTED) {
+        fprintf(stderr, "CRC-32 validation failed for packet type %u\n", packet.packet_type);
+        send_corrupted_packet_acknowledgment(clientfd, sender_ip_address, sender_port, &packet);
+        return CONTINUE_TRANSMISSION;
+    }
+
+    // Every packet is routed to its session by the sender address and the transmission ID
+    uint8_t packet_type = packet.packet_type;
+    uint32_t transmission_id = packet.transmission_id;
+    uint32_t sender_address = client_addr->sin_addr.s_addr;
+    session_t *session = find_session(table, sender_address, transmission_id);
+    if (session) {
+        session->last_activity = now;
+    }
+    transmission_t *no_transmission = NULL;
+    transmission_t **trans = session ? &session->trans : &no_transmission;
 
     // Process received the packet based on its type
     uint32_t packet_index = 0;
     int result = CONTINUE_TRANSMISSION_NO_ACK; // ignore other packet types, if not handled
 
     if (packet_type == TRANSMISSION_START_PACKET_TYPE) {
-        result = process_packet_start_0x00(buffer, trans);
+        // A duplicate or a restart goes to its own session, a delta has to fit the memory budget of one as only its data packets are not written to disk as they arrive
+        uint64_t file_size_bound = (uint64_t)packet.as.start.total_packet_count * packet.as.start.chunk_size;
+        if ((packet.as.start.flags & (DELTA_FLAG | DEDUP_FLAG)) && file_size_bound > SESSION_MEMORY_BUDGET) {
+            fprintf(stderr, "Error: Refusing transmission %u of %u packets, more than the memory budget of a session\n",
+                transmission_id, packet.as.start.total_packet_count);
+        } else {
+            if (!session) {
+                session = add_session(table, sender_address, transmission_id, now);
+            }
+            if (!session) {
+                fprintf(stderr, "Error: Received start packet while every session is busy.\n");
+            } else {
+                session->reply_port = sender_port;
+                session->saved = false;
+                trans = &session->trans;
+                result = process_packet_start_0x00(&packet, trans);
+            }
+        }
 
-    } else if (packet_type == TRANSMISSION_DATA_PACKET_TYPE) {
-        result = process_packet_data_0x01(buffer, trans, recv_len, &packet_index);
+    } else if (packet_type == TRANSMISSION_MANIFEST_PACKET_TYPE) {
+        // The files of a batch are received one after another, the program exits after the last one, a resent manifest is counted once
+        if (!session) {
+            session = add_session(table, sender_address, transmission_id, now);
+            if (session) {
+                table->announced_file_count += packet.as.manifest.file_count;
+                printf("Manifest: %u files\n", packet.as.manifest.file_count);
+            }
+        }
+        if (session) {
+            result = CONTINUE_TRANSMISSION;
+        } else {
+            fprintf(stderr, "Error: Received manifest while every session is busy.\n");
+        }
+
+    } else if (packet_type == TRANSMISSION_DATA_PACKET_TYPE || packet_type == TRANSMISSION_COMPRESSED_PACKET_TYPE) {
+        result = process_packet_data_0x01(&packet, trans);
+        packet_index = packet.as.data.index;
+
+        // Data packets are confirmed in bulk by selective acknowledgments, duplicates right away as the sender is waiting
+        if (result == CONTINUE_TRANSMISSION || result == CONTINUE_TRANSMISSION_DUPLICATE) {
+            stripe_t *stripe = get_stripe(*trans, packet_index);
+            if ((*trans)->flags & STRIPE_FLAG) {
+                stripe->reply_port = sender_port;
+            }
+            if (result == CONTINUE_TRANSMISSION_DUPLICATE || selective_acknowledgment_due(stripe)) {
+                send_selective_acknowledgment(clientfd, sender_ip_address, sender_port, *trans, stripe);
+            }
+            result = CONTINUE_TRANSMISSION_NO_ACK;
+        }
+
+    } else if (packet_type == TRANSMISSION_PARITY_PACKET_TYPE) {
+        result = process_packet_parity_0x07(&packet, trans);
+
+        // Rebuilt data packets are confirmed like the received ones
+        if (result == CONTINUE_TRANSMISSION) {
+            transmission_t *t = *trans;
+            for (uint8_t i = 0; i < t->stripe_count; i++) {
+                if (t->stripes[i].pending_ack_count > 0 && selective_acknowledgment_due(&t->stripes[i])) {
+                    send_selective_acknowledgment(clientfd, sender_ip_address, sender_port, t, &t->stripes[i]);
+                }
+            }
+            result = CONTINUE_TRANSMISSION_NO_ACK;
+        }
+
+    } else if (packet_type == TRANSMISSION_PROBE_PACKET_TYPE) {
+        // Confirm the probe size, the probe got here without fragmentation
+        send_acknowledgment(clientfd, sender_ip_address, sender_port,
+        packet_type, true, (uint32_t)recv_len, transmission_id);
+
+    } else if (packet_type == TRANSMISSION_DIGESTS_PACKET_TYPE) {
+        uint8_t bitmap[(MAX_RANGE_DIGEST_COUNT + 7) / 8];
+        result = process_packet_digests_0x08(&packet, trans, bitmap);
+
+        // Answered by the repair request instead of an acknowledgment
+        if (result == CONTINUE_TRANSMISSION) {
+            send_repair_request(clientfd, sender_ip_address, sender_port, *trans, packet.as.digests.first_range_index,
+                packet.as.digests.range_count, bitmap);
+            result = CONTINUE_TRANSMISSION_NO_ACK;
+        }
+
+    } else if (packet_type == TRANSMISSION_SIGNATURE_REQUEST_PACKET_TYPE) {
+        uint8_t signatures[SIGNATURES_PER_PACKET * BLOCK_SIGNATURE_SIZE];
+        uint32_t file_size;
+        uint8_t signature_count;
+        result = process_packet_signature_request_0x0C(&packet, &file_size, signatures, &signature_count);
+
+        // Answered by the block signatures instead of an acknowledgment, the transmission starts only after them
+        if (result == CONTINUE_TRANSMISSION) {
+            send_block_signatures(clientfd, sender_ip_address, sender_port, transmission_id, file_size,
+                packet.as.signature_request.first_block_index, signature_count, signatures);
+            result = CONTINUE_TRANSMISSION_NO_ACK;
+        }
+
+    } else if (packet_type == TRANSMISSION_CHUNK_QUERY_PACKET_TYPE) {
+        uint8_t bitmap[(MAX_CHUNK_HASH_COUNT + 7) / 8];
+        result = process_packet_chunk_query_0x0E(&packet, bitmap);
+
+        // Answered by the missing chunks instead of an acknowledgment, the transmission starts only after them
+        if (result == CONTINUE_TRANSMISSION) {
+            send_missing_chunks(clientfd, sender_ip_address, sender_port, transmission_id,
+                packet.as.chunk_query.first_chunk_index, packet.as.chunk_query.chunk_count, bitmap);
+            result = CONTINUE_TRANSMISSION_NO_ACK;
+        }
 
     } else if (packet_type == TRANSMISSION_END_PACKET_TYPE) {
     	send_acknowledgment(clientfd, sender_ip_address, sender_port,
 		packet_type, true, packet_index, transmission_id);
-    	Sleep(100);
-        result = process_packet_end_0x02(buffer, trans, file_saved);
+        if (session && session->saved) {
+            // The response got lost, the file is already written
+            result = STOP_TRANSMISSION_SUCCESS;
+        } else {
+            result = process_packet_end_0x02(&packet, trans);
+            if (result == STOP_TRANSMISSION_SUCCESS) {
+                session->saved = true;
+                table->saved_file_count++;
+            }
+        }
     }
 
     if (result == CONTINUE_TRANSMISSION) {
@@ -75,96 +315,20 @@ int handle_packet(SOCKET sockfd, SOCKET clientfd, const char *sender_ip_address,
         fprintf(stderr, "SHA256 mismatch\n");
         send_sha256_acknowledgement(clientfd, sender_ip_address, sender_port,
          0, transmission_id);
+        result = CONTINUE_TRANSMISSION;
     } else if (result == STOP_TRANSMISSION_SUCCESS) {
         send_sha256_acknowledgement(clientfd, sender_ip_address, sender_port,
          1, transmission_id);
-        result = STOP_TRANSMISSION;
+        result = table->exit_when_saved && all_files_saved(table) ? STOP_TRANSMISSION : CONTINUE_TRANSMISSION;
+    } else if (result == STOP_TRANSMISSION) {
+        // Only the failed session is dropped, the others go on
+        fprintf(stderr, "Dropping transmission %u\n", transmission_id);
+        if (session) {
+            remove_session(table, session);
+        }
+        result = CONTINUE_TRANSMISSION;
     } else if (result == CONTINUE_TRANSMISSION_NO_ACK) {
         result = CONTINUE_TRANSMISSION;
     }
     return result;
 }
-
-bool new_transmission(unsigned int receiver_port, char *sender_ip_address, unsigned int sender_port) {
-    WSADATA wsa;
-    SOCKET sockfd;
-    SOCKET clientfd;
-    struct sockaddr_in server_addr;
-
-    // set up the socket
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
-        fprintf(stderr, "WSAStartup failed\n");
-        return false;
-    }
-
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    clientfd = socket(AF_INET, SOCK_DGRAM, 0);
-	// Bind clientfd to port 53000
-	struct sockaddr_in client_addr;
-	memset(&client_addr, 0, sizeof(client_addr));
-	client_addr.sin_family = AF_INET;
-	client_addr.sin_addr.s_addr = INADDR_ANY;  // Use specific IP if needed
-	client_addr.sin_port = htons(sender_port);
-
-	if (bind(clientfd, (struct sockaddr *)&client_addr, sizeof(client_addr)) == SOCKET_ERROR) {
-		fprintf(stderr, "Failed to bind client socket to port 53000: %d\n", WSAGetLastError());
-		closesocket(sockfd);
-		closesocket(clientfd);
-		WSACleanup();
-		return false;
-	}
-
-    if (sockfd == INVALID_SOCKET) {
-        fprintf(stderr, "Socket creation failed\n");
-        WSACleanup();
-        return false;
-    }
-
-    if (clientfd == INVALID_SOCKET) {
-        fprintf(stderr, "Client socket creation failed\n");
-        closesocket(sockfd);
-        WSACleanup();
-        return false;
-    }
-
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    //server_addr.sin_addr.s_addr = inet_addr(sender_ip_address); // works for me
-	server_addr.sin_addr.s_addr = INADDR_ANY; // works for communication with  others than me lol
-	server_addr.sin_port = htons(receiver_port);
-
-	if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
-		fprintf(stderr, "Bind failed with error code: %d\n", WSAGetLastError());
-		closesocket(sockfd);
-		WSACleanup();
-		return false;
-	}
-
-    printf("Listening on port %d...\n", receiver_port);
-
-    boolean file_saved = false;
-    boolean exiting = false;
-
-    int result;
-    transmission_t *trans = NULL;
-    while (true) { // loop until transmission is complete
-        result = handle_packet(sockfd, clientfd, sender_ip_address, sender_port, &trans, &file_saved);
-        if (result == SHA256_MISSMATCH) {
-            closesocket(sockfd);
-            WSACleanup();
-            return false;
-        } else if (result == STOP_TRANSMISSION) {
-            if (!exiting) {
-                HANDLE thread = CreateThread(NULL, 0, spawn, NULL, 0, NULL);
-                exiting = true;
-            }
-            continue; // break; if no need to wait asynchronously for 10 seconds
-        } else if (result == CONTINUE_TRANSMISSION) {
-            continue;
-        }
-    }
-
-    closesocket(sockfd);
-    WSACleanup();
-    return true;
-}
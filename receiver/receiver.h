@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <winsock2.h>
+#include "platform.h"
 
 #include "packet.h"
 
@@ -12,16 +12,93 @@
 #define STOP_TRANSMISSION 1
 #define SHA256_MISSMATCH 2
 #define STOP_TRANSMISSION_SUCCESS 3
+#define CONTINUE_TRANSMISSION_DUPLICATE 4
 #define DEFAULT_PACKET_INDEX 0
 #define BUFFER_SIZE 65507
 
-#define MIN_RECEIVE_LEN 4
 #define CRC32_LEN 4
 
-// Function that handles the packet processing into transmission_t structure
-int handle_packet(SOCKET sockfd, SOCKET clientfd, const char *sender_ip_address, uint16_t sender_port, transmission_t **trans, boolean *file_saved);
+#define SACK_FREQUENCY 8      // Data packets confirmed by one selective acknowledgment
+#define SACK_DELAY_MS 5       // Longest time a received data packet waits for its acknowledgment
+#define SACK_BITMAP_SIZE 512  // Most bytes of the selective acknowledgment bitmap (4096 packets)
 
-// Function that handles the new transmission
-bool new_transmission();
+#define SESSION_TABLE_SIZE 64          // Slots of the session table, a power of two
+#define MAX_SESSION_COUNT 32           // Sessions at once, so that the table stays at most half full
+#define SESSION_IDLE_TIMEOUT_MS 30000  // A session without any packet for this long is dropped
+#define SESSION_SWEEP_INTERVAL_MS 1000 // Time between looking for idle sessions
+#define SESSION_MEMORY_BUDGET (512ULL * 1024 * 1024) // Largest delta and file rebuilt from it one session may hold in memory
+
+#define EXIT_DELAY_MS 10000            // Time resent end packets are still answered after the last file is written
+#define RECEIVE_BATCH_SIZE 32          // Datagrams received by one recvmmsg call on Linux
+
+// Transfer of one file from one sender, also kept after the file is written or for a manifest so that resent packets are answered the same
+typedef struct {
+    bool used;
+    uint32_t sender_address;           // IPv4 address in network byte order, without the port as stripes come from ports of their own
+    uint32_t transmission_id;
+    uint16_t reply_port;               // Port the sender sends its start and end packets from
+    transmission_t *trans;             // File being received, NULL once it is written or for a manifest
+    bool saved;                        // File written, a resent end packet is answered with success again
+    uint64_t last_activity;            // Milliseconds since the system start of the last packet
+} session_t;
+
+// Open addressing hash map of the sessions keyed by the sender address and the transmission ID, with linear probing
+typedef struct {
+    session_t sessions[SESSION_TABLE_SIZE];
+    uint32_t session_count;
+    uint32_t announced_file_count;     // Files announced by the manifests, files sent on their own count once written
+    uint32_t saved_file_count;         // Files written so far
+    uint64_t last_sweep;
+    bool exit_when_saved;              // Stop once every file is written instead of serving senders until killed
+} session_table_t;
+
+// Function that finds the session of the sender with the given transmission ID, returns NULL if there is none
+session_t *find_session(session_table_t *table, uint32_t sender_address, uint32_t transmission_id);
+
+// Function that adds a session to the table, evicting an idle one if the table is full, returns NULL if every session is busy
+session_t *add_session(session_table_t *table, uint32_t sender_address, uint32_t transmission_id, uint64_t now);
+
+// Function that removes the session from the table and frees its transmission
+void remove_session(session_table_t *table, session_t *session);
+
+// Function that drops the sessions which have been idle for longer than the idle timeout
+void remove_idle_sessions(session_table_t *table, uint64_t now);
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Buffers preallocated for one batch of datagrams, each recvmmsg call receives straight into them
+typedef struct {
+    uint8_t *buffers;                                // RECEIVE_BATCH_SIZE buffers of BUFFER_SIZE bytes
+    struct mmsghdr messages[RECEIVE_BATCH_SIZE];
+    struct iovec iovecs[RECEIVE_BATCH_SIZE];
+    struct sockaddr_in addresses[RECEIVE_BATCH_SIZE];
+} receive_pool_t;
+
+// Function that allocates the buffers of the pool and points its messages at them, returns false on allocation failure
+bool create_receive_pool(receive_pool_t *pool);
+
+// Function that frees the buffers of the pool
+void free_receive_pool(receive_pool_t *pool);
+#endif
+
+// Function that tells whether every announced file has been written and no other one is being received
+bool all_files_saved(session_table_t *table);
+
+// Function that drops the idle sessions once every sweep interval
+void sweep_sessions(session_table_t *table, uint64_t now);
+
+// Function that confirms the data packets of every stripe whose first unconfirmed one arrived at least SACK_DELAY_MS ago, called after every batch of packets and whenever the wait for one times out
+void send_delayed_acknowledgments(SOCKET clientfd, session_table_t *table, uint64_t now);
+
+// Function that tells how many milliseconds the next delayed acknowledgment is due in, at most SESSION_SWEEP_INTERVAL_MS
+int get_acknowledgment_timeout(session_table_t *table, uint64_t now);
+
+// Function that handles the packet processing into transmission_t structure, the packet of recv_len bytes in buffer came from client_addr
+int handle_packet(SOCKET clientfd, session_table_t *table, const uint8_t *buffer, size_t recv_len, const struct sockaddr_in *client_addr, uint64_t now);
+
+// Function that handles the new transmission, implemented by the Winsock backend on Windows and by the epoll backend on Linux, the answers are sent from reply_port
+bool new_transmission(unsigned int receiver_port, unsigned int reply_port, bool exit_when_saved);
 
 #endif //RECEIVER_H
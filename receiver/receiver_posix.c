@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "platform.h"
+#include "receiver.h"
+#include "logger.h"
+
+// Linux backend of the receiver, an epoll loop drains the nonblocking socket a batch of datagrams per recvmmsg call into preallocated buffers
+
+#define EPOLL_EVENT_COUNT 2 // The socket and the exit timer
+
+uint64_t get_monotonic_milliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool preallocate_file(FILE *file, uint64_t size) {
+    return posix_fallocate(fileno(file), 0, (off_t)size) == 0;
+}
+
+// The part file is only ever accessed through these, so that its stdio buffer stays empty
+bool write_file_at(FILE *file, uint64_t offset, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = pwrite(fileno(file), data, size, (off_t)offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool read_file_at(FILE *file, uint64_t offset, uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t read_size = pread(fileno(file), data, size, (off_t)offset);
+        if (read_size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_size <= 0) {
+            return false;
+        }
+        data += read_size;
+        size -= read_size;
+        offset += read_size;
+    }
+    return true;
+}
+
+bool replace_file(const char *path, const char *target_path) {
+    return rename(path, target_path) == 0;
+}
+
+bool create_receive_pool(receive_pool_t *pool) {
+    pool->buffers = malloc((size_t)RECEIVE_BATCH_SIZE * BUFFER_SIZE);
+    if (!pool->buffers) {
+        fprintf(stderr, "Memory allocation failed for the receive buffers\n");
+        return false;
+    }
+    memset(pool->messages, 0, sizeof(pool->messages));
+    for (int i = 0; i < RECEIVE_BATCH_SIZE; i++) {
+        pool->iovecs[i].iov_base = &pool->buffers[(size_t)i * BUFFER_SIZE];
+        pool->iovecs[i].iov_len = BUFFER_SIZE;
+        pool->messages[i].msg_hdr.msg_iov = &pool->iovecs[i];
+        pool->messages[i].msg_hdr.msg_iovlen = 1;
+        pool->messages[i].msg_hdr.msg_name = &pool->addresses[i];
+        pool->messages[i].msg_hdr.msg_namelen = sizeof(pool->addresses[i]);
+    }
+    return true;
+}
+
+void free_receive_pool(receive_pool_t *pool) {
+    free(pool->buffers);
+    pool->buffers = NULL;
+}
+
+// Handles every datagram waiting on the socket, returns true once the last file is written
+bool receive_packets(SOCKET sockfd, SOCKET clientfd, session_table_t *table, receive_pool_t *pool) {
+    bool stopping = false;
+    while (true) {
+        int message_count = recvmmsg(sockfd, pool->messages, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (message_count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "Received Packed corrupted/failed\n");
+            }
+            return stopping;
+        }
+
+        uint64_t now = get_monotonic_milliseconds();
+        sweep_sessions(table, now);
+        for (int i = 0; i < message_count; i++) {
+            const uint8_t *buffer = pool->iovecs[i].iov_base;
+            if (handle_packet(clientfd, table, buffer, pool->messages[i].msg_len, &pool->addresses[i], now) == STOP_TRANSMISSION) {
+                stopping = true;
+            }
+            // The kernel shortens the address length to the one received
+            pool->messages[i].msg_hdr.msg_namelen = sizeof(pool->addresses[i]);
+        }
+        send_delayed_acknowledgments(clientfd, table, now);
+        if (message_count < RECEIVE_BATCH_SIZE) {
+            return stopping;
+        }
+    }
+}
+
+bool new_transmission(unsigned int receiver_port, unsigned int reply_port, bool exit_when_saved) {
+    SOCKET sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == INVALID_SOCKET) {
+        fprintf(stderr, "Socket creation failed\n");
+        return false;
+    }
+    SOCKET clientfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (clientfd == INVALID_SOCKET) {
+        fprintf(stderr, "Client socket creation failed\n");
+        closesocket(sockfd);
+        return false;
+    }
+
+    // Acknowledgments are sent from the reply port
+    struct sockaddr_in client_addr;
+    memset(&client_addr, 0, sizeof(client_addr));
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = INADDR_ANY;
+    client_addr.sin_port = htons(reply_port);
+    if (bind(clientfd, (struct sockaddr *)&client_addr, sizeof(client_addr)) == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to bind client socket to port %u: %s\n", reply_port, strerror(errno));
+        closesocket(sockfd);
+        closesocket(clientfd);
+        return false;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(receiver_port);
+    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+        fprintf(stderr, "Bind failed: %s\n", strerror(errno));
+        closesocket(sockfd);
+        closesocket(clientfd);
+        return false;
+    }
+
+    // The socket is drained until it would block, epoll tells when there is more, the exit timer when to stop answering
+    int epoll_fd = epoll_create1(0);
+    int exit_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    receive_pool_t pool;
+    pool.buffers = NULL;
+    struct epoll_event socket_event = {.events = EPOLLIN, .data.fd = sockfd};
+    struct epoll_event exit_timer_event = {.events = EPOLLIN, .data.fd = exit_timer_fd};
+    if (epoll_fd < 0 || exit_timer_fd < 0 || fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &socket_event) != 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, exit_timer_fd, &exit_timer_event) != 0 || !create_receive_pool(&pool)) {
+        fprintf(stderr, "Failed to set up the event loop: %s\n", strerror(errno));
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+        if (exit_timer_fd >= 0) {
+            close(exit_timer_fd);
+        }
+        free_receive_pool(&pool);
+        closesocket(sockfd);
+        closesocket(clientfd);
+        return false;
+    }
+
+    printf("Listening on port %d...\n", receiver_port);
+
+    session_table_t table;
+    memset(&table, 0, sizeof(table));
+    table.last_sweep = get_monotonic_milliseconds();
+    table.exit_when_saved = exit_when_saved;
+    bool exiting = false;
+    bool running = true;
+    while (running) { // loop until transmission is complete
+        struct epoll_event events[EPOLL_EVENT_COUNT];
+        // Wake up when the next delayed acknowledgment is due
+        int timeout = get_acknowledgment_timeout(&table, get_monotonic_milliseconds());
+        int event_count = epoll_wait(epoll_fd, events, EPOLL_EVENT_COUNT, timeout);
+        if (event_count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Waiting for packets failed: %s\n", strerror(errno));
+            break;
+        }
+        if (event_count == 0) {
+            // Delayed acknowledgment - confirm the data packets which have waited long enough
+            uint64_t now = get_monotonic_milliseconds();
+            sweep_sessions(&table, now);
+            send_delayed_acknowledgments(clientfd, &table, now);
+            continue;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].data.fd == exit_timer_fd) {
+                uint64_t expiration_count;
+                if (read(exit_timer_fd, &expiration_count, sizeof(expiration_count)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "Failed to read the exit timer: %s\n", strerror(errno));
+                }
+                if (exiting && all_files_saved(&table)) {
+                    running = false;
+                }
+            } else if (receive_packets(sockfd, clientfd, &table, &pool) && !exiting) {
+                // Resent end packets are answered for a while after the last file is written
+                printf("Exiting program after %d seconds.\n", EXIT_DELAY_MS / 1000);
+                struct itimerspec exit_delay = {.it_value = {.tv_sec = EXIT_DELAY_MS / 1000, .tv_nsec = (EXIT_DELAY_MS % 1000) * 1000000L}};
+                timerfd_settime(exit_timer_fd, 0, &exit_delay, NULL);
+                exiting = true;
+            } else if (exiting && !all_files_saved(&table)) {
+                // Another sender started a transmission in the meantime, it is received to the end
+                printf("Not exiting, a transmission started.\n");
+                struct itimerspec disarmed = {0};
+                timerfd_settime(exit_timer_fd, 0, &disarmed, NULL);
+                exiting = false;
+            }
+        }
+    }
+
+    free_receive_pool(&pool);
+    close(exit_timer_fd);
+    close(epoll_fd);
+    closesocket(sockfd);
+    closesocket(clientfd);
+    return !running;
+}
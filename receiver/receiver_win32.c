@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "platform.h"
+#include "receiver.h"
+#include "logger.h"
+
+// Winsock backend of the receiver, one blocking recvfrom per packet which times out to send the delayed acknowledgments
+
+uint64_t get_monotonic_milliseconds(void) {
+    return GetTickCount64();
+}
+
+bool preallocate_file(FILE *file, uint64_t size) {
+    return _chsize_s(_fileno(file), (__int64)size) == 0;
+}
+
+// The part file is only ever accessed through these, a seek is required between its writes and reads anyway
+bool write_file_at(FILE *file, uint64_t offset, const uint8_t *data, size_t size) {
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0 && fwrite(data, 1, size, file) == size;
+}
+
+bool read_file_at(FILE *file, uint64_t offset, uint8_t *data, size_t size) {
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0 && fread(data, 1, size, file) == size;
+}
+
+// Unlike on POSIX, rename fails if the target exists
+bool replace_file(const char *path, const char *target_path) {
+    return MoveFileExA(path, target_path, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+bool new_transmission(unsigned int receiver_port, unsigned int reply_port, bool exit_when_saved) {
+    WSADATA wsa;
+    SOCKET sockfd;
+    SOCKET clientfd;
+    struct sockaddr_in server_addr;
+
+    // set up the socket
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "WSAStartup failed\n");
+        return false;
+    }
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    clientfd = socket(AF_INET, SOCK_DGRAM, 0);
+	// Bind clientfd to the reply port the answers are sent from
+	struct sockaddr_in client_addr;
+	memset(&client_addr, 0, sizeof(client_addr));
+	client_addr.sin_family = AF_INET;
+	client_addr.sin_addr.s_addr = INADDR_ANY;  // Use specific IP if needed
+	client_addr.sin_port = htons(reply_port);
+
+	if (bind(clientfd, (struct sockaddr *)&client_addr, sizeof(client_addr)) == SOCKET_ERROR) {
+		fprintf(stderr, "Failed to bind client socket to port %u: %d\n", reply_port, WSAGetLastError());
+		closesocket(sockfd);
+		closesocket(clientfd);
+		WSACleanup();
+		return false;
+	}
+
+    if (sockfd == INVALID_SOCKET) {
+        fprintf(stderr, "Socket creation failed\n");
+        WSACleanup();
+        return false;
+    }
+
+    if (clientfd == INVALID_SOCKET) {
+        fprintf(stderr, "Client socket creation failed\n");
+        closesocket(sockfd);
+        WSACleanup();
+        return false;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY; // works for communication with  others than me lol
+	server_addr.sin_port = htons(receiver_port);
+
+	if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR) {
+		fprintf(stderr, "Bind failed with error code: %d\n", WSAGetLastError());
+		closesocket(sockfd);
+		WSACleanup();
+		return false;
+	}
+
+    // Wake up periodically to send delayed selective acknowledgments
+    DWORD receive_timeout = SACK_DELAY_MS;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&receive_timeout, sizeof(receive_timeout)) == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to set receive timeout: %d\n", WSAGetLastError());
+        closesocket(sockfd);
+        WSACleanup();
+        return false;
+    }
+
+    printf("Listening on port %d...\n", receiver_port);
+
+    // Resent end packets are answered for a while after the last file is written
+    bool exiting = false;
+    uint64_t exit_time = 0;
+
+    struct sockaddr_in source_addr;
+    uint8_t buffer[BUFFER_SIZE];
+    session_table_t table;
+    memset(&table, 0, sizeof(table));
+    table.last_sweep = get_monotonic_milliseconds();
+    table.exit_when_saved = exit_when_saved;
+    while (!exiting || get_monotonic_milliseconds() < exit_time) { // loop until transmission is complete
+        int addr_len = sizeof(source_addr);
+        ssize_t recv_len = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&source_addr, &addr_len);
+        uint64_t now = get_monotonic_milliseconds();
+        sweep_sessions(&table, now);
+        if (recv_len == SOCKET_ERROR && WSAGetLastError() == WSAETIMEDOUT) {
+            // Delayed acknowledgment - confirm the data packets which have waited long enough
+            send_delayed_acknowledgments(clientfd, &table, now);
+            continue;
+        }
+        if (recv_len == SOCKET_ERROR) {
+            fprintf(stderr, "Received Packed corrupted/failed\n");
+            continue;
+        }
+
+        if (handle_packet(clientfd, &table, buffer, (size_t)recv_len, &source_addr, now) == STOP_TRANSMISSION && !exiting) {
+            printf("Exiting program after %d seconds.\n", EXIT_DELAY_MS / 1000);
+            exit_time = now + EXIT_DELAY_MS;
+            exiting = true;
+        } else if (exiting && !all_files_saved(&table)) {
+            // Another sender started a transmission in the meantime, it is received to the end
+            printf("Not exiting, a transmission started.\n");
+            exiting = false;
+        }
+        // The receive timeout only fires while the socket is idle
+        send_delayed_acknowledgments(clientfd, &table, now);
+    }
+
+    closesocket(sockfd);
+    WSACleanup();
+    return true;
+}
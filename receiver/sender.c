@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "sender.h"
 #include "utils.h"
@@ -70,8 +71,8 @@ corrupted_packet_index, uint32_t transmission_id) {
     // status, 8 bits
     ack_packet[ack_packet_size++] = status ? 1 : 0;
 
-    // Only include this if the packet type is 0x01 (data packet) 32 bits
-    if (packet_type == TRANSMISSION_DATA_PACKET_TYPE) {
+    // Only include this if the packet type is 0x01 (data packet) or 0x06 (probe size) 32 bits
+    if (packet_type == TRANSMISSION_DATA_PACKET_TYPE || packet_type == TRANSMISSION_PROBE_PACKET_TYPE) {
     	uint32_t transmission_id_network = htonl(corrupted_packet_index);
         memcpy(&ack_packet[ack_packet_size], &transmission_id_network, sizeof(uint32_t));
         ack_packet_size += sizeof(uint32_t);
@@ -91,3 +92,210 @@ corrupted_packet_index, uint32_t transmission_id) {
         printf("Acknowledgment 0x04 sent to %s:%u\n", server_ip, server_port);
     }
 }
+
+void send_selective_acknowledgment(SOCKET sockfd, const char *server_ip, uint16_t
+server_port, transmission_t *trans, stripe_t *stripe) {
+    struct sockaddr_in server_addr;
+    uint8_t ack_packet[BUFFER_SIZE];
+    int ack_packet_size = 0;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    // each stripe is acknowledged to the port it is sent from
+    if (stripe->reply_port != 0) {
+        server_port = stripe->reply_port;
+    }
+    server_addr.sin_port = htons(server_port);
+    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+
+    // fill in the packet type
+    ack_packet[ack_packet_size++] = TRANSMISSION_SACK_PACKET_TYPE;
+
+    // add transmission ID
+    uint32_t transmission_id_network = htonl(trans->transmission_id);
+    memcpy(&ack_packet[ack_packet_size], &transmission_id_network, sizeof(uint32_t));
+    ack_packet_size += sizeof(uint32_t);
+
+    // cumulative index, 32 bits - every packet of the stripe below it has been received
+    uint32_t cumulative_index_network = htonl(stripe->cumulative_index);
+    memcpy(&ack_packet[ack_packet_size], &cumulative_index_network, sizeof(uint32_t));
+    ack_packet_size += sizeof(uint32_t);
+
+    // bitmap start index, 32 bits - the packet at the cumulative index is missing so start after it
+    uint32_t bitmap_start_index = stripe->cumulative_index + 1;
+    uint32_t bitmap_start_index_network = htonl(bitmap_start_index);
+    memcpy(&ack_packet[ack_packet_size], &bitmap_start_index_network, sizeof(uint32_t));
+    ack_packet_size += sizeof(uint32_t);
+
+    // bitmap length, 16 bits - up to the highest data packet of the stripe received so far, a small window needs only a few bytes
+    uint32_t bitmap_end_index = trans->received_end_index < stripe->end_index ? trans->received_end_index : stripe->end_index;
+    uint32_t bitmap_size = bitmap_end_index > bitmap_start_index ? (bitmap_end_index - bitmap_start_index + 7) / 8 : 0;
+    if (bitmap_size > SACK_BITMAP_SIZE) {
+        bitmap_size = SACK_BITMAP_SIZE;
+    }
+    uint16_t bitmap_size_network = htons((uint16_t)bitmap_size);
+    memcpy(&ack_packet[ack_packet_size], &bitmap_size_network, sizeof(uint16_t));
+    ack_packet_size += sizeof(uint16_t);
+
+    fill_selective_acknowledgment_bitmap(trans, stripe, bitmap_start_index, &ack_packet[ack_packet_size], (uint16_t)bitmap_size);
+    ack_packet_size += bitmap_size;
+
+    // Add CRC to the end of the packet (calculated from the rest of the packet)
+    uint32_t crc = calculate_crc32(ack_packet, ack_packet_size);
+    crc = htonl(crc);
+    memcpy(&ack_packet[ack_packet_size], &crc, sizeof(uint32_t));
+    ack_packet_size += sizeof(uint32_t);
+
+    stripe->pending_ack_count = 0;
+
+    // Send the selective acknowledgment packet
+    ssize_t sent_len = sendto(sockfd, ack_packet, ack_packet_size, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (sent_len == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to send selective acknowledgment packet 0x05\n");
+    } else {
+        printf("Selective acknowledgment 0x05 (below %u) sent to %s:%u\n", stripe->cumulative_index, server_ip, server_port);
+    }
+}
+
+void send_repair_request(SOCKET sockfd, const char *server_ip, uint16_t server_port, transmission_t *trans,
+uint32_t first_range_index, uint16_t range_count, const uint8_t *bitmap) {
+    struct sockaddr_in server_addr;
+    uint8_t repair_packet[BUFFER_SIZE];
+    int repair_packet_size = 0;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+
+    // fill in the packet type
+    repair_packet[repair_packet_size++] = TRANSMISSION_REPAIR_PACKET_TYPE;
+
+    // add transmission ID
+    uint32_t transmission_id_network = htonl(trans->transmission_id);
+    memcpy(&repair_packet[repair_packet_size], &transmission_id_network, sizeof(uint32_t));
+    repair_packet_size += sizeof(uint32_t);
+
+    // repair round, 8 bits - the sender ignores answers to its earlier rounds
+    repair_packet[repair_packet_size++] = trans->repair_round;
+
+    // first range index, 32 bits, and range count, 16 bits - copied from the range digests packet
+    uint32_t first_range_index_network = htonl(first_range_index);
+    memcpy(&repair_packet[repair_packet_size], &first_range_index_network, sizeof(uint32_t));
+    repair_packet_size += sizeof(uint32_t);
+    uint16_t range_count_network = htons(range_count);
+    memcpy(&repair_packet[repair_packet_size], &range_count_network, sizeof(uint16_t));
+    repair_packet_size += sizeof(uint16_t);
+
+    // bitmap of the damaged ranges
+    memcpy(&repair_packet[repair_packet_size], bitmap, (range_count + 7) / 8);
+    repair_packet_size += (range_count + 7) / 8;
+
+    // Add CRC to the end of the packet (calculated from the rest of the packet)
+    uint32_t crc = calculate_crc32(repair_packet, repair_packet_size);
+    crc = htonl(crc);
+    memcpy(&repair_packet[repair_packet_size], &crc, sizeof(uint32_t));
+    repair_packet_size += sizeof(uint32_t);
+
+    // Send the repair request packet
+    ssize_t sent_len = sendto(sockfd, repair_packet, repair_packet_size, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (sent_len == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to send repair request packet 0x09\n");
+    } else {
+        printf("Repair request 0x09 (ranges %u to %u) sent to %s:%u\n", first_range_index, first_range_index + range_count - 1, server_ip, server_port);
+    }
+}
+
+void send_block_signatures(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint32_t transmission_id,
+uint32_t file_size, uint32_t first_block_index, uint8_t signature_count, const uint8_t *signatures) {
+    struct sockaddr_in server_addr;
+    uint8_t signatures_packet[BUFFER_SIZE];
+    int signatures_packet_size = 0;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+
+    // fill in the packet type
+    signatures_packet[signatures_packet_size++] = TRANSMISSION_SIGNATURES_PACKET_TYPE;
+
+    // add transmission ID
+    uint32_t transmission_id_network = htonl(transmission_id);
+    memcpy(&signatures_packet[signatures_packet_size], &transmission_id_network, sizeof(uint32_t));
+    signatures_packet_size += sizeof(uint32_t);
+
+    // file size, 32 bits - 0 if there is no existing file
+    uint32_t file_size_network = htonl(file_size);
+    memcpy(&signatures_packet[signatures_packet_size], &file_size_network, sizeof(uint32_t));
+    signatures_packet_size += sizeof(uint32_t);
+
+    // first block index, 32 bits - copied from the signature request, and block count, 8 bits
+    uint32_t first_block_index_network = htonl(first_block_index);
+    memcpy(&signatures_packet[signatures_packet_size], &first_block_index_network, sizeof(uint32_t));
+    signatures_packet_size += sizeof(uint32_t);
+    signatures_packet[signatures_packet_size++] = signature_count;
+
+    // weak and strong checksum of each block
+    memcpy(&signatures_packet[signatures_packet_size], signatures, (size_t)signature_count * BLOCK_SIGNATURE_SIZE);
+    signatures_packet_size += signature_count * BLOCK_SIGNATURE_SIZE;
+
+    // Add CRC to the end of the packet (calculated from the rest of the packet)
+    uint32_t crc = calculate_crc32(signatures_packet, signatures_packet_size);
+    crc = htonl(crc);
+    memcpy(&signatures_packet[signatures_packet_size], &crc, sizeof(uint32_t));
+    signatures_packet_size += sizeof(uint32_t);
+
+    // Send the block signatures packet
+    ssize_t sent_len = sendto(sockfd, signatures_packet, signatures_packet_size, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (sent_len == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to send block signatures packet 0x0D\n");
+    } else {
+        printf("Block signatures 0x0D (%u blocks from %u) sent to %s:%u\n", signature_count, first_block_index, server_ip, server_port);
+    }
+}
+
+void send_missing_chunks(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint32_t transmission_id,
+uint32_t first_chunk_index, uint8_t chunk_count, const uint8_t *bitmap) {
+    struct sockaddr_in server_addr;
+    uint8_t missing_packet[BUFFER_SIZE];
+    int missing_packet_size = 0;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(server_port);
+    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+
+    // fill in the packet type
+    missing_packet[missing_packet_size++] = TRANSMISSION_MISSING_CHUNKS_PACKET_TYPE;
+
+    // add transmission ID
+    uint32_t transmission_id_network = htonl(transmission_id);
+    memcpy(&missing_packet[missing_packet_size], &transmission_id_network, sizeof(uint32_t));
+    missing_packet_size += sizeof(uint32_t);
+
+    // first chunk index, 32 bits, and chunk count, 8 bits - copied from the chunk query
+    uint32_t first_chunk_index_network = htonl(first_chunk_index);
+    memcpy(&missing_packet[missing_packet_size], &first_chunk_index_network, sizeof(uint32_t));
+    missing_packet_size += sizeof(uint32_t);
+    missing_packet[missing_packet_size++] = chunk_count;
+
+    // bitmap of the chunks missing from the chunk store
+    int bitmap_size = (chunk_count + 7) / 8;
+    memcpy(&missing_packet[missing_packet_size], bitmap, bitmap_size);
+    missing_packet_size += bitmap_size;
+
+    // Add CRC to the end of the packet (calculated from the rest of the packet)
+    uint32_t crc = calculate_crc32(missing_packet, missing_packet_size);
+    crc = htonl(crc);
+    memcpy(&missing_packet[missing_packet_size], &crc, sizeof(uint32_t));
+    missing_packet_size += sizeof(uint32_t);
+
+    // Send the missing chunks packet
+    ssize_t sent_len = sendto(sockfd, missing_packet, missing_packet_size, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (sent_len == SOCKET_ERROR) {
+        fprintf(stderr, "Failed to send missing chunks packet 0x0F\n");
+    } else {
+        printf("Missing chunks 0x0F (%u chunks from %u) sent to %s:%u\n", chunk_count, first_chunk_index, server_ip, server_port);
+    }
+}
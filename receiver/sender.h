@@ -3,12 +3,29 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <winsock2.h>
+#include "platform.h"
+
+#include "packet.h"
 
 // Sends an acknowledgment packet to the given server IP and port.
 void send_acknowledgment(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint8_t packet_type,
                          bool status, uint32_t corrupted_packet_index, uint32_t transmission_id);
 
+// Sends a selective acknowledgment confirming every data packet of the stripe received so far in the transmission.
+void send_selective_acknowledgment(SOCKET sockfd, const char *server_ip, uint16_t server_port, transmission_t *trans, stripe_t *stripe);
+
+// Sends a repair request marking the damaged ranges of the received range digests.
+void send_repair_request(SOCKET sockfd, const char *server_ip, uint16_t server_port, transmission_t *trans,
+                         uint32_t first_range_index, uint16_t range_count, const uint8_t *bitmap);
+
+// Sends the block signatures of the existing file answering a signature request.
+void send_block_signatures(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint32_t transmission_id,
+                           uint32_t file_size, uint32_t first_block_index, uint8_t signature_count, const uint8_t *signatures);
+
+// Sends the bitmap of the chunks missing from the chunk store answering a chunk query.
+void send_missing_chunks(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint32_t transmission_id,
+                         uint32_t first_chunk_index, uint8_t chunk_count, const uint8_t *bitmap);
+
 //Calculates the SHA-256 hash of the data packets in the transmission structure.
  void send_sha256_acknowledgement(SOCKET sockfd, const char *server_ip, uint16_t server_port, uint8_t status, uint32_t transmission_id);
 
@@ -3,15 +3,16 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-// Function to calculate CRC32 checksum
-uint32_t calculate_crc32(const uint8_t *data, size_t length);
+#include "platform.h"
+#include "../common/block_checksum.h"
+#include "../common/crc32.h"
+#include "packet.h"
 
 // Function to validate CRC32 checksum
 bool validate_crc32(const uint8_t *data, size_t length, uint32_t expected_crc);
 
-// Function to send acknowledgment packet if CRC32 validation fails
-bool check_packet_crc32(uint8_t *buffer, size_t recv_len, const char *sender_ip_address,
-    uint16_t sender_port, SOCKET clientfd, uint8_t packet_type, uint32_t received_crc, uint32_t transmission_id);
+// Function to send negative acknowledgment packet if CRC32 validation fails
+void send_corrupted_packet_acknowledgment(SOCKET clientfd, const char *sender_ip_address, uint16_t sender_port,
+    const packet_view_t *packet);
 
 #endif //UTILS_H
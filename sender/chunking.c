@@ -0,0 +1,142 @@
+#include <openssl/evp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./chunking.h"
+#include "./utils.h"
+
+// Normalized chunking, a boundary is harder to find before the average size
+// and easier after it, the masks spread their bits over the hash
+#define CDC_MASK_SMALL 0x0003590703530000ULL
+#define CDC_MASK_LARGE 0x0000D90003530000ULL
+
+// Random value of each byte, the same for every run so that equal data gets
+// the same boundaries
+uint64_t gear_table[256];
+bool gear_table_initialized = false;
+
+void init_gear_table() {
+	// splitmix64
+	uint64_t state = 0x5053494143444331ULL;
+	for (size_t i = 0; i < 256; ++i) {
+		uint64_t value = (state += 0x9E3779B97F4A7C15ULL);
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+		gear_table[i] = value ^ (value >> 31);
+	}
+	gear_table_initialized = true;
+}
+
+size_t find_cdc_chunk_boundary(const uint8_t *data, size_t size) {
+	if (size <= MIN_CDC_CHUNK_SIZE) {
+		return size;
+	}
+	size_t normal_size = size < AVERAGE_CDC_CHUNK_SIZE ? size
+													   : AVERAGE_CDC_CHUNK_SIZE;
+	size_t max_size = size < MAX_CDC_CHUNK_SIZE ? size : MAX_CDC_CHUNK_SIZE;
+
+	// The bytes before the minimum size are skipped, they cannot end a chunk
+	uint64_t hash = 0;
+	size_t i = MIN_CDC_CHUNK_SIZE;
+	for (; i < normal_size; ++i) {
+		hash = (hash << 1) + gear_table[data[i]];
+		if (!(hash & CDC_MASK_SMALL)) {
+			return i + 1;
+		}
+	}
+	for (; i < max_size; ++i) {
+		hash = (hash << 1) + gear_table[data[i]];
+		if (!(hash & CDC_MASK_LARGE)) {
+			return i + 1;
+		}
+	}
+	return i;
+}
+
+int compare_cdc_chunk_hashes(const void *first, const void *second) {
+	const cdc_chunk_t *first_chunk = *(const cdc_chunk_t **)first;
+	const cdc_chunk_t *second_chunk = *(const cdc_chunk_t **)second;
+	int order = memcmp(first_chunk->hash, second_chunk->hash, HASH_SIZE);
+	if (order != 0) {
+		return order;
+	}
+	return first_chunk->offset < second_chunk->offset ? -1 : 1;
+}
+
+// Points every chunk to the first one with its hash, a chunk repeated within
+// the file is sent once
+void find_unique_cdc_chunks(cdc_chunks_t *chunks) {
+	cdc_chunk_t **order = malloc(sizeof(cdc_chunk_t *) * (chunks->count + 1));
+	chunks->unique_chunks = malloc(sizeof(size_t) * (chunks->count + 1));
+	if (order == NULL || chunks->unique_chunks == NULL) {
+		fprintf(stderr, "Failed to allocate space for chunks!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	for (size_t i = 0; i < chunks->count; ++i) {
+		order[i] = &chunks->chunks[i];
+	}
+	qsort(order, chunks->count, sizeof(cdc_chunk_t *),
+		  compare_cdc_chunk_hashes);
+	for (size_t i = 0; i < chunks->count; ++i) {
+		bool repeated =
+			i > 0 && memcmp(order[i - 1]->hash, order[i]->hash, HASH_SIZE) == 0;
+		order[i]->first_index = repeated ? order[i - 1]->first_index
+										 : (size_t)(order[i] - chunks->chunks);
+	}
+	free(order);
+
+	chunks->unique_count = 0;
+	for (size_t i = 0; i < chunks->count; ++i) {
+		chunks->chunks[i].missing = false;
+		if (chunks->chunks[i].first_index == i) {
+			chunks->unique_chunks[chunks->unique_count++] = i;
+		}
+	}
+}
+
+cdc_chunks_t split_into_cdc_chunks(const uint8_t *data, size_t size) {
+	if (!gear_table_initialized) {
+		init_gear_table();
+	}
+
+	cdc_chunks_t chunks;
+	chunks.count = 0;
+	size_t capacity = size / AVERAGE_CDC_CHUNK_SIZE + 16;
+	chunks.chunks = malloc(sizeof(cdc_chunk_t) * capacity);
+	if (chunks.chunks == NULL) {
+		fprintf(stderr, "Failed to allocate space for chunks!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	size_t offset = 0;
+	while (offset < size) {
+		if (chunks.count == capacity) {
+			capacity *= 2;
+			chunks.chunks =
+				realloc(chunks.chunks, sizeof(cdc_chunk_t) * capacity);
+			if (chunks.chunks == NULL) {
+				fprintf(stderr, "Failed to allocate space for chunks!\n");
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+		}
+		cdc_chunk_t *chunk = &chunks.chunks[chunks.count++];
+		chunk->offset = offset;
+		chunk->size = find_cdc_chunk_boundary(data + offset, size - offset);
+		if (!EVP_Digest(data + offset, chunk->size, chunk->hash, NULL,
+						EVP_sha256(), NULL)) {
+			fprintf(stderr, "Failed to compute EVP digest!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		offset += chunk->size;
+	}
+	find_unique_cdc_chunks(&chunks);
+	return chunks;
+}
+
+void destroy_cdc_chunks(cdc_chunks_t *chunks) {
+	free(chunks->chunks);
+	free(chunks->unique_chunks);
+}
@@ -0,0 +1,42 @@
+#ifndef CHUNKING_H
+#define CHUNKING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./packet.h"
+
+// FastCDC content defined chunking, a boundary depends only on the bytes
+// right before it, so regions shared by different files are split into the
+// same chunks wherever they are
+#define MIN_CDC_CHUNK_SIZE 2048
+#define AVERAGE_CDC_CHUNK_SIZE 8192
+#define MAX_CDC_CHUNK_SIZE 65536
+
+typedef struct {
+	size_t offset;
+	size_t size;
+	uint8_t hash[HASH_SIZE]; // SHA-256, the key of the receiver's chunk store
+	size_t first_index;		 // Of the first chunk with the same hash
+	bool missing;			 // From the receiver's chunk store
+} cdc_chunk_t;
+
+typedef struct {
+	cdc_chunk_t *chunks;
+	size_t count;
+	// Indices of the chunks which are the first with their hash, only they are
+	// queried
+	size_t *unique_chunks;
+	size_t unique_count;
+} cdc_chunks_t;
+
+// Returns the size of the chunk at the start of data
+size_t find_cdc_chunk_boundary(const uint8_t *data, size_t size);
+
+// Splits the data into chunks, hashes them and finds the repeated ones
+cdc_chunks_t split_into_cdc_chunks(const uint8_t *data, size_t size);
+
+void destroy_cdc_chunks(cdc_chunks_t *chunks);
+
+#endif // CHUNKING_H
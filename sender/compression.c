@@ -0,0 +1,152 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./compression.h"
+#include "./utils.h"
+
+bool parse_compression_algorithm(const char *string,
+								 compression_algorithm_t *algorithm) {
+	if (strcmp(string, "zlib") == 0) {
+		*algorithm = ZLIB_COMPRESSION;
+		return true;
+	}
+#ifdef HAVE_ZSTD
+	if (strcmp(string, "zstd") == 0) {
+		*algorithm = ZSTD_COMPRESSION;
+		return true;
+	}
+#endif
+	return false;
+}
+
+void create_compressor(compressor_t *compressor,
+					   compression_algorithm_t algorithm) {
+	memset(compressor, 0, sizeof(*compressor));
+	compressor->algorithm = algorithm;
+
+	switch (algorithm) {
+	case ZLIB_COMPRESSION:
+		// Raw deflate, the packet CRC already covers the data
+		if (deflateInit2(&compressor->zlib_stream, Z_DEFAULT_COMPRESSION,
+						 Z_DEFLATED, -MAX_WBITS, 8,
+						 Z_DEFAULT_STRATEGY) != Z_OK) {
+			fprintf(stderr, "Failed to init zlib compression!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		break;
+	case ZSTD_COMPRESSION:
+#ifdef HAVE_ZSTD
+		compressor->zstd_context = ZSTD_createCCtx();
+		if (compressor->zstd_context == NULL) {
+			fprintf(stderr, "Failed to create zstd context!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+#endif
+		break;
+	case NO_COMPRESSION:
+		break;
+	}
+}
+
+void destroy_compressor(compressor_t *compressor) {
+	switch (compressor->algorithm) {
+	case ZLIB_COMPRESSION:
+		deflateEnd(&compressor->zlib_stream);
+		break;
+	case ZSTD_COMPRESSION:
+#ifdef HAVE_ZSTD
+		ZSTD_freeCCtx(compressor->zstd_context);
+#endif
+		break;
+	case NO_COMPRESSION:
+		break;
+	}
+}
+
+size_t compress_zlib_chunk(compressor_t *compressor, const uint8_t *data,
+						   size_t data_size, uint8_t *output,
+						   size_t output_capacity) {
+	z_stream *stream = &compressor->zlib_stream;
+	if (deflateReset(stream) != Z_OK) {
+		return 0;
+	}
+	stream->next_in = (Bytef *)data;
+	stream->avail_in = data_size;
+	stream->next_out = output;
+	stream->avail_out = output_capacity;
+	// Running out of output space means that the chunk does not shrink
+	if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+		return 0;
+	}
+	return output_capacity - stream->avail_out;
+}
+
+#ifdef HAVE_ZSTD
+size_t compress_zstd_chunk(compressor_t *compressor, const uint8_t *data,
+						   size_t data_size, uint8_t *output,
+						   size_t output_capacity) {
+	size_t compressed_size =
+		ZSTD_compressCCtx(compressor->zstd_context, output, output_capacity,
+						  data, data_size, ZSTD_COMPRESSION_LEVEL);
+	if (ZSTD_isError(compressed_size)) {
+		return 0;
+	}
+	return compressed_size;
+}
+#endif
+
+size_t compress_chunk(compressor_t *compressor, const uint8_t *data,
+					  size_t data_size, uint8_t *output,
+					  size_t output_capacity) {
+	// Incompressible data is only tried now and then
+	if (compressor->miss_count >= COMPRESSION_MISS_LIMIT &&
+		++compressor->skipped_count % COMPRESSION_PROBE_INTERVAL != 0) {
+		++compressor->raw_chunk_count;
+		return 0;
+	}
+
+	size_t compressed_size = 0;
+	if (output_capacity > 0) {
+		switch (compressor->algorithm) {
+		case ZLIB_COMPRESSION:
+			compressed_size = compress_zlib_chunk(compressor, data, data_size,
+												  output, output_capacity);
+			break;
+		case ZSTD_COMPRESSION:
+#ifdef HAVE_ZSTD
+			compressed_size = compress_zstd_chunk(compressor, data, data_size,
+												  output, output_capacity);
+#endif
+			break;
+		case NO_COMPRESSION:
+			break;
+		}
+	}
+
+	if (compressed_size == 0) {
+		++compressor->miss_count;
+		++compressor->raw_chunk_count;
+		return 0;
+	}
+	compressor->miss_count = 0;
+	compressor->skipped_count = 0;
+	++compressor->compressed_chunk_count;
+	compressor->original_size += data_size;
+	compressor->compressed_size += compressed_size;
+	return compressed_size;
+}
+
+void print_compressor(compressor_t *compressor) {
+	printf("Compression: %s, %llu chunks compressed (%.2fx), %llu chunks sent "
+		   "raw\n",
+		   compressor->algorithm == ZLIB_COMPRESSION ? "zlib" : "zstd",
+		   (unsigned long long)compressor->compressed_chunk_count,
+		   compressor->compressed_size > 0
+			   ? (double)compressor->original_size /
+					 compressor->compressed_size
+			   : 0.0,
+		   (unsigned long long)compressor->raw_chunk_count);
+}
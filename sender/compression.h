@@ -0,0 +1,58 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ZSTD_COMPRESSION_LEVEL 3
+// After this many chunks in a row which did not shrink (e.g. of a JPEG) only
+// every COMPRESSION_PROBE_INTERVAL-th chunk is tried until one shrinks again
+#define COMPRESSION_MISS_LIMIT 8
+#define COMPRESSION_PROBE_INTERVAL 64
+
+// Values of the method byte of compressed data packets
+typedef enum {
+	NO_COMPRESSION = 0,
+	ZLIB_COMPRESSION = 1,
+	ZSTD_COMPRESSION = 2
+} compression_algorithm_t;
+
+// Compresses every chunk on its own, so that it can be decompressed as soon as
+// it arrives no matter which packets got lost
+typedef struct {
+	compression_algorithm_t algorithm;
+	z_stream zlib_stream;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd_context;
+#endif
+	size_t miss_count; // Chunks in a row which did not shrink
+	size_t skipped_count;
+	uint64_t compressed_chunk_count;
+	uint64_t raw_chunk_count;
+	uint64_t original_size; // Of the compressed chunks
+	uint64_t compressed_size;
+} compressor_t;
+
+bool parse_compression_algorithm(const char *string,
+								 compression_algorithm_t *algorithm);
+
+// Initialises the compressor in place, zlib keeps a pointer to its stream
+void create_compressor(compressor_t *compressor,
+					   compression_algorithm_t algorithm);
+
+void destroy_compressor(compressor_t *compressor);
+
+// Returns the size of the compressed chunk written to output, 0 if the chunk
+// is to be sent raw because it did not get smaller than output_capacity
+size_t compress_chunk(compressor_t *compressor, const uint8_t *data,
+					  size_t data_size, uint8_t *output,
+					  size_t output_capacity);
+
+void print_compressor(compressor_t *compressor);
+
+#endif // COMPRESSION_H
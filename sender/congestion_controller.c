@@ -0,0 +1,257 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./congestion_controller.h"
+#include "./rtt_estimator.h"
+
+static void clamp_congestion_window(congestion_controller_t *controller) {
+	if (controller->window < MIN_CONGESTION_WINDOW) {
+		controller->window = MIN_CONGESTION_WINDOW;
+	}
+	if (controller->window > MAX_CONGESTION_WINDOW) {
+		controller->window = MAX_CONGESTION_WINDOW;
+	}
+}
+
+static void new_reno_on_acknowledgement(congestion_controller_t *controller,
+										size_t acknowledged_count,
+										uint64_t now,
+										rtt_estimator_t *rtt_estimator) {
+	(void)now;
+	(void)rtt_estimator;
+	if (controller->window < controller->slow_start_threshold) {
+		// Slow start - double the window every RTT
+		controller->window += acknowledged_count;
+	} else {
+		// Congestion avoidance - one more packet every RTT
+		controller->window += acknowledged_count / controller->window;
+	}
+	clamp_congestion_window(controller);
+}
+
+static void new_reno_on_loss(congestion_controller_t *controller, size_t index,
+							 size_t current_index, loss_cause_t cause) {
+	if (index >= controller->recovery_index) {
+		controller->slow_start_threshold = controller->window / 2;
+		if (controller->slow_start_threshold < MIN_CONGESTION_WINDOW) {
+			controller->slow_start_threshold = MIN_CONGESTION_WINDOW;
+		}
+		controller->window = controller->slow_start_threshold;
+		controller->recovery_index = current_index;
+	}
+	// As after a TCP retransmission timeout, slow start again from the minimum
+	if (cause == RESEND_TIMEOUT_LOSS) {
+		controller->window = MIN_CONGESTION_WINDOW;
+	}
+}
+
+static double get_max_delivery_rate(congestion_controller_t *controller) {
+	double max_delivery_rate = 0;
+	for (size_t i = 0; i < DELIVERY_RATE_WINDOW_ROUNDS; ++i) {
+		if (controller->delivery_rates[i] > max_delivery_rate) {
+			max_delivery_rate = controller->delivery_rates[i];
+		}
+	}
+	return max_delivery_rate;
+}
+
+static double get_bandwidth_delay_product(congestion_controller_t *controller) {
+	// The minimum RTT is filtered over the same rounds as the delivery rate, so
+	// that a single lucky sample does not shrink the window for good
+	uint64_t min_rtt = UINT64_MAX;
+	for (size_t i = 0; i < DELIVERY_RATE_WINDOW_ROUNDS; ++i) {
+		if (controller->round_min_rtts[i] != 0 &&
+			controller->round_min_rtts[i] < min_rtt) {
+			min_rtt = controller->round_min_rtts[i];
+		}
+	}
+	if (min_rtt == UINT64_MAX) {
+		return 0;
+	}
+	if (min_rtt < MIN_BANDWIDTH_DELAY_RTT) {
+		min_rtt = MIN_BANDWIDTH_DELAY_RTT;
+	}
+	return get_max_delivery_rate(controller) * min_rtt;
+}
+
+static double get_delivery_rate_sample(congestion_controller_t *controller) {
+	if (!controller->has_rate_sample || controller->sample_interval == 0) {
+		return 0;
+	}
+	return (double)(controller->delivered -
+					controller->sample_prior_delivered) /
+		   controller->sample_interval;
+}
+
+static void delay_based_on_acknowledgement(congestion_controller_t *controller,
+										   size_t acknowledged_count,
+										   uint64_t now,
+										   rtt_estimator_t *rtt_estimator) {
+	(void)now;
+	// A round trip ends once a packet sent after its start is acknowledged
+	if (controller->has_rate_sample &&
+		controller->sample_prior_delivered >=
+			controller->next_round_delivered) {
+		controller->next_round_delivered = controller->delivered;
+		++controller->round_count;
+		size_t round = controller->round_count % DELIVERY_RATE_WINDOW_ROUNDS;
+		controller->delivery_rates[round] = 0;
+		controller->round_min_rtts[round] = 0;
+
+		if (controller->startup) {
+			// Leave startup once the delivery rate stops growing
+			double max_delivery_rate = get_max_delivery_rate(controller);
+			if (max_delivery_rate >= controller->full_bandwidth * 1.25) {
+				controller->full_bandwidth = max_delivery_rate;
+				controller->full_bandwidth_rounds = 0;
+			} else if (++controller->full_bandwidth_rounds >=
+					   STARTUP_FULL_BANDWIDTH_ROUNDS) {
+				controller->startup = false;
+			}
+		}
+	}
+
+	size_t round = controller->round_count % DELIVERY_RATE_WINDOW_ROUNDS;
+	double delivery_rate = get_delivery_rate_sample(controller);
+	if (delivery_rate > controller->delivery_rates[round]) {
+		controller->delivery_rates[round] = delivery_rate;
+	}
+	if (rtt_estimator->sample_count &&
+		(controller->round_min_rtts[round] == 0 ||
+		 rtt_estimator->latest_rtt < controller->round_min_rtts[round])) {
+		controller->round_min_rtts[round] = rtt_estimator->latest_rtt;
+	}
+
+	if (controller->startup) {
+		controller->window += acknowledged_count;
+	} else if (controller->round_count > controller->loss_round) {
+		// Keep two bandwidth-delay products in flight
+		controller->window = 2 * get_bandwidth_delay_product(controller);
+	}
+	clamp_congestion_window(controller);
+}
+
+static void delay_based_on_loss(congestion_controller_t *controller,
+								size_t index, size_t current_index,
+								loss_cause_t cause) {
+	if (index >= controller->recovery_index) {
+		// Losses tell us that the bottleneck queue is full - stop probing and
+		// drain the queue for the rest of the round
+		controller->startup = false;
+		controller->window *= DELAY_BASED_LOSS_REDUCTION;
+		clamp_congestion_window(controller);
+		controller->recovery_index = current_index;
+		controller->loss_round = controller->round_count;
+	}
+	// Nothing gets through - keep the minimum window until a round trip
+	// completes again and the window follows the bandwidth-delay product
+	if (cause == RESEND_TIMEOUT_LOSS) {
+		controller->window = MIN_CONGESTION_WINDOW;
+		controller->loss_round = controller->round_count;
+	}
+}
+
+static const congestion_controller_operations_t new_reno_operations = {
+	"newreno", new_reno_on_acknowledgement, new_reno_on_loss};
+
+static const congestion_controller_operations_t delay_based_operations = {
+	"delay", delay_based_on_acknowledgement, delay_based_on_loss};
+
+congestion_controller_t
+create_congestion_controller(congestion_control_algorithm_t algorithm) {
+	congestion_controller_t controller;
+	memset(&controller, 0, sizeof(controller));
+
+	switch (algorithm) {
+	case NEW_RENO_CONGESTION_CONTROL:
+		controller.operations = &new_reno_operations;
+		break;
+	case DELAY_BASED_CONGESTION_CONTROL:
+		controller.operations = &delay_based_operations;
+		break;
+	}
+	controller.window = INITIAL_CONGESTION_WINDOW;
+	controller.slow_start_threshold = MAX_CONGESTION_WINDOW;
+	controller.startup = true;
+
+	return controller;
+}
+
+bool parse_congestion_control_algorithm(
+	const char *name, congestion_control_algorithm_t *algorithm) {
+	if (strcmp(name, new_reno_operations.name) == 0) {
+		*algorithm = NEW_RENO_CONGESTION_CONTROL;
+		return true;
+	}
+	if (strcmp(name, delay_based_operations.name) == 0) {
+		*algorithm = DELAY_BASED_CONGESTION_CONTROL;
+		return true;
+	}
+	return false;
+}
+
+void congestion_controller_on_packet_sent(congestion_controller_t *controller,
+										  sent_packet_t *sent_packet,
+										  size_t in_flight_count) {
+	if (in_flight_count == 0) {
+		controller->first_sent_time = sent_packet->time_stamp;
+		controller->delivered_time = sent_packet->time_stamp;
+	}
+	sent_packet->delivered = controller->delivered;
+	sent_packet->delivered_time = controller->delivered_time;
+	sent_packet->first_sent_time = controller->first_sent_time;
+}
+
+void congestion_controller_on_packet_acknowledged(
+	congestion_controller_t *controller, sent_packet_t *sent_packet,
+	uint64_t now) {
+	++controller->delivered;
+	controller->delivered_time = now;
+
+	// The rate is sampled from the most recently sent of the acknowledged
+	// packets, over the longer of its send and acknowledgement intervals so
+	// that compressed acknowledgements do not inflate it
+	if (!controller->has_rate_sample ||
+		sent_packet->delivered >= controller->sample_prior_delivered) {
+		uint64_t send_interval =
+			sent_packet->time_stamp - sent_packet->first_sent_time;
+		uint64_t acknowledgement_interval = now - sent_packet->delivered_time;
+		controller->has_rate_sample = true;
+		controller->sample_prior_delivered = sent_packet->delivered;
+		controller->sample_interval = send_interval > acknowledgement_interval
+										  ? send_interval
+										  : acknowledgement_interval;
+		controller->first_sent_time = sent_packet->time_stamp;
+	}
+}
+
+void congestion_controller_on_acknowledgement(
+	congestion_controller_t *controller, size_t acknowledged_count,
+	uint64_t now, rtt_estimator_t *rtt_estimator) {
+	if (acknowledged_count == 0) {
+		return;
+	}
+	controller->operations->on_acknowledgement(controller, acknowledged_count,
+											   now, rtt_estimator);
+	controller->has_rate_sample = false;
+}
+
+void congestion_controller_on_loss(congestion_controller_t *controller,
+								   size_t index, size_t current_index,
+								   loss_cause_t cause) {
+	controller->operations->on_loss(controller, index, current_index, cause);
+}
+
+size_t get_congestion_window(congestion_controller_t *controller) {
+	return (size_t)controller->window;
+}
+
+void print_congestion_controller(congestion_controller_t *controller) {
+	printf("Congestion control: %s, window %zu packets, max delivery rate "
+		   "%.1f packets/s\n",
+		   controller->operations->name, get_congestion_window(controller),
+		   get_max_delivery_rate(controller) * 1000000);
+}
@@ -0,0 +1,100 @@
+#ifndef CONGESTION_CONTROLLER_H
+#define CONGESTION_CONTROLLER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./packet.h"
+#include "./rtt_estimator.h"
+
+#define INITIAL_CONGESTION_WINDOW 10
+#define MIN_CONGESTION_WINDOW 2
+// The receiver's selective acknowledgement bitmap covers this many packets,
+// 4 MB in flight with the default chunk size fill a gigabit link up to a 30 ms
+// round trip time
+#define MAX_CONGESTION_WINDOW 4096
+#define DELIVERY_RATE_WINDOW_ROUNDS 10
+#define STARTUP_FULL_BANDWIDTH_ROUNDS 3
+#define DELAY_BASED_LOSS_REDUCTION 0.7
+// Acknowledgements are sent in batches by the receiver, so less than this much
+// data in flight would leave the link idle between them
+#define MIN_BANDWIDTH_DELAY_RTT 2000 // 2ms
+
+typedef enum {
+	NEW_RENO_CONGESTION_CONTROL,
+	DELAY_BASED_CONGESTION_CONTROL
+} congestion_control_algorithm_t;
+
+// How a lost packet was noticed
+typedef enum {
+	// Packets sent after it were acknowledged, the path still delivers
+	FAST_RETRANSMIT_LOSS,
+	// Its resend timer fired, the acknowledgements may have stopped altogether
+	RESEND_TIMEOUT_LOSS
+} loss_cause_t;
+
+typedef struct congestion_controller_t congestion_controller_t;
+
+typedef struct {
+	const char *name;
+	void (*on_acknowledgement)(congestion_controller_t *controller,
+							   size_t acknowledged_count, uint64_t now,
+							   rtt_estimator_t *rtt_estimator);
+	void (*on_loss)(congestion_controller_t *controller, size_t index,
+					size_t current_index, loss_cause_t cause);
+} congestion_controller_operations_t;
+
+struct congestion_controller_t {
+	const congestion_controller_operations_t *operations;
+	double window; // In packets
+	double slow_start_threshold;
+	// Losses of packets sent before this index belong to one congestion event
+	size_t recovery_index;
+
+	// Delivery rate sampling, packets keep a snapshot of it when they are sent
+	uint64_t delivered;
+	uint64_t delivered_time;
+	uint64_t first_sent_time;
+	bool has_rate_sample;
+	uint64_t sample_prior_delivered;
+	uint64_t sample_interval;
+
+	// Delay based (BBR-like) state
+	bool startup;
+	uint64_t next_round_delivered;
+	size_t loss_round;
+	double delivery_rates[DELIVERY_RATE_WINDOW_ROUNDS]; // Packets per us
+	uint64_t round_min_rtts[DELIVERY_RATE_WINDOW_ROUNDS];
+	size_t round_count;
+	double full_bandwidth;
+	size_t full_bandwidth_rounds;
+};
+
+congestion_controller_t
+create_congestion_controller(congestion_control_algorithm_t algorithm);
+
+bool parse_congestion_control_algorithm(
+	const char *name, congestion_control_algorithm_t *algorithm);
+
+void congestion_controller_on_packet_sent(congestion_controller_t *controller,
+										  sent_packet_t *sent_packet,
+										  size_t in_flight_count);
+
+void congestion_controller_on_packet_acknowledged(
+	congestion_controller_t *controller, sent_packet_t *sent_packet,
+	uint64_t now);
+
+void congestion_controller_on_acknowledgement(
+	congestion_controller_t *controller, size_t acknowledged_count,
+	uint64_t now, rtt_estimator_t *rtt_estimator);
+
+void congestion_controller_on_loss(congestion_controller_t *controller,
+								   size_t index, size_t current_index,
+								   loss_cause_t cause);
+
+size_t get_congestion_window(congestion_controller_t *controller);
+
+void print_congestion_controller(congestion_controller_t *controller);
+
+#endif // CONGESTION_CONTROLLER_H
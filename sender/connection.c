@@ -1,22 +1,30 @@
+#define _GNU_SOURCE // sendmmsg and recvmmsg
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "netinet/in.h"
 #include "sys/socket.h"
 #include "sys/time.h"
-#include "zlib.h"
 
+#include "../common/crc32.h"
 #include "./connection.h"
 #include "./packet.h"
+#include "./timer_queue.h"
 #include "./utils.h"
 
 void set_non_blocking(int sockfd) {
@@ -81,10 +89,75 @@ connection_t create_connection(char *receiver_ip_address,
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
+	connection.timer_descriptor =
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	connection.epoll_descriptor = epoll_create1(EPOLL_CLOEXEC);
+	if (connection.timer_descriptor < 0 || connection.epoll_descriptor < 0) {
+		fprintf(stderr, "Failed to create epoll instance or timer!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	int descriptors[] = {connection.socket, connection.timer_descriptor};
+	for (size_t i = 0; i < sizeof(descriptors) / sizeof(descriptors[0]); ++i) {
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = descriptors[i];
+		if (epoll_ctl(connection.epoll_descriptor, EPOLL_CTL_ADD,
+					  descriptors[i], &event) < 0) {
+			fprintf(stderr, "Failed to add descriptor to epoll instance!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+
 	return connection;
 }
 
-void close_connection(connection_t connection) { close(connection.socket); }
+void close_connection(connection_t connection) {
+	close(connection.epoll_descriptor);
+	close(connection.timer_descriptor);
+	close(connection.socket);
+}
+
+bool wait_for_packet(connection_t connection, uint64_t deadline) {
+	// An all zero value would disarm the timer instead of firing right away
+	struct itimerspec timer_value;
+	memset(&timer_value, 0, sizeof(timer_value));
+	timer_value.it_value.tv_sec = deadline / 1000000;
+	timer_value.it_value.tv_nsec = deadline % 1000000 * 1000;
+	if (deadline == 0) {
+		timer_value.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(connection.timer_descriptor, TFD_TIMER_ABSTIME,
+						&timer_value, NULL) < 0) {
+		fprintf(stderr, "Failed to arm timer!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	struct epoll_event events[2];
+	int event_count;
+	do {
+		event_count = epoll_wait(connection.epoll_descriptor, events, 2, -1);
+	} while (event_count < 0 && errno == EINTR);
+	if (event_count < 0) {
+		fprintf(stderr, "Failed to wait for events!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	bool received_packet = false;
+	for (int i = 0; i < event_count; ++i) {
+		if (events[i].data.fd == connection.socket) {
+			received_packet = true;
+		} else {
+			uint64_t expiration_count;
+			if (read(connection.timer_descriptor, &expiration_count,
+					 sizeof(expiration_count)) < 0 &&
+				errno != EAGAIN) {
+				fprintf(stderr, "Failed to read timer!\n");
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+		}
+	}
+	return received_packet;
+}
 
 void send_packet_data(connection_t connection, uint8_t *packet_data,
 					  size_t packet_size) {
@@ -96,30 +169,41 @@ void send_packet_data(connection_t connection, uint8_t *packet_data,
 	}
 }
 
-sent_packet_t send_packet(connection_t connection, packet_t *packet) {
+sent_packet_t prepare_packet(packet_t *packet) {
 	uint8_t *packet_data = NULL;
 	size_t packet_size;
 	serialize_packet(packet, &packet_data, &packet_size);
 
-	send_packet_data(connection, packet_data, packet_size);
-
-	struct timeval now;
-	gettimeofday(&now, NULL);
-
 	sent_packet_t sent_packet;
-	sent_packet.time_stamp = now.tv_usec + now.tv_sec * 1000000;
-	sent_packet.acknowledgement = NONE;
+	sent_packet.time_stamp = get_time_in_microseconds();
+	sent_packet.retransmission_count = 0;
+	sent_packet.timer_position = TIMER_NOT_SCHEDULED;
 	sent_packet.packet_data = packet_data;
 	sent_packet.packet_data_size = packet_size;
+	sent_packet.payload = NULL;
+	sent_packet.payload_size = 0;
+	return sent_packet;
+}
+
+sent_packet_t send_packet(connection_t connection, packet_t *packet) {
+	sent_packet_t sent_packet = prepare_packet(packet);
+	send_packet_data(connection, sent_packet.packet_data,
+					 sent_packet.packet_data_size);
 	return sent_packet;
 }
 
 sent_packet_t send_transmission_start_packet(connection_t connection,
 											 uint32_t transmission_id,
 											 uint32_t transmission_length,
+											 uint16_t chunk_size,
+											 uint8_t flags,
+											 uint32_t stripe_length,
 											 const char *file_name) {
 	transmission_start_packet_content_t content;
 	content.transmission_length = transmission_length;
+	content.chunk_size = chunk_size;
+	content.flags = flags;
+	content.stripe_length = stripe_length;
 	content.file_name = file_name;
 
 	packet_t packet;
@@ -130,29 +214,89 @@ sent_packet_t send_transmission_start_packet(connection_t connection,
 	return send_packet(connection, &packet);
 }
 
-sent_packet_t send_transmission_data_packet(connection_t connection,
-											uint32_t transmission_id,
-											uint32_t index, uint8_t *data,
-											size_t data_size) {
-	transmission_data_packet_content_t content;
-	content.index = index;
-	content.data = data;
-	content.data_size = data_size;
+sent_packet_t prepare_transmission_data_packet(uint8_t packet_type,
+											   uint32_t transmission_id,
+											   uint32_t index,
+											   const uint8_t *data,
+											   size_t data_size) {
+	sent_packet_t sent_packet;
+	sent_packet.packet_data = NULL;
+	sent_packet.packet_data_size =
+		DATA_PACKET_HEADER_SIZE + data_size + CRC_SIZE;
+	sent_packet.payload = data;
+	sent_packet.payload_size = data_size;
+	serialize_transmission_data_packet_frame(packet_type, transmission_id,
+											 index, data, data_size,
+											 sent_packet.header,
+											 sent_packet.trailer);
+
+	sent_packet.time_stamp = get_time_in_microseconds();
+	sent_packet.retransmission_count = 0;
+	sent_packet.timer_position = TIMER_NOT_SCHEDULED;
+	return sent_packet;
+}
+
+void send_range_digests_packet(connection_t connection,
+							   uint32_t transmission_id, uint8_t repair_round,
+							   uint32_t first_range_index, uint16_t range_count,
+							   const uint8_t (*digests)[HASH_SIZE]) {
+	range_digests_packet_content_t content;
+	content.repair_round = repair_round;
+	content.first_range_index = first_range_index;
+	content.range_count = range_count;
+	content.digests = digests;
 
 	packet_t packet;
-	packet.packet_type = TRANSMISSION_DATA_PACKET_TYPE;
+	packet.packet_type = RANGE_DIGESTS_PACKET_TYPE;
 	packet.transmission_id = transmission_id;
 	packet.content = &content;
 
-	return send_packet(connection, &packet);
+	sent_packet_t sent_packet = send_packet(connection, &packet);
+	free(sent_packet.packet_data);
+}
+
+void send_signature_request_packet(connection_t connection,
+								   uint32_t transmission_id,
+								   uint32_t first_block_index,
+								   uint16_t block_size, const char *file_name) {
+	signature_request_packet_content_t content;
+	content.first_block_index = first_block_index;
+	content.block_size = block_size;
+	content.file_name = file_name;
+
+	packet_t packet;
+	packet.packet_type = SIGNATURE_REQUEST_PACKET_TYPE;
+	packet.transmission_id = transmission_id;
+	packet.content = &content;
+
+	sent_packet_t sent_packet = send_packet(connection, &packet);
+	free(sent_packet.packet_data);
+}
+
+void send_chunk_query_packet(connection_t connection, uint32_t transmission_id,
+							 uint32_t first_chunk_index, uint8_t chunk_count,
+							 const uint8_t (*hashes)[HASH_SIZE]) {
+	chunk_query_packet_content_t content;
+	content.first_chunk_index = first_chunk_index;
+	content.chunk_count = chunk_count;
+	content.hashes = hashes;
+
+	packet_t packet;
+	packet.packet_type = CHUNK_QUERY_PACKET_TYPE;
+	packet.transmission_id = transmission_id;
+	packet.content = &content;
+
+	sent_packet_t sent_packet = send_packet(connection, &packet);
+	free(sent_packet.packet_data);
 }
 
 sent_packet_t send_transmission_end_packet(connection_t connection,
 										   uint32_t transmission_id,
-										   uint32_t file_size,
+										   uint64_t file_size, bool large_file,
 										   uint8_t hash[HASH_SIZE]) {
 	transmission_end_packet_content_t content;
 	content.file_size = file_size;
+	content.large_file = large_file;
 	memcpy(&content.hash, hash, HASH_SIZE);
 
 	packet_t packet;
@@ -163,17 +307,66 @@ sent_packet_t send_transmission_end_packet(connection_t connection,
 	return send_packet(connection, &packet);
 }
 
-bool receive_packet(connection_t connection, packet_t *packet) {
-	uint8_t *packet_buffer = malloc(sizeof(uint8_t) * MAX_PACKET_SIZE);
-	if (packet_buffer == NULL) {
-		printf("Malloc failed in receive_packet()\n");
+sent_packet_t send_manifest_packet(connection_t connection,
+								   uint32_t session_id, uint32_t file_count) {
+	manifest_packet_content_t content;
+	content.file_count = file_count;
+
+	packet_t packet;
+	packet.packet_type = MANIFEST_PACKET_TYPE;
+	packet.transmission_id = session_id;
+	packet.content = &content;
+
+	return send_packet(connection, &packet);
+}
+
+int set_path_mtu_discovery(connection_t connection, int mode) {
+	int previous_mode;
+	socklen_t option_size = sizeof(previous_mode);
+	if (getsockopt(connection.socket, IPPROTO_IP, IP_MTU_DISCOVER,
+				   &previous_mode, &option_size) < 0 ||
+		setsockopt(connection.socket, IPPROTO_IP, IP_MTU_DISCOVER, &mode,
+				   sizeof(mode)) < 0) {
+		fprintf(stderr, "Failed to set path MTU discovery!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
+	return previous_mode;
+}
+
+bool send_path_mtu_probe(connection_t connection, size_t probe_size) {
+	path_mtu_probe_packet_content_t content;
+	content.padding_size = probe_size - sizeof(uint8_t) - sizeof(uint32_t) -
+						   CRC_SIZE;
+
+	packet_t packet;
+	packet.packet_type = PATH_MTU_PROBE_PACKET_TYPE;
+	packet.transmission_id = 0;
+	packet.content = &content;
+
+	sent_packet_t sent_packet = prepare_packet(&packet);
+	ssize_t sent_size =
+		sendto(connection.socket, sent_packet.packet_data,
+			   sent_packet.packet_data_size, 0,
+			   (struct sockaddr *)&connection.receiver_address,
+			   sizeof(connection.receiver_address));
+	free(sent_packet.packet_data);
+	if (sent_size < 0) {
+		// Larger than the MTU of the path known to the kernel
+		if (errno == EMSGSIZE) {
+			return false;
+		}
+		fprintf(stderr, "Failed to send packet!");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	return true;
+}
 
+bool receive_packet(connection_t connection, uint8_t *buffer,
+					packet_view_t *packet) {
 	socklen_t address_size = sizeof(connection.receiver_address);
-	int packet_buffer_length = recvfrom(
-		connection.socket, (char *)packet_buffer, MAX_PACKET_SIZE, 0,
-		(struct sockaddr *)&connection.receiver_address, &address_size);
+	int packet_buffer_length =
+		recvfrom(connection.socket, (char *)buffer, MAX_PACKET_SIZE, 0,
+				 (struct sockaddr *)&connection.receiver_address, &address_size);
 	if (packet_buffer_length < 0) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
 			// No data received
@@ -184,25 +377,155 @@ bool receive_packet(connection_t connection, packet_t *packet) {
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
-	uint32_t received_crc;
-	memcpy(&received_crc, packet_buffer + packet_buffer_length - CRC_SIZE,
-		   CRC_SIZE);
+	// Data received and parsed
+	return parse_packet(buffer, packet_buffer_length, packet);
+}
 
-	uint32_t calculated_crc = crc32(0L, Z_NULL, 0);
-	calculated_crc = crc32(calculated_crc, (const Bytef *)packet_buffer,
-						   packet_buffer_length - CRC_SIZE);
-	calculated_crc = htonl(calculated_crc);
-	if (received_crc != calculated_crc) {
-		return false;
+packet_batch_t create_packet_batch(size_t size) {
+	packet_batch_t batch;
+	memset(&batch, 0, sizeof(batch));
+	batch.size = size;
+
+	batch.messages = calloc(size, sizeof(struct mmsghdr));
+	batch.iovecs = calloc(size * MAX_PACKET_IOVECS, sizeof(struct iovec));
+	batch.receive_buffers = malloc(size * MAX_PACKET_SIZE);
+	if (batch.messages == NULL || batch.iovecs == NULL ||
+		batch.receive_buffers == NULL) {
+		fprintf(stderr, "Failed to allocate space for packet batch!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
-	if (packet_buffer[0] != ACKNOWLEDGEMENT_PACKET_TYPE &&
-		packet_buffer[0] != TRANSMISSION_END_RESPONSE_PACKET_TYPE) {
-		return false;
+	return batch;
+}
+
+void destroy_packet_batch(packet_batch_t *batch) {
+	free(batch->messages);
+	free(batch->iovecs);
+	free(batch->receive_buffers);
+}
+
+void queue_packet(connection_t connection, packet_batch_t *batch,
+				  sent_packet_t *sent_packet) {
+	if (batch->queued_count == batch->size) {
+		flush_packet_batch(connection, batch);
 	}
 
-	*packet = parse_packet(packet_buffer, packet_buffer_length);
-	free(packet_buffer);
-	// Data received and parsed
-	return true;
+	// The iovecs point into the sent packet which has to stay in place until
+	// the batch is flushed
+	struct iovec *iov = &batch->iovecs[batch->queued_count * MAX_PACKET_IOVECS];
+	size_t iov_count;
+	if (sent_packet->packet_data != NULL) {
+		iov[0].iov_base = sent_packet->packet_data;
+		iov[0].iov_len = sent_packet->packet_data_size;
+		iov_count = 1;
+	} else {
+		iov[0].iov_base = sent_packet->header;
+		iov[0].iov_len = DATA_PACKET_HEADER_SIZE;
+		iov[1].iov_base = (void *)sent_packet->payload;
+		iov[1].iov_len = sent_packet->payload_size;
+		iov[2].iov_base = sent_packet->trailer;
+		iov[2].iov_len = CRC_SIZE;
+		iov_count = 3;
+	}
+
+	struct msghdr *message = &batch->messages[batch->queued_count].msg_hdr;
+	memset(message, 0, sizeof(*message));
+	message->msg_name = &batch->receiver_address;
+	message->msg_namelen = sizeof(batch->receiver_address);
+	message->msg_iov = iov;
+	message->msg_iovlen = iov_count;
+
+	++batch->queued_count;
+}
+
+void wait_until_writable(int socket) {
+	struct pollfd poll_descriptor;
+	poll_descriptor.fd = socket;
+	poll_descriptor.events = POLLOUT;
+	if (poll(&poll_descriptor, 1, -1) < 0 && errno != EINTR) {
+		fprintf(stderr, "Failed to wait for the socket!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+}
+
+void flush_packet_batch(connection_t connection, packet_batch_t *batch) {
+	batch->receiver_address = connection.receiver_address;
+
+	size_t sent_count = 0;
+	while (sent_count < batch->queued_count) {
+		int result =
+			sendmmsg(connection.socket, batch->messages + sent_count,
+					 batch->queued_count - sent_count, 0);
+		if (result < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// The socket buffer is full - wait for it to drain
+				wait_until_writable(connection.socket);
+				continue;
+			}
+			fprintf(stderr, "Failed to send packets!");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+
+		++batch->send_call_count;
+		sent_count += result;
+	}
+
+	batch->sent_packet_count += batch->queued_count;
+	batch->queued_count = 0;
+}
+
+size_t receive_packet_batch(connection_t connection, packet_batch_t *batch,
+							packet_view_t *packets, size_t *packet_count) {
+	for (size_t i = 0; i < batch->size; ++i) {
+		struct iovec *iov = &batch->iovecs[i * MAX_PACKET_IOVECS];
+		iov->iov_base = batch->receive_buffers + i * MAX_PACKET_SIZE;
+		iov->iov_len = MAX_PACKET_SIZE;
+
+		struct msghdr *message = &batch->messages[i].msg_hdr;
+		memset(message, 0, sizeof(*message));
+		message->msg_iov = iov;
+		message->msg_iovlen = 1;
+	}
+
+	*packet_count = 0;
+	int received_count =
+		recvmmsg(connection.socket, batch->messages, batch->size, 0, NULL);
+	if (received_count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			// No data received
+			return 0;
+		}
+
+		fprintf(stderr, "Recvmmsg failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	++batch->receive_call_count;
+	batch->received_packet_count += received_count;
+
+	for (int i = 0; i < received_count; ++i) {
+		uint8_t *packet_buffer = batch->receive_buffers + i * MAX_PACKET_SIZE;
+		int packet_buffer_length = batch->messages[i].msg_len;
+		if (parse_packet(packet_buffer, packet_buffer_length,
+						 &packets[*packet_count])) {
+			++*packet_count;
+		}
+	}
+
+	return received_count;
+}
+
+void print_packet_batch_statistics(packet_batch_t *batch) {
+	printf("Batching: %lu packets in %lu sendmmsg calls (%.1f per call), %lu "
+		   "packets in %lu recvmmsg calls (%.1f per call), batch size %zu\n",
+		   (unsigned long)batch->sent_packet_count,
+		   (unsigned long)batch->send_call_count,
+		   batch->send_call_count ? (double)batch->sent_packet_count /
+										batch->send_call_count
+								  : 0.0,
+		   (unsigned long)batch->received_packet_count,
+		   (unsigned long)batch->receive_call_count,
+		   batch->receive_call_count ? (double)batch->received_packet_count /
+										   batch->receive_call_count
+									 : 0.0,
+		   batch->size);
 }
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -14,12 +15,35 @@
 #include "./packet.h"
 #include "./utils.h"
 
+#define DEFAULT_BATCH_SIZE 32
+#define MAX_BATCH_SIZE 1024
+// Header, payload and trailer of a data packet
+#define MAX_PACKET_IOVECS 3
+
 typedef struct connection_t {
 	struct sockaddr_in sender_address;
 	struct sockaddr_in receiver_address;
 	int socket;
+	// The sender sleeps in epoll until a packet arrives on the socket or the
+	// timer armed with the next deadline fires
+	int epoll_descriptor;
+	int timer_descriptor;
 } connection_t;
 
+// Datagrams sent with one sendmmsg and received with one recvmmsg call
+typedef struct {
+	struct mmsghdr *messages;
+	struct iovec *iovecs;
+	uint8_t *receive_buffers;
+	struct sockaddr_in receiver_address;
+	size_t size;
+	size_t queued_count;
+	uint64_t send_call_count;
+	uint64_t sent_packet_count;
+	uint64_t receive_call_count;
+	uint64_t received_packet_count;
+} packet_batch_t;
+
 int create_socket();
 
 struct sockaddr_in create_receiver_address(char *target_ip_address,
@@ -31,26 +55,78 @@ connection_t create_connection(char *receiver_ip_address,
 
 void close_connection(connection_t connection);
 
+// Waits until a packet arrives or the CLOCK_MONOTONIC deadline in
+// microseconds passes, returns true in the former case
+bool wait_for_packet(connection_t connection, uint64_t deadline);
+
 void send_packet_data(connection_t connection, uint8_t *packet_data,
 					  size_t packet_size);
 
+sent_packet_t prepare_packet(packet_t *packet);
+
 sent_packet_t send_packet(connection_t connection, packet_t *packet);
 
 sent_packet_t send_transmission_start_packet(connection_t connection,
 											 uint32_t transmission_id,
 											 uint32_t transmission_length,
+											 uint16_t chunk_size,
+											 uint8_t flags,
+											 uint32_t stripe_length,
 											 const char *file_name);
 
-sent_packet_t send_transmission_data_packet(connection_t connection,
-											uint32_t transmission_id,
-											uint32_t index, uint8_t *data,
-											size_t data_size);
+// packet_type is TRANSMISSION_DATA_PACKET_TYPE or COMPRESSED_DATA_PACKET_TYPE
+sent_packet_t prepare_transmission_data_packet(uint8_t packet_type,
+											   uint32_t transmission_id,
+											   uint32_t index,
+											   const uint8_t *data,
+											   size_t data_size);
+
+void send_range_digests_packet(connection_t connection,
+							   uint32_t transmission_id, uint8_t repair_round,
+							   uint32_t first_range_index, uint16_t range_count,
+							   const uint8_t (*digests)[HASH_SIZE]);
+
+void send_signature_request_packet(connection_t connection,
+								   uint32_t transmission_id,
+								   uint32_t first_block_index,
+								   uint16_t block_size, const char *file_name);
+
+void send_chunk_query_packet(connection_t connection, uint32_t transmission_id,
+							 uint32_t first_chunk_index, uint8_t chunk_count,
+							 const uint8_t (*hashes)[HASH_SIZE]);
 
 sent_packet_t send_transmission_end_packet(connection_t connection,
 										   uint32_t transmission_id,
-										   uint32_t file_size,
+										   uint64_t file_size, bool large_file,
 										   uint8_t hash[HASH_SIZE]);
 
-bool receive_packet(connection_t connection, packet_t *packet);
+sent_packet_t send_manifest_packet(connection_t connection,
+								   uint32_t session_id, uint32_t file_count);
+
+// Returns the previous IP_MTU_DISCOVER mode of the socket
+int set_path_mtu_discovery(connection_t connection, int mode);
+
+// Returns false if the probe is larger than the known path MTU
+bool send_path_mtu_probe(connection_t connection, size_t probe_size);
+
+// Receives into buffer (MAX_PACKET_SIZE bytes) which the packet points into
+bool receive_packet(connection_t connection, uint8_t *buffer,
+					packet_view_t *packet);
+
+packet_batch_t create_packet_batch(size_t size);
+
+void destroy_packet_batch(packet_batch_t *batch);
+
+void queue_packet(connection_t connection, packet_batch_t *batch,
+				  sent_packet_t *sent_packet);
+
+void flush_packet_batch(connection_t connection, packet_batch_t *batch);
+
+// The packets point into the receive buffers of the batch, they are valid
+// until the next call
+size_t receive_packet_batch(connection_t connection, packet_batch_t *batch,
+							packet_view_t *packets, size_t *packet_count);
+
+void print_packet_batch_statistics(packet_batch_t *batch);
 
 #endif // CONNECTION_H
@@ -0,0 +1,291 @@
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "./delta.h"
+#include "./utils.h"
+
+// Writes the instructions, consecutive matching blocks are merged into one
+// copy instruction
+typedef struct {
+	delta_t *delta;
+	bool copy_pending;
+	uint32_t copy_block_index;
+	uint32_t copy_block_count;
+} delta_writer_t;
+
+void create_block_signatures(block_signatures_t *signatures, size_t file_size,
+							 size_t block_size) {
+	signatures->file_size = file_size;
+	signatures->block_size = block_size;
+	signatures->block_count = file_size / block_size;
+	signatures->signatures = NULL;
+	signatures->table = NULL;
+	signatures->table_mask = 0;
+	if (signatures->block_count > 0) {
+		signatures->signatures =
+			malloc(sizeof(block_signature_t) * signatures->block_count);
+		if (signatures->signatures == NULL) {
+			fprintf(stderr, "Failed to allocate space for signatures!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+}
+
+void destroy_block_signatures(block_signatures_t *signatures) {
+	free(signatures->signatures);
+	free(signatures->table);
+}
+
+size_t get_block_signature_slot(block_signatures_t *signatures,
+								uint32_t weak_checksum) {
+	uint32_t hash = weak_checksum * 0x9E3779B1u;
+	return (hash ^ hash >> 16) & signatures->table_mask;
+}
+
+void index_block_signatures(block_signatures_t *signatures) {
+	// At most half full
+	size_t table_size = 1;
+	while (table_size < 2 * signatures->block_count) {
+		table_size *= 2;
+	}
+	signatures->table = calloc(table_size, sizeof(uint32_t));
+	if (signatures->table == NULL) {
+		fprintf(stderr, "Failed to allocate space for signatures!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	signatures->table_mask = table_size - 1;
+
+	for (size_t i = 0; i < signatures->block_count; ++i) {
+		size_t slot = get_block_signature_slot(
+			signatures, signatures->signatures[i].weak_checksum);
+		while (signatures->table[slot] != 0) {
+			slot = (slot + 1) & signatures->table_mask;
+		}
+		signatures->table[slot] = i + 1;
+	}
+}
+
+// Returns the index of a block of the receiver's copy equal to the data or
+// SIZE_MAX, the strong checksum is only computed once the weak one matches
+size_t find_matching_block(block_signatures_t *signatures,
+						   uint32_t weak_checksum, const uint8_t *data,
+						   size_t preferred_block) {
+	bool strong_checksum_known = false;
+	uint64_t strong_checksum = 0;
+
+	// The block following the last copied one extends its copy instruction
+	if (preferred_block < signatures->block_count &&
+		signatures->signatures[preferred_block].weak_checksum ==
+			weak_checksum) {
+		strong_checksum =
+			calculate_strong_checksum(data, signatures->block_size);
+		strong_checksum_known = true;
+		if (signatures->signatures[preferred_block].strong_checksum ==
+			strong_checksum) {
+			return preferred_block;
+		}
+	}
+
+	for (size_t slot = get_block_signature_slot(signatures, weak_checksum);
+		 signatures->table[slot] != 0;
+		 slot = (slot + 1) & signatures->table_mask) {
+		block_signature_t *signature =
+			&signatures->signatures[signatures->table[slot] - 1];
+		if (signature->weak_checksum != weak_checksum) {
+			continue;
+		}
+		if (!strong_checksum_known) {
+			strong_checksum =
+				calculate_strong_checksum(data, signatures->block_size);
+			strong_checksum_known = true;
+		}
+		if (signature->strong_checksum == strong_checksum) {
+			return signatures->table[slot] - 1;
+		}
+	}
+	return SIZE_MAX;
+}
+
+void write_delta(delta_writer_t *writer, const void *data, size_t size) {
+	if (size > 0 && fwrite(data, 1, size, writer->delta->file) != size) {
+		fprintf(stderr, "Failed to write delta!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	writer->delta->size += size;
+}
+
+void flush_copy_instruction(delta_writer_t *writer) {
+	if (!writer->copy_pending) {
+		return;
+	}
+	uint8_t instruction[DELTA_COPY_INSTRUCTION_SIZE];
+	instruction[0] = DELTA_COPY_INSTRUCTION;
+	uint32_t block_index_net = htonl(writer->copy_block_index);
+	memcpy(instruction + 1, &block_index_net, sizeof(block_index_net));
+	uint32_t block_count_net = htonl(writer->copy_block_count);
+	memcpy(instruction + 5, &block_count_net, sizeof(block_count_net));
+	write_delta(writer, instruction, sizeof(instruction));
+	writer->copy_pending = false;
+}
+
+void write_copy_instruction(delta_writer_t *writer, size_t block,
+							size_t block_size) {
+	if (writer->copy_pending &&
+		block == (size_t)writer->copy_block_index + writer->copy_block_count) {
+		++writer->copy_block_count;
+	} else {
+		flush_copy_instruction(writer);
+		writer->copy_pending = true;
+		writer->copy_block_index = block;
+		writer->copy_block_count = 1;
+	}
+	writer->delta->copied_size += block_size;
+}
+
+void write_literal_instruction(delta_writer_t *writer, const uint8_t *data,
+							   size_t size) {
+	if (size == 0) {
+		return;
+	}
+	flush_copy_instruction(writer);
+	uint8_t instruction[DELTA_LITERAL_INSTRUCTION_SIZE];
+	instruction[0] = DELTA_LITERAL_INSTRUCTION;
+	uint32_t size_net = htonl(size);
+	memcpy(instruction + 1, &size_net, sizeof(size_net));
+	write_delta(writer, instruction, sizeof(instruction));
+	write_delta(writer, data, size);
+	writer->delta->literal_size += size;
+}
+
+void start_delta(const uint8_t *data, size_t file_size, uint8_t flag,
+				 delta_t *delta) {
+	// The receiver checks the file it rebuilds against the hash of this one
+	delta->flag = flag;
+	delta->original_file_size = file_size;
+	if (!EVP_Digest(data, file_size, delta->original_hash, NULL, EVP_sha256(),
+					NULL)) {
+		fprintf(stderr, "Failed to compute EVP digest!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	delta->file = tmpfile();
+	if (delta->file == NULL) {
+		fprintf(stderr, "Failed to create delta file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	delta->size = 0;
+	delta->copied_size = 0;
+	delta->literal_size = 0;
+}
+
+void finish_delta(delta_t *delta) {
+	if (fflush(delta->file)) {
+		fprintf(stderr, "Failed to write delta!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	rewind(delta->file);
+}
+
+bool create_delta(FILE *file, size_t file_size,
+				  block_signatures_t *signatures, delta_t *delta) {
+	size_t block_size = signatures->block_size;
+	if (signatures->block_count == 0 || file_size < block_size) {
+		return false;
+	}
+
+	const uint8_t *data =
+		mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Failed to memory map file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	madvise((void *)data, file_size, MADV_SEQUENTIAL);
+
+	start_delta(data, file_size, DELTA_FLAG, delta);
+	delta_writer_t writer = {delta, false, 0, 0};
+
+	// Slide the weak checksum over the file a byte at a time, a matching
+	// block is skipped as a whole
+	size_t position = 0;
+	size_t literal_start = 0;
+	size_t preferred_block = SIZE_MAX;
+	uint32_t weak_checksum = 0;
+	bool weak_checksum_valid = false;
+	while (position + block_size <= file_size) {
+		if (!weak_checksum_valid) {
+			weak_checksum = calculate_weak_checksum(data + position, block_size);
+			weak_checksum_valid = true;
+		}
+		size_t block = find_matching_block(signatures, weak_checksum,
+										   data + position, preferred_block);
+		if (block != SIZE_MAX) {
+			write_literal_instruction(&writer, data + literal_start,
+									  position - literal_start);
+			write_copy_instruction(&writer, block, block_size);
+			preferred_block = block + 1;
+			position += block_size;
+			literal_start = position;
+			weak_checksum_valid = false;
+			continue;
+		}
+		if (position + block_size < file_size) {
+			weak_checksum =
+				roll_weak_checksum(weak_checksum, data[position],
+								   data[position + block_size], block_size);
+		}
+		++position;
+	}
+	write_literal_instruction(&writer, data + literal_start,
+							  file_size - literal_start);
+	flush_copy_instruction(&writer);
+
+	if (munmap((void *)data, file_size)) {
+		fprintf(stderr, "Failed to unmap file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	finish_delta(delta);
+
+	if (delta->copied_size == 0) {
+		fclose(delta->file);
+		return false;
+	}
+	return true;
+}
+
+void create_dedup_delta(const uint8_t *data, size_t file_size,
+						cdc_chunks_t *chunks, delta_t *delta) {
+	start_delta(data, file_size, DEDUP_FLAG, delta);
+	delta_writer_t writer = {delta, false, 0, 0};
+
+	for (size_t i = 0; i < chunks->count; ++i) {
+		cdc_chunk_t *chunk = &chunks->chunks[i];
+		// Every literal is one chunk, so a chunk repeated later in the file
+		// is in the store by the time the receiver gets to it
+		if (chunk->first_index == i && chunk->missing) {
+			write_literal_instruction(&writer, data + chunk->offset,
+									  chunk->size);
+			continue;
+		}
+		uint8_t instruction[DELTA_STORED_CHUNK_INSTRUCTION_SIZE];
+		instruction[0] = DELTA_STORED_CHUNK_INSTRUCTION;
+		memcpy(instruction + 1, chunk->hash, HASH_SIZE);
+		write_delta(&writer, instruction, sizeof(instruction));
+		delta->copied_size += chunk->size;
+	}
+
+	finish_delta(delta);
+}
+
+void print_delta(delta_t *delta) {
+	printf("Delta: %llu bytes copied from the receiver's %s, %llu bytes "
+		   "sent literally in %zu bytes of instructions\n",
+		   (unsigned long long)delta->copied_size,
+		   delta->flag == DEDUP_FLAG ? "chunk store" : "copy",
+		   (unsigned long long)delta->literal_size, delta->size);
+}
@@ -0,0 +1,63 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../common/block_checksum.h"
+#include "./chunking.h"
+#include "./packet.h"
+
+typedef struct {
+	uint32_t weak_checksum;
+	uint64_t strong_checksum;
+} block_signature_t;
+
+// Signatures of the full blocks of the receiver's copy of a file, its shorter
+// last block is never matched
+typedef struct {
+	size_t file_size; // Of the receiver's copy, 0 if it has none
+	size_t block_size;
+	size_t block_count;
+	block_signature_t *signatures;
+	// Open addressing table of block index + 1 by weak checksum, 0 is empty
+	uint32_t *table;
+	size_t table_mask;
+} block_signatures_t;
+
+// Delta instructions rebuilding a file from the receiver's copy or from the
+// chunks in its chunk store, they are sent instead of the file
+typedef struct {
+	uint8_t flag; // DELTA_FLAG or DEDUP_FLAG of the transmission start
+	FILE *file;	  // Temporary file of the instructions
+	size_t size;
+	size_t original_file_size;
+	uint8_t original_hash[HASH_SIZE]; // SHA-256 of the file
+	// Bytes taken from the receiver's copy or chunk store
+	uint64_t copied_size;
+	uint64_t literal_size;
+} delta_t;
+
+void create_block_signatures(block_signatures_t *signatures, size_t file_size,
+							 size_t block_size);
+
+void destroy_block_signatures(block_signatures_t *signatures);
+
+// Builds the table once all of the signatures have been received
+void index_block_signatures(block_signatures_t *signatures);
+
+// Returns false if no block of the file matches, so that it is better sent as
+// is
+bool create_delta(FILE *file, size_t file_size,
+				  block_signatures_t *signatures, delta_t *delta);
+
+// Sends the chunks missing from the receiver's chunk store as literals, which
+// it adds to the store, and refers to the others by their hash
+void create_dedup_delta(const uint8_t *data, size_t file_size,
+						cdc_chunks_t *chunks, delta_t *delta);
+
+void print_delta(delta_t *delta);
+
+#endif // DELTA_H
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./connection.h"
+#include "./fec.h"
+#include "./packet.h"
+#include "./utils.h"
+
+bool parse_fec_parameters(const char *string, size_t *group_size,
+						  size_t *parity_count) {
+	int parsed_group_size, parsed_parity_count;
+	if (sscanf(string, "%d:%d", &parsed_group_size, &parsed_parity_count) !=
+		2) {
+		return false;
+	}
+	if (parsed_group_size < 1 || parsed_group_size > MAX_FEC_GROUP_SIZE ||
+		parsed_parity_count < 1 ||
+		parsed_parity_count > MAX_FEC_PARITY_COUNT ||
+		parsed_parity_count > parsed_group_size) {
+		return false;
+	}
+
+	*group_size = parsed_group_size;
+	*parity_count = parsed_parity_count;
+	return true;
+}
+
+fec_encoder_t create_fec_encoder(size_t group_size, size_t parity_count,
+								 size_t chunk_size) {
+	fec_encoder_t encoder;
+	encoder.group_size = group_size;
+	encoder.parity_count = parity_count;
+	encoder.chunk_size = chunk_size;
+	encoder.group_start_index = 0;
+	encoder.group_packet_count = 0;
+	encoder.sent_parity_packet_count = 0;
+	encoder.parity_data = calloc(parity_count, chunk_size);
+	encoder.parity_sizes = calloc(parity_count, sizeof(size_t));
+	encoder.length_parities = calloc(parity_count, sizeof(uint16_t));
+	if (encoder.parity_data == NULL || encoder.parity_sizes == NULL ||
+		encoder.length_parities == NULL) {
+		fprintf(stderr, "Failed to allocate space for parity!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	return encoder;
+}
+
+void destroy_fec_encoder(fec_encoder_t *encoder) {
+	free(encoder->parity_data);
+	free(encoder->parity_sizes);
+	free(encoder->length_parities);
+}
+
+bool add_fec_data_packet(fec_encoder_t *encoder, uint32_t index,
+						 const uint8_t *data, size_t data_size) {
+	if (encoder->group_packet_count == 0) {
+		encoder->group_start_index = index;
+	}
+
+	size_t parity_index = encoder->group_packet_count % encoder->parity_count;
+	uint8_t *parity = encoder->parity_data + parity_index * encoder->chunk_size;
+	for (size_t i = 0; i < data_size; ++i) {
+		parity[i] ^= data[i];
+	}
+	if (data_size > encoder->parity_sizes[parity_index]) {
+		encoder->parity_sizes[parity_index] = data_size;
+	}
+	encoder->length_parities[parity_index] ^= data_size;
+
+	return ++encoder->group_packet_count == encoder->group_size;
+}
+
+size_t finish_fec_group(fec_encoder_t *encoder, uint32_t transmission_id,
+						sent_packet_t *parity_packets) {
+	// A short last group may leave some parities without any data packet
+	size_t parity_packet_count = encoder->group_packet_count;
+	if (parity_packet_count > encoder->parity_count) {
+		parity_packet_count = encoder->parity_count;
+	}
+
+	for (size_t i = 0; i < parity_packet_count; ++i) {
+		fec_parity_packet_content_t content;
+		content.group_start_index = encoder->group_start_index;
+		content.group_size = encoder->group_size;
+		content.parity_count = encoder->parity_count;
+		content.parity_index = i;
+		content.length_parity = encoder->length_parities[i];
+		content.data = encoder->parity_data + i * encoder->chunk_size;
+		content.data_size = encoder->parity_sizes[i];
+
+		packet_t packet;
+		packet.packet_type = FEC_PARITY_PACKET_TYPE;
+		packet.transmission_id = transmission_id;
+		packet.content = &content;
+
+		parity_packets[i] = prepare_packet(&packet);
+	}
+
+	encoder->sent_parity_packet_count += parity_packet_count;
+	encoder->group_packet_count = 0;
+	memset(encoder->parity_data, 0,
+		   encoder->parity_count * encoder->chunk_size);
+	memset(encoder->parity_sizes, 0,
+		   encoder->parity_count * sizeof(*encoder->parity_sizes));
+	memset(encoder->length_parities, 0,
+		   encoder->parity_count * sizeof(*encoder->length_parities));
+	return parity_packet_count;
+}
+
+void print_fec_encoder(fec_encoder_t *encoder) {
+	printf("FEC: %zu parity packets per %zu data packets, %llu parity packets "
+		   "sent\n",
+		   encoder->parity_count, encoder->group_size,
+		   (unsigned long long)encoder->sent_parity_packet_count);
+}
@@ -0,0 +1,49 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./packet.h"
+
+#define MAX_FEC_GROUP_SIZE 255
+#define MAX_FEC_PARITY_COUNT 16
+
+// XOR parity over groups of group_size consecutive data packets. Parity packet
+// j of a group covers the data packets whose offset in the group is j modulo
+// parity_count, so any burst of up to parity_count lost packets in a group can
+// be rebuilt by the receiver.
+typedef struct {
+	size_t group_size;
+	size_t parity_count;
+	size_t chunk_size;
+	uint32_t group_start_index;
+	size_t group_packet_count; // Data packets added to the current group
+	uint8_t *parity_data;	   // parity_count chunk sized buffers
+	size_t *parity_sizes;	   // Longest data packet covered by each parity
+	uint16_t *length_parities;
+	uint64_t sent_parity_packet_count;
+} fec_encoder_t;
+
+// Parses "<group_size>:<parity_count>"
+bool parse_fec_parameters(const char *string, size_t *group_size,
+						  size_t *parity_count);
+
+fec_encoder_t create_fec_encoder(size_t group_size, size_t parity_count,
+								 size_t chunk_size);
+
+void destroy_fec_encoder(fec_encoder_t *encoder);
+
+// Returns true once the group is complete and its parity packets are due
+bool add_fec_data_packet(fec_encoder_t *encoder, uint32_t index,
+						 const uint8_t *data, size_t data_size);
+
+// Returns the number of parity packets of the current group which are written
+// to parity_packets (at most parity_count) and starts a new group
+size_t finish_fec_group(fec_encoder_t *encoder, uint32_t transmission_id,
+						sent_packet_t *parity_packets);
+
+void print_fec_encoder(fec_encoder_t *encoder);
+
+#endif // FEC_H
@@ -1,4 +1,5 @@
 #include <arpa/inet.h>
+#include <getopt.h>
 #include <openssl/evp.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -8,31 +9,261 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../common/crc32.h"
 #include "./connection.h"
 #include "./transmission.h"
 #include "./utils.h"
 
+void print_usage(const char *program_name) {
+	fprintf(stderr,
+			"Usage: %s [options] <file|directory>... <receiver_port> "
+			"<receiver_ip_address> <sender_port>\n"
+			"       %s [options] -i <name> <receiver_port> "
+			"<receiver_ip_address> <sender_port>\n"
+			"Files and the regular files inside directories are sent in one "
+			"session\n"
+			"Options:\n"
+			"  -c <newreno|delay>  congestion control algorithm (default "
+			"newreno), the\n"
+			"                      window is at most %d packets\n"
+			"  -m                  send data straight from the memory mapped "
+			"file\n"
+			"  -b <size>           datagrams sent and received per system "
+			"call (default %d)\n"
+			"  -s <size>           data bytes per data packet (default %d, "
+			"at most %d)\n"
+			"  -p                  probe the path MTU for the largest data "
+			"packet\n"
+			"                      up to -s that does not get fragmented\n"
+			"  -f <k>:<m>          send m XOR parity packets per k data "
+			"packets\n"
+			"  -t                  verify the file by a tree hash computed in "
+			"parallel\n"
+			"  -n <count>          send each file in count stripes by as many "
+			"threads\n"
+			"                      from sender_port + 1 on, implies -t "
+			"(at most %d)\n"
+			"  -z <zlib|zstd>      compress every data packet on its own, "
+			"incompressible\n"
+			"                      ones are sent raw (zstd only if built "
+			"with HAVE_ZSTD)\n"
+			"  -d                  send only the difference to the file of the "
+			"same name\n"
+			"                      the receiver already has, such files are "
+			"neither\n"
+			"                      verified by a tree hash nor sent in stripes\n"
+			"  -u                  send only the content defined chunks missing "
+			"from\n"
+			"                      the receiver's chunk store, after trying -d "
+			"if given\n"
+			"  -r <depth>          data packets read and hashed ahead by a "
+			"reader thread\n"
+			"                      (default %d, 0 to read them in the send "
+			"loop)\n"
+			"  -l                  send each file with a 64-bit size and never "
+			"as a\n"
+			"                      delta, always on for files over 4 GiB\n"
+			"  -i <name>           send standard input (e.g. a pipe) of unknown "
+			"length\n"
+			"                      as a file of this name, implies -l, "
+			"cannot be repaired\n"
+			"                      and ignores -m, -t, -n, -d and -u\n"
+			"  -k                  benchmark the CRC-32 implementations and "
+			"exit\n",
+			program_name, program_name, MAX_CONGESTION_WINDOW,
+			DEFAULT_BATCH_SIZE, DEFAULT_CHUNK_SIZE, MAX_CHUNK_SIZE,
+			MAX_STRIPE_COUNT, DEFAULT_READ_AHEAD_DEPTH);
+}
+
 int main(int argc, char **argv) {
 	// We are going to need this later for generating random
 	// ids etc.
 	srand(time(NULL));
+	init_crc32();
+
+	transmission_options_t options;
+	options.congestion_control = NEW_RENO_CONGESTION_CONTROL;
+	options.memory_map = false;
+	options.batch_size = DEFAULT_BATCH_SIZE;
+	options.chunk_size = DEFAULT_CHUNK_SIZE;
+	options.probe_path_mtu = false;
+	options.fec_group_size = 0;
+	options.fec_parity_count = 0;
+	options.tree_hash = false;
+	options.stripe_count = 1;
+	options.compression = NO_COMPRESSION;
+	options.delta = false;
+	options.dedup = false;
+	options.read_ahead_depth = DEFAULT_READ_AHEAD_DEPTH;
+	options.large_file = false;
+	options.stream_name = NULL;
+	bool chunk_size_set = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "c:mb:s:pf:tn:z:dur:li:kh")) != -1) {
+		switch (option) {
+		case 'c':
+			if (!parse_congestion_control_algorithm(
+					optarg, &options.congestion_control)) {
+				fprintf(stderr, "Unknown congestion control algorithm %s!\n",
+						optarg);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 'm':
+			options.memory_map = true;
+			break;
+		case 'b':
+			options.batch_size = atoi(optarg);
+			if (options.batch_size < 1 || options.batch_size > MAX_BATCH_SIZE) {
+				fprintf(stderr, "Batch size has to be between 1 and %d!\n",
+						MAX_BATCH_SIZE);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 's':
+			options.chunk_size = atoi(optarg);
+			if (options.chunk_size < MIN_CHUNK_SIZE ||
+				options.chunk_size > MAX_CHUNK_SIZE) {
+				fprintf(stderr, "Chunk size has to be between %d and %d!\n",
+						MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			chunk_size_set = true;
+			break;
+		case 'p':
+			options.probe_path_mtu = true;
+			break;
+		case 'f':
+			if (!parse_fec_parameters(optarg, &options.fec_group_size,
+									  &options.fec_parity_count)) {
+				fprintf(stderr,
+						"Invalid FEC parameters %s, expected <k>:<m> with "
+						"1 <= m <= k <= %d and m <= %d!\n",
+						optarg, MAX_FEC_GROUP_SIZE, MAX_FEC_PARITY_COUNT);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 't':
+			options.tree_hash = true;
+			break;
+		case 'n':
+			options.stripe_count = atoi(optarg);
+			if (options.stripe_count < 1 ||
+				options.stripe_count > MAX_STRIPE_COUNT) {
+				fprintf(stderr, "Stripe count has to be between 1 and %d!\n",
+						MAX_STRIPE_COUNT);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 'z':
+			if (!parse_compression_algorithm(optarg, &options.compression)) {
+				fprintf(stderr, "Unknown compression algorithm %s!\n", optarg);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 'd':
+			options.delta = true;
+			break;
+		case 'u':
+			options.dedup = true;
+			break;
+		case 'r':
+			options.read_ahead_depth = atoi(optarg);
+			if (options.read_ahead_depth > MAX_READ_AHEAD_DEPTH) {
+				fprintf(stderr, "Read ahead depth has to be at most %d!\n",
+						MAX_READ_AHEAD_DEPTH);
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			break;
+		case 'l':
+			options.large_file = true;
+			break;
+		case 'i':
+			options.stream_name = optarg;
+			break;
+		case 'k':
+			return benchmark_crc32() == 0 ? EXIT_SUCCESS
+										  : NON_RECOVERABLE_ERROR_CODE;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+
+	// Standard input can be read only once and only in order, so it is written
+	// to disk by the receiver as it arrives and verified by SHA-256
+	if (options.stream_name != NULL) {
+		options.memory_map = false;
+		options.tree_hash = false;
+		options.stripe_count = 1;
+		options.delta = false;
+		options.dedup = false;
+		options.large_file = true;
+	}
+
+	// The stripes are hashed in parallel while SHA-256 would need them in order
+	if (options.stripe_count > 1) {
+		options.tree_hash = true;
+	}
+
+	// Without an explicit chunk size probe all the way up to jumbo frames
+	if (options.probe_path_mtu && !chunk_size_set) {
+		options.chunk_size = MAX_CHUNK_SIZE;
+	}
 
-	if (argc != 5) {
-		fprintf(stderr, "Not enough arguments supplied - see --help!\n");
+	if (argc - optind < (options.stream_name != NULL ? 3 : 4)) {
+		fprintf(stderr, "Not enough arguments supplied - see -h!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
-	char *filename = argv[1];
-	unsigned int receiver_port = atoi(argv[2]);
-	char *receiver_ip_address = argv[3];
-	unsigned int sender_port = atoi(argv[4]);
+	size_t file_count;
+	char **file_paths;
+	if (options.stream_name != NULL) {
+		if (argc - optind > 3) {
+			fprintf(stderr, "Files cannot be sent along with a stream!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		file_count = 1;
+		file_paths = malloc(sizeof(char *));
+		if (file_paths == NULL) {
+			fprintf(stderr, "Failed to allocate memory for file paths!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		file_paths[0] = strdup(STREAM_FILE_PATH);
+	} else {
+		file_paths =
+			collect_file_paths(argv + optind, argc - optind - 3, &file_count);
+	}
+	if (file_count == 0) {
+		fprintf(stderr, "No files to send!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	unsigned int receiver_port = atoi(argv[argc - 3]);
+	char *receiver_ip_address = argv[argc - 2];
+	unsigned int sender_port = atoi(argv[argc - 1]);
 
 	connection_t connection =
 		create_connection(receiver_ip_address, receiver_port, sender_port);
+	connection_t stripe_connections[MAX_STRIPE_COUNT];
+	for (size_t i = 0; i < options.stripe_count && options.stripe_count > 1;
+		 ++i) {
+		stripe_connections[i] = create_connection(
+			receiver_ip_address, receiver_port, sender_port + 1 + i);
+	}
 
-	transmit_file(connection, filename);
+	transmit_files(connection, stripe_connections, file_paths, file_count,
+				   options);
 
 	close_connection(connection);
+	for (size_t i = 0; i < options.stripe_count && options.stripe_count > 1;
+		 ++i) {
+		close_connection(stripe_connections[i]);
+	}
+	free_file_paths(file_paths, file_count);
 
 	return EXIT_SUCCESS;
 }
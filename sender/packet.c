@@ -5,8 +5,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <zlib.h>
 
+#include "../common/block_checksum.h"
+#include "../common/crc32.h"
 #include "./packet.h"
 #include "./utils.h"
 
@@ -15,7 +16,11 @@ void serialize_transmission_start_packet_content(
 	uint8_t **packet_content_data, size_t *packet_content_size) {
 	// Calculate packet size
 	*packet_content_size = sizeof(packet_content->transmission_length) +
-						   strlen(packet_content->file_name) + 1;
+						   sizeof(packet_content->chunk_size) +
+						   sizeof(packet_content->flags) + strlen(packet_content->file_name) + 1;
+	if (packet_content->flags & STRIPE_FLAG) {
+		*packet_content_size += sizeof(packet_content->stripe_length);
+	}
 
 	// Allocate space
 	*packet_content_data = malloc(*packet_content_size);
@@ -32,6 +37,20 @@ void serialize_transmission_start_packet_content(
 		   sizeof(transmission_length_net));
 	packet_content_data_pointer += sizeof(transmission_length_net);
 
+	uint16_t chunk_size_net = htons(packet_content->chunk_size);
+	memcpy(packet_content_data_pointer, &chunk_size_net,
+		   sizeof(chunk_size_net));
+	packet_content_data_pointer += sizeof(chunk_size_net);
+
+	*packet_content_data_pointer++ = packet_content->flags;
+
+	if (packet_content->flags & STRIPE_FLAG) {
+		uint32_t stripe_length_net = htonl(packet_content->stripe_length);
+		memcpy(packet_content_data_pointer, &stripe_length_net,
+			   sizeof(stripe_length_net));
+		packet_content_data_pointer += sizeof(stripe_length_net);
+	}
+
 	memcpy(packet_content_data_pointer, packet_content->file_name,
 		   strlen(packet_content->file_name) + 1);
 }
@@ -64,8 +83,9 @@ void serialize_transmission_end_packet_content(
 	transmission_end_packet_content_t *packet_content,
 	uint8_t **packet_content_data, size_t *packet_content_size) {
 	// Calculate packet size
-	*packet_content_size =
-		sizeof(packet_content->file_size) + sizeof(packet_content->hash);
+	size_t file_size_size =
+		packet_content->large_file ? sizeof(uint64_t) : sizeof(uint32_t);
+	*packet_content_size = file_size_size + sizeof(packet_content->hash);
 
 	// Allocate space
 	*packet_content_data = malloc(*packet_content_size);
@@ -76,7 +96,14 @@ void serialize_transmission_end_packet_content(
 	uint8_t *packet_content_data_pointer = *packet_content_data;
 
 	// Serialize
-	uint32_t file_size_net = htonl(packet_content->file_size);
+	if (packet_content->large_file) {
+		uint32_t file_size_high_net =
+			htonl((uint32_t)(packet_content->file_size >> 32));
+		memcpy(packet_content_data_pointer, &file_size_high_net,
+			   sizeof(file_size_high_net));
+		packet_content_data_pointer += sizeof(file_size_high_net);
+	}
+	uint32_t file_size_net = htonl((uint32_t)packet_content->file_size);
 	memcpy(packet_content_data_pointer, &file_size_net, sizeof(file_size_net));
 	packet_content_data_pointer += sizeof(file_size_net);
 
@@ -84,6 +111,172 @@ void serialize_transmission_end_packet_content(
 		   sizeof(packet_content->hash));
 }
 
+void serialize_manifest_packet_content(
+	manifest_packet_content_t *packet_content, uint8_t **packet_content_data,
+	size_t *packet_content_size) {
+	// Calculate packet size
+	*packet_content_size = sizeof(packet_content->file_count);
+
+	// Allocate space
+	*packet_content_data = malloc(*packet_content_size);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	// Serialize
+	uint32_t file_count_net = htonl(packet_content->file_count);
+	memcpy(*packet_content_data, &file_count_net, sizeof(file_count_net));
+}
+
+void serialize_fec_parity_packet_content(
+	fec_parity_packet_content_t *packet_content, uint8_t **packet_content_data,
+	size_t *packet_content_size) {
+	// Calculate packet size
+	*packet_content_size = sizeof(packet_content->group_start_index) +
+						   sizeof(packet_content->group_size) +
+						   sizeof(packet_content->parity_count) +
+						   sizeof(packet_content->parity_index) +
+						   sizeof(packet_content->length_parity) +
+						   packet_content->data_size;
+
+	// Allocate space
+	*packet_content_data = malloc(*packet_content_size);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	uint8_t *packet_content_data_pointer = *packet_content_data;
+
+	// Serialize
+	uint32_t group_start_index_net = htonl(packet_content->group_start_index);
+	memcpy(packet_content_data_pointer, &group_start_index_net,
+		   sizeof(group_start_index_net));
+	packet_content_data_pointer += sizeof(group_start_index_net);
+
+	uint16_t group_size_net = htons(packet_content->group_size);
+	memcpy(packet_content_data_pointer, &group_size_net,
+		   sizeof(group_size_net));
+	packet_content_data_pointer += sizeof(group_size_net);
+
+	*packet_content_data_pointer++ = packet_content->parity_count;
+	*packet_content_data_pointer++ = packet_content->parity_index;
+
+	uint16_t length_parity_net = htons(packet_content->length_parity);
+	memcpy(packet_content_data_pointer, &length_parity_net,
+		   sizeof(length_parity_net));
+	packet_content_data_pointer += sizeof(length_parity_net);
+
+	memcpy(packet_content_data_pointer, packet_content->data,
+		   packet_content->data_size);
+}
+
+void serialize_range_digests_packet_content(
+	range_digests_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size) {
+	// Calculate packet size
+	*packet_content_size = sizeof(packet_content->repair_round) +
+						   sizeof(packet_content->first_range_index) +
+						   sizeof(packet_content->range_count) +
+						   packet_content->range_count * HASH_SIZE;
+
+	// Allocate space
+	*packet_content_data = malloc(*packet_content_size);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	uint8_t *packet_content_data_pointer = *packet_content_data;
+
+	// Serialize
+	*packet_content_data_pointer++ = packet_content->repair_round;
+
+	uint32_t first_range_index_net = htonl(packet_content->first_range_index);
+	memcpy(packet_content_data_pointer, &first_range_index_net,
+		   sizeof(first_range_index_net));
+	packet_content_data_pointer += sizeof(first_range_index_net);
+
+	uint16_t range_count_net = htons(packet_content->range_count);
+	memcpy(packet_content_data_pointer, &range_count_net,
+		   sizeof(range_count_net));
+	packet_content_data_pointer += sizeof(range_count_net);
+
+	memcpy(packet_content_data_pointer, packet_content->digests,
+		   packet_content->range_count * HASH_SIZE);
+}
+
+void serialize_signature_request_packet_content(
+	signature_request_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size) {
+	// Calculate packet size
+	*packet_content_size = sizeof(packet_content->first_block_index) +
+						   sizeof(packet_content->block_size) +
+						   strlen(packet_content->file_name) + 1;
+
+	// Allocate space
+	*packet_content_data = malloc(*packet_content_size);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	uint8_t *packet_content_data_pointer = *packet_content_data;
+
+	// Serialize
+	uint32_t first_block_index_net = htonl(packet_content->first_block_index);
+	memcpy(packet_content_data_pointer, &first_block_index_net,
+		   sizeof(first_block_index_net));
+	packet_content_data_pointer += sizeof(first_block_index_net);
+
+	uint16_t block_size_net = htons(packet_content->block_size);
+	memcpy(packet_content_data_pointer, &block_size_net,
+		   sizeof(block_size_net));
+	packet_content_data_pointer += sizeof(block_size_net);
+
+	memcpy(packet_content_data_pointer, packet_content->file_name,
+		   strlen(packet_content->file_name) + 1);
+}
+
+void serialize_chunk_query_packet_content(
+	chunk_query_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size) {
+	// Calculate packet size
+	*packet_content_size = sizeof(packet_content->first_chunk_index) +
+						   sizeof(packet_content->chunk_count) +
+						   packet_content->chunk_count * HASH_SIZE;
+
+	// Allocate space
+	*packet_content_data = malloc(*packet_content_size);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	uint8_t *packet_content_data_pointer = *packet_content_data;
+
+	// Serialize
+	uint32_t first_chunk_index_net = htonl(packet_content->first_chunk_index);
+	memcpy(packet_content_data_pointer, &first_chunk_index_net,
+		   sizeof(first_chunk_index_net));
+	packet_content_data_pointer += sizeof(first_chunk_index_net);
+
+	*packet_content_data_pointer++ = packet_content->chunk_count;
+
+	memcpy(packet_content_data_pointer, packet_content->hashes,
+		   packet_content->chunk_count * HASH_SIZE);
+}
+
+void serialize_path_mtu_probe_packet_content(
+	path_mtu_probe_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size) {
+	*packet_content_size = packet_content->padding_size;
+
+	// Allocate space, the padding is all zeros
+	*packet_content_data = calloc(*packet_content_size, 1);
+	if (*packet_content_data == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+}
+
 void serialize_packet(packet_t *packet, uint8_t **packet_data,
 					  size_t *packet_size) {
 	// Serialize content
@@ -105,6 +298,36 @@ void serialize_packet(packet_t *packet, uint8_t **packet_data,
 			(transmission_end_packet_content_t *)packet->content,
 			&packet_content_data, &packet_content_size);
 		break;
+	case MANIFEST_PACKET_TYPE:
+		serialize_manifest_packet_content(
+			(manifest_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
+	case FEC_PARITY_PACKET_TYPE:
+		serialize_fec_parity_packet_content(
+			(fec_parity_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
+	case RANGE_DIGESTS_PACKET_TYPE:
+		serialize_range_digests_packet_content(
+			(range_digests_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
+	case SIGNATURE_REQUEST_PACKET_TYPE:
+		serialize_signature_request_packet_content(
+			(signature_request_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
+	case CHUNK_QUERY_PACKET_TYPE:
+		serialize_chunk_query_packet_content(
+			(chunk_query_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
+	case PATH_MTU_PROBE_PACKET_TYPE:
+		serialize_path_mtu_probe_packet_content(
+			(path_mtu_probe_packet_content_t *)packet->content,
+			&packet_content_data, &packet_content_size);
+		break;
 	default:
 		fprintf(stderr, "Packet of unknown type!");
 		exit(NON_RECOVERABLE_ERROR_CODE);
@@ -134,68 +357,218 @@ void serialize_packet(packet_t *packet, uint8_t **packet_data,
 	memcpy(packet_data_pointer, packet_content_data, packet_content_size);
 	packet_data_pointer += packet_content_size;
 
-	uint32_t crc = crc32(0L, Z_NULL, 0);
-	crc = crc32(crc, (const Bytef *)*packet_data, *packet_size - CRC_SIZE);
+	uint32_t crc = calculate_crc32(*packet_data, *packet_size - CRC_SIZE);
 	uint32_t crc_net = htonl(crc);
 	memcpy(packet_data_pointer, &crc_net, CRC_SIZE);
 
 	free(packet_content_data);
 }
 
-transmission_end_response_packet_content_t *
-parse_transmission_end_packet_response_content(uint8_t *buffer,
-											   size_t buffer_size) {
-	transmission_end_response_packet_content_t *packet_content =
-		malloc(sizeof(transmission_end_response_packet_content_t));
-	if (packet_content == NULL) {
-		fprintf(stderr, "Failed to allocate space for packet content!");
-		exit(NON_RECOVERABLE_ERROR_CODE);
+void serialize_transmission_data_packet_frame(
+	uint8_t packet_type, uint32_t transmission_id, uint32_t index,
+	const uint8_t *data, size_t data_size,
+	uint8_t header[DATA_PACKET_HEADER_SIZE], uint8_t trailer[CRC_SIZE]) {
+	// Serialize header
+	header[0] = packet_type;
+	uint32_t transmission_id_net = htonl(transmission_id);
+	memcpy(header + 1, &transmission_id_net, sizeof(transmission_id_net));
+	uint32_t index_net = htonl(index);
+	memcpy(header + 5, &index_net, sizeof(index_net));
+
+	// The CRC covers the header followed by the data which stays in place
+	uint32_t crc = calculate_crc32(header, DATA_PACKET_HEADER_SIZE);
+	crc = update_crc32(crc, data, data_size);
+	uint32_t crc_net = htonl(crc);
+	memcpy(trailer, &crc_net, CRC_SIZE);
+}
+
+bool parse_transmission_end_packet_response_content(
+	const uint8_t *buffer, size_t buffer_size,
+	transmission_end_response_packet_content_t *packet_content) {
+	if (buffer_size < 1) {
+		return false;
 	}
 	packet_content->status = buffer[0];
-	return packet_content;
+	return true;
 }
 
-acknowledgement_packet_content_t *
-parse_acknowledgement_packet_content(uint8_t *buffer, size_t buffer_size) {
-	acknowledgement_packet_content_t *packet_content =
-		malloc(sizeof(acknowledgement_packet_content_t));
-	if (packet_content == NULL) {
-		fprintf(stderr, "Failed to allocate space for packet content!");
-		exit(NON_RECOVERABLE_ERROR_CODE);
+bool parse_acknowledgement_packet_content(
+	const uint8_t *buffer, size_t buffer_size,
+	acknowledgement_packet_content_t *packet_content) {
+	if (buffer_size < 2) {
+		return false;
 	}
 
 	packet_content->packet_type = buffer[0];
 	packet_content->status = buffer[1];
-	if (packet_content->packet_type == TRANSMISSION_DATA_PACKET_TYPE) {
+	packet_content->index = 0;
+	if (packet_content->packet_type == TRANSMISSION_DATA_PACKET_TYPE ||
+		packet_content->packet_type == PATH_MTU_PROBE_PACKET_TYPE) {
+		if (buffer_size < 2 + sizeof(packet_content->index)) {
+			return false;
+		}
 		memcpy(&packet_content->index, buffer + 2,
 			   sizeof(packet_content->index));
 		packet_content->index = ntohl(packet_content->index);
-	} else {
-		memset(&packet_content->index, 0, sizeof(packet_content->index));
 	}
 
-	return packet_content;
+	return true;
+}
+
+bool parse_selective_acknowledgement_packet_content(
+	const uint8_t *buffer, size_t buffer_size,
+	selective_acknowledgement_packet_content_t *packet_content) {
+	// Cumulative index, bitmap start & size
+	if (buffer_size < 10) {
+		return false;
+	}
+
+	memcpy(&packet_content->cumulative_index, buffer,
+		   sizeof(packet_content->cumulative_index));
+	packet_content->cumulative_index = ntohl(packet_content->cumulative_index);
+	memcpy(&packet_content->bitmap_start_index, buffer + 4,
+		   sizeof(packet_content->bitmap_start_index));
+	packet_content->bitmap_start_index =
+		ntohl(packet_content->bitmap_start_index);
+	memcpy(&packet_content->bitmap_size, buffer + 8,
+		   sizeof(packet_content->bitmap_size));
+	packet_content->bitmap_size = ntohs(packet_content->bitmap_size);
+
+	// Never trust the advertised size beyond what we have received
+	if (packet_content->bitmap_size > MAX_SACK_BITMAP_SIZE) {
+		packet_content->bitmap_size = MAX_SACK_BITMAP_SIZE;
+	}
+	if (packet_content->bitmap_size > buffer_size - 10) {
+		packet_content->bitmap_size = buffer_size - 10;
+	}
+	packet_content->bitmap = buffer + 10;
+
+	return true;
+}
+
+bool parse_repair_request_packet_content(
+	const uint8_t *buffer, size_t buffer_size,
+	repair_request_packet_content_t *packet_content) {
+	// Repair round, first range index & range count
+	if (buffer_size < 7) {
+		return false;
+	}
+
+	packet_content->repair_round = buffer[0];
+	memcpy(&packet_content->first_range_index, buffer + 1,
+		   sizeof(packet_content->first_range_index));
+	packet_content->first_range_index =
+		ntohl(packet_content->first_range_index);
+	memcpy(&packet_content->range_count, buffer + 5,
+		   sizeof(packet_content->range_count));
+	packet_content->range_count = ntohs(packet_content->range_count);
+
+	// Never trust the advertised count beyond what we have received
+	if (packet_content->range_count > RANGE_DIGESTS_PER_PACKET) {
+		packet_content->range_count = RANGE_DIGESTS_PER_PACKET;
+	}
+	size_t bitmap_size = (packet_content->range_count + 7) / 8;
+	if (bitmap_size > buffer_size - 7) {
+		bitmap_size = buffer_size - 7;
+		packet_content->range_count = bitmap_size * 8;
+	}
+	packet_content->bitmap = buffer + 7;
+
+	return true;
+}
+
+bool parse_block_signatures_packet_content(
+	const uint8_t *buffer, size_t buffer_size,
+	block_signatures_packet_content_t *packet_content) {
+	// File size, first block index & block count
+	if (buffer_size < 9) {
+		return false;
+	}
+
+	memcpy(&packet_content->file_size, buffer,
+		   sizeof(packet_content->file_size));
+	packet_content->file_size = ntohl(packet_content->file_size);
+	memcpy(&packet_content->first_block_index, buffer + 4,
+		   sizeof(packet_content->first_block_index));
+	packet_content->first_block_index =
+		ntohl(packet_content->first_block_index);
+	packet_content->block_count = buffer[8];
+
+	// The signatures are copied out by the caller, so they all have to be here
+	if (packet_content->block_count > SIGNATURES_PER_PACKET ||
+		(size_t)packet_content->block_count * BLOCK_SIGNATURE_SIZE >
+			buffer_size - 9) {
+		return false;
+	}
+	packet_content->signatures = buffer + 9;
+
+	return true;
 }
 
-packet_t parse_packet(uint8_t *buffer, size_t buffer_size) {
-	// Ignore CRC
+bool parse_missing_chunks_packet_content(
+	const uint8_t *buffer, size_t buffer_size,
+	missing_chunks_packet_content_t *packet_content) {
+	// First chunk index & chunk count
+	if (buffer_size < 5) {
+		return false;
+	}
+
+	memcpy(&packet_content->first_chunk_index, buffer,
+		   sizeof(packet_content->first_chunk_index));
+	packet_content->first_chunk_index =
+		ntohl(packet_content->first_chunk_index);
+	packet_content->chunk_count = buffer[4];
+
+	// A chunk without its bit would be taken for a stored one
+	if (packet_content->chunk_count > CHUNK_HASHES_PER_PACKET ||
+		(size_t)(packet_content->chunk_count + 7) / 8 > buffer_size - 5) {
+		return false;
+	}
+	packet_content->bitmap = buffer + 5;
+
+	return true;
+}
+
+bool parse_packet(const uint8_t *buffer, size_t buffer_size,
+				  packet_view_t *packet) {
+	if (buffer_size < 5 + CRC_SIZE) {
+		return false;
+	}
+
+	// The CRC is checked once here, the content is parsed in place after it
+	uint32_t received_crc;
+	memcpy(&received_crc, buffer + buffer_size - CRC_SIZE, CRC_SIZE);
 	buffer_size -= CRC_SIZE;
+	if (ntohl(received_crc) != calculate_crc32(buffer, buffer_size)) {
+		return false;
+	}
 
-	packet_t packet;
-	packet.packet_type = buffer[0];
-	memcpy(&packet.transmission_id, buffer + 1, sizeof(packet.transmission_id));
-	packet.transmission_id = ntohl(packet.transmission_id);
+	packet->packet_type = buffer[0];
+	memcpy(&packet->transmission_id, buffer + 1,
+		   sizeof(packet->transmission_id));
+	packet->transmission_id = ntohl(packet->transmission_id);
 
-	switch (packet.packet_type) {
+	switch (packet->packet_type) {
 	case TRANSMISSION_END_RESPONSE_PACKET_TYPE:
-		packet.content = parse_transmission_end_packet_response_content(
-			buffer + 5, buffer_size - 5);
-		break;
+		return parse_transmission_end_packet_response_content(
+			buffer + 5, buffer_size - 5, &packet->content.end_response);
 	case ACKNOWLEDGEMENT_PACKET_TYPE:
-		packet.content =
-			parse_acknowledgement_packet_content(buffer + 5, buffer_size - 5);
-		break;
+		return parse_acknowledgement_packet_content(
+			buffer + 5, buffer_size - 5, &packet->content.acknowledgement);
+	case SELECTIVE_ACKNOWLEDGEMENT_PACKET_TYPE:
+		return parse_selective_acknowledgement_packet_content(
+			buffer + 5, buffer_size - 5,
+			&packet->content.selective_acknowledgement);
+	case REPAIR_REQUEST_PACKET_TYPE:
+		return parse_repair_request_packet_content(
+			buffer + 5, buffer_size - 5, &packet->content.repair_request);
+	case BLOCK_SIGNATURES_PACKET_TYPE:
+		return parse_block_signatures_packet_content(
+			buffer + 5, buffer_size - 5, &packet->content.block_signatures);
+	case MISSING_CHUNKS_PACKET_TYPE:
+		return parse_missing_chunks_packet_content(
+			buffer + 5, buffer_size - 5, &packet->content.missing_chunks);
 	}
 
-	return packet;
+	return false;
 }
@@ -15,16 +15,58 @@
 #define TRANSMISSION_END_PACKET_TYPE 0x2
 #define TRANSMISSION_END_RESPONSE_PACKET_TYPE 0x3
 #define ACKNOWLEDGEMENT_PACKET_TYPE 0x4
+#define SELECTIVE_ACKNOWLEDGEMENT_PACKET_TYPE 0x5
+#define PATH_MTU_PROBE_PACKET_TYPE 0x6
+#define FEC_PARITY_PACKET_TYPE 0x7
+#define RANGE_DIGESTS_PACKET_TYPE 0x8
+#define REPAIR_REQUEST_PACKET_TYPE 0x9
+#define MANIFEST_PACKET_TYPE 0xA
+// Data packet whose data starts with the compression method
+#define COMPRESSED_DATA_PACKET_TYPE 0xB
+#define SIGNATURE_REQUEST_PACKET_TYPE 0xC
+#define BLOCK_SIGNATURES_PACKET_TYPE 0xD
+#define CHUNK_QUERY_PACKET_TYPE 0xE
+#define MISSING_CHUNKS_PACKET_TYPE 0xF
 #define CRC_SIZE 4
+// Packet type, transmission ID and data packet index
+#define DATA_PACKET_HEADER_SIZE 9
 #define HASH_SIZE 32
-
-typedef enum { NONE, POSITIVE, NEGATIVE } Acknowledgement;
+#define MAX_SACK_BITMAP_SIZE 512
+// Range digests sent in one packet, 960 bytes of digests
+#define RANGE_DIGESTS_PER_PACKET 30
+#define MAX_REPAIR_BITMAP_SIZE ((RANGE_DIGESTS_PER_PACKET + 7) / 8)
+// Chunk hashes sent in one chunk query, 960 bytes of hashes
+#define CHUNK_HASHES_PER_PACKET 30
+// Transmission start flags
+#define TREE_HASH_FLAG 0x1
+#define STRIPE_FLAG 0x2
+#define DELTA_FLAG 0x4
+#define DEDUP_FLAG 0x8
+// The receiver writes the file to disk as it arrives, the end packet carries a
+// 64-bit file size
+#define LARGE_FILE_FLAG 0x10
+// The length of the file is unknown until its end packet, always sent with
+// LARGE_FILE_FLAG
+#define STREAM_FLAG 0x20
 
 typedef struct {
 	uint8_t *packet_data;
 	size_t packet_data_size;
+	// Data packets are sent from their payload which lives in the memory
+	// mapped file or in a retransmission slot, packet_data is NULL for them
+	uint8_t header[DATA_PACKET_HEADER_SIZE];
+	const uint8_t *payload;
+	size_t payload_size;
+	uint8_t trailer[CRC_SIZE];
+	uint32_t index; // Of data packets
 	uint64_t time_stamp;
-	Acknowledgement acknowledgement;
+	// Delivery rate sampling state when the packet was (re)sent
+	uint64_t delivered;
+	uint64_t delivered_time;
+	uint64_t first_sent_time;
+	uint32_t retransmission_count;
+	uint64_t resend_deadline;
+	size_t timer_position;
 } sent_packet_t;
 
 typedef struct packet_t {
@@ -35,6 +77,9 @@ typedef struct packet_t {
 
 typedef struct transmission_start_packet_content_t {
 	uint32_t transmission_length;
+	uint16_t chunk_size; // Data size of every data packet but the last one
+	uint8_t flags;
+	uint32_t stripe_length; // Only sent with STRIPE_FLAG
 	const char *file_name;
 } transmission_start_packet_content_t;
 
@@ -45,10 +90,15 @@ typedef struct transmission_data_packet_content_t {
 } transmission_data_packet_content_t;
 
 typedef struct transmission_end_packet_content_t {
-	uint32_t file_size;
+	uint64_t file_size;
+	bool large_file; // The file size is sent in 64 bits, with LARGE_FILE_FLAG
 	uint8_t hash[HASH_SIZE];
 } transmission_end_packet_content_t;
 
+typedef struct manifest_packet_content_t {
+	uint32_t file_count;
+} manifest_packet_content_t;
+
 typedef struct transmission_end_response_packet_content_t {
 	bool status;
 } transmission_end_response_packet_content_t;
@@ -56,10 +106,86 @@ typedef struct transmission_end_response_packet_content_t {
 typedef struct acknowledgement_packet_content_t {
 	uint8_t packet_type;
 	bool status;
-	uint32_t
-		index; // Only present if packet_type is TRANSMISSION_DATA_PACKET_TYPE
+	// Only present if packet_type is TRANSMISSION_DATA_PACKET_TYPE or
+	// PATH_MTU_PROBE_PACKET_TYPE (the size of the received probe)
+	uint32_t index;
 } acknowledgement_packet_content_t;
 
+typedef struct fec_parity_packet_content_t {
+	uint32_t group_start_index;
+	uint16_t group_size;
+	uint8_t parity_count;
+	uint8_t parity_index;
+	uint16_t length_parity; // XOR of the data sizes of the covered packets
+	const uint8_t *data;
+	size_t data_size;
+} fec_parity_packet_content_t;
+
+typedef struct range_digests_packet_content_t {
+	uint8_t repair_round;
+	uint32_t first_range_index;
+	uint16_t range_count;
+	const uint8_t (*digests)[HASH_SIZE];
+} range_digests_packet_content_t;
+
+typedef struct repair_request_packet_content_t {
+	uint8_t repair_round;
+	uint32_t first_range_index;
+	uint16_t range_count;
+	const uint8_t *bitmap; // Set for the ranges which differ
+} repair_request_packet_content_t;
+
+typedef struct signature_request_packet_content_t {
+	uint32_t first_block_index;
+	uint16_t block_size;
+	const char *file_name;
+} signature_request_packet_content_t;
+
+typedef struct block_signatures_packet_content_t {
+	uint32_t file_size; // Of the receiver's copy, 0 if it has none
+	uint32_t first_block_index;
+	uint8_t block_count;
+	const uint8_t *signatures; // BLOCK_SIGNATURE_SIZE bytes each
+} block_signatures_packet_content_t;
+
+typedef struct chunk_query_packet_content_t {
+	uint32_t first_chunk_index;
+	uint8_t chunk_count;
+	const uint8_t (*hashes)[HASH_SIZE];
+} chunk_query_packet_content_t;
+
+typedef struct missing_chunks_packet_content_t {
+	uint32_t first_chunk_index;
+	uint8_t chunk_count;
+	const uint8_t *bitmap; // Set for the chunks not in the chunk store
+} missing_chunks_packet_content_t;
+
+typedef struct path_mtu_probe_packet_content_t {
+	size_t padding_size;
+} path_mtu_probe_packet_content_t;
+
+typedef struct selective_acknowledgement_packet_content_t {
+	uint32_t cumulative_index; // All data packets below it were received
+	uint32_t bitmap_start_index;
+	uint16_t bitmap_size;
+	const uint8_t *bitmap;
+} selective_acknowledgement_packet_content_t;
+
+// A received packet whose CRC has been checked. It is parsed in place, so the
+// bitmaps point into the receive buffer which has to outlive the view.
+typedef struct packet_view_t {
+	uint8_t packet_type;
+	uint32_t transmission_id;
+	union {
+		transmission_end_response_packet_content_t end_response;
+		acknowledgement_packet_content_t acknowledgement;
+		selective_acknowledgement_packet_content_t selective_acknowledgement;
+		repair_request_packet_content_t repair_request;
+		block_signatures_packet_content_t block_signatures;
+		missing_chunks_packet_content_t missing_chunks;
+	} content;
+} packet_view_t;
+
 void serialize_transmission_data_packet_content(
 	transmission_data_packet_content_t *packet_content,
 	uint8_t **packet_content_data, size_t *packet_content_size);
@@ -72,9 +198,41 @@ void serialize_transmission_end_packet_content(
 	transmission_end_packet_content_t *packet_content,
 	uint8_t **packet_content_data, size_t *packet_content_size);
 
+void serialize_manifest_packet_content(
+	manifest_packet_content_t *packet_content, uint8_t **packet_content_data,
+	size_t *packet_content_size);
+
+void serialize_fec_parity_packet_content(
+	fec_parity_packet_content_t *packet_content, uint8_t **packet_content_data,
+	size_t *packet_content_size);
+
+void serialize_range_digests_packet_content(
+	range_digests_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size);
+
+void serialize_signature_request_packet_content(
+	signature_request_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size);
+
+void serialize_chunk_query_packet_content(
+	chunk_query_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size);
+
+void serialize_path_mtu_probe_packet_content(
+	path_mtu_probe_packet_content_t *packet_content,
+	uint8_t **packet_content_data, size_t *packet_content_size);
+
 void serialize_packet(packet_t *packet, uint8_t **packet_data,
 					  size_t *packet_size);
 
-packet_t parse_packet(uint8_t *buffer, size_t buffer_size);
+void serialize_transmission_data_packet_frame(
+	uint8_t packet_type, uint32_t transmission_id, uint32_t index,
+	const uint8_t *data, size_t data_size,
+	uint8_t header[DATA_PACKET_HEADER_SIZE], uint8_t trailer[CRC_SIZE]);
+
+// Returns false for packets with a bad CRC, of a type the sender does not
+// receive or too short for their type
+bool parse_packet(const uint8_t *buffer, size_t buffer_size,
+				  packet_view_t *packet);
 
 #endif // PACKET_H
@@ -0,0 +1,79 @@
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./connection.h"
+#include "./packet.h"
+#include "./path_mtu.h"
+#include "./utils.h"
+
+bool wait_for_path_mtu_probe_acknowledgement(connection_t connection,
+											 size_t probe_size) {
+	uint64_t deadline =
+		get_time_in_microseconds() + PATH_MTU_PROBE_TIMEOUT * 1000;
+	while (get_time_in_microseconds() < deadline) {
+		if (!wait_for_packet(connection, deadline)) {
+			continue;
+		}
+
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t packet;
+		if (!receive_packet(connection, buffer, &packet)) {
+			continue;
+		}
+		if (packet.packet_type != ACKNOWLEDGEMENT_PACKET_TYPE) {
+			continue;
+		}
+
+		// Acknowledgements of earlier, smaller probes may still be arriving
+		acknowledgement_packet_content_t *content =
+			&packet.content.acknowledgement;
+		if (content->packet_type == PATH_MTU_PROBE_PACKET_TYPE &&
+			content->status && content->index == probe_size) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool probe_path_mtu(connection_t connection, size_t probe_size) {
+	for (size_t attempt = 0; attempt < PATH_MTU_PROBE_ATTEMPTS; ++attempt) {
+		if (!send_path_mtu_probe(connection, probe_size)) {
+			return false;
+		}
+		if (wait_for_path_mtu_probe_acknowledgement(connection, probe_size)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t probe_chunk_size(connection_t connection, size_t min_chunk_size,
+						size_t max_chunk_size) {
+	// Forbid fragmentation, so that probes larger than the path MTU get
+	// dropped instead of reassembled by the receiver
+	int previous_mode = set_path_mtu_discovery(connection, IP_PMTUDISC_DO);
+
+	// Binary search, trying the largest chunk size first as it usually fits
+	size_t overhead = DATA_PACKET_HEADER_SIZE + CRC_SIZE;
+	size_t largest_passed = min_chunk_size;
+	size_t smallest_failed = max_chunk_size + 1;
+	size_t chunk_size = max_chunk_size;
+	while (smallest_failed - largest_passed > PATH_MTU_PROBE_PRECISION) {
+		bool passed = probe_path_mtu(connection, chunk_size + overhead);
+		printf("Path MTU probe of %zu bytes %s.\n", chunk_size + overhead,
+			   passed ? "passed" : "failed");
+		if (passed) {
+			largest_passed = chunk_size;
+		} else {
+			smallest_failed = chunk_size;
+		}
+		chunk_size = largest_passed + (smallest_failed - largest_passed) / 2;
+	}
+
+	set_path_mtu_discovery(connection, previous_mode);
+	printf("Using chunks of %zu bytes.\n", largest_passed);
+	return largest_passed;
+}
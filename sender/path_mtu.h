@@ -0,0 +1,18 @@
+#ifndef PATH_MTU_H
+#define PATH_MTU_H
+
+#include <stddef.h>
+
+#include "./connection.h"
+
+#define PATH_MTU_PROBE_ATTEMPTS 3
+#define PATH_MTU_PROBE_TIMEOUT 100	// 100ms
+#define PATH_MTU_PROBE_PRECISION 16 // Bytes
+
+// Finds the largest chunk size in [min_chunk_size, max_chunk_size] whose data
+// packets reach the receiver without IP fragmentation. Chunks of
+// min_chunk_size are assumed to always get through.
+size_t probe_chunk_size(connection_t connection, size_t min_chunk_size,
+						size_t max_chunk_size);
+
+#endif // PATH_MTU_H
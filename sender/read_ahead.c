@@ -0,0 +1,214 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./read_ahead.h"
+#include "./utils.h"
+
+// Asks the kernel for the next chunks this many chunks before the reader
+// gets to them
+#define READ_AHEAD_ADVICE_CHUNK_COUNT 256
+
+read_ahead_t *create_read_ahead(int file_descriptor, bool sequential,
+								size_t chunk_size, size_t depth) {
+	read_ahead_t *read_ahead = malloc(sizeof(read_ahead_t));
+	if (read_ahead == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	read_ahead->file_descriptor = file_descriptor;
+	read_ahead->sequential = sequential;
+	read_ahead->chunk_size = chunk_size;
+	read_ahead->depth = depth;
+	read_ahead->buffers = malloc(depth * chunk_size);
+	read_ahead->sizes = malloc(depth * sizeof(size_t));
+	if (read_ahead->buffers == NULL || read_ahead->sizes == NULL) {
+		fprintf(stderr, "Failed to allocate space for the read ahead!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	atomic_init(&read_ahead->head, 0);
+	atomic_init(&read_ahead->tail, 0);
+	atomic_init(&read_ahead->stopping, false);
+	atomic_init(&read_ahead->reader_waiting, false);
+	atomic_init(&read_ahead->consumer_waiting, false);
+	if (pthread_mutex_init(&read_ahead->mutex, NULL) ||
+		pthread_cond_init(&read_ahead->condition, NULL)) {
+		fprintf(stderr, "Failed to create the read ahead condition!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	read_ahead->running = false;
+	read_ahead->end_reached = false;
+	return read_ahead;
+}
+
+// Wakes the other side if it sleeps, it sets its flag before checking the
+// ring once more under the mutex, so either it sees the change or we see it
+void wake_read_ahead_side(read_ahead_t *read_ahead, atomic_bool *waiting) {
+	if (atomic_load(waiting)) {
+		pthread_mutex_lock(&read_ahead->mutex);
+		pthread_cond_broadcast(&read_ahead->condition);
+		pthread_mutex_unlock(&read_ahead->mutex);
+	}
+}
+
+bool is_read_ahead_ring_full(read_ahead_t *read_ahead) {
+	return atomic_load(&read_ahead->head) - atomic_load(&read_ahead->tail) >=
+		   read_ahead->depth;
+}
+
+bool is_read_ahead_ring_empty(read_ahead_t *read_ahead) {
+	return atomic_load(&read_ahead->head) == atomic_load(&read_ahead->tail);
+}
+
+void *run_read_ahead(void *argument) {
+	read_ahead_t *read_ahead = argument;
+	off_t advised_offset = read_ahead->offset;
+
+	while (!atomic_load(&read_ahead->stopping)) {
+		if (is_read_ahead_ring_full(read_ahead)) {
+			pthread_mutex_lock(&read_ahead->mutex);
+			atomic_store(&read_ahead->reader_waiting, true);
+			while (is_read_ahead_ring_full(read_ahead) &&
+				   !atomic_load(&read_ahead->stopping)) {
+				pthread_cond_wait(&read_ahead->condition, &read_ahead->mutex);
+			}
+			atomic_store(&read_ahead->reader_waiting, false);
+			pthread_mutex_unlock(&read_ahead->mutex);
+			continue;
+		}
+
+		// Keep the page cache ahead of us, reads are sequential anyway
+		off_t advice_size =
+			(off_t)READ_AHEAD_ADVICE_CHUNK_COUNT * read_ahead->chunk_size;
+		if (!read_ahead->sequential &&
+			advised_offset < read_ahead->end_offset &&
+			advised_offset < read_ahead->offset + advice_size / 2) {
+			posix_fadvise(read_ahead->file_descriptor, advised_offset,
+						  advice_size, POSIX_FADV_WILLNEED);
+			advised_offset += advice_size;
+		}
+
+		size_t head = atomic_load(&read_ahead->head);
+		size_t slot = head % read_ahead->depth;
+		uint8_t *buffer = read_ahead->buffers + slot * read_ahead->chunk_size;
+		size_t chunk_size = read_ahead->chunk_size;
+		if (read_ahead->end_offset - read_ahead->offset < (off_t)chunk_size) {
+			chunk_size = read_ahead->end_offset - read_ahead->offset;
+		}
+		size_t read_size = 0;
+		while (read_size < chunk_size) {
+			ssize_t result =
+				read_ahead->sequential
+					? read(read_ahead->file_descriptor, buffer + read_size,
+						   chunk_size - read_size)
+					: pread(read_ahead->file_descriptor, buffer + read_size,
+							chunk_size - read_size,
+							read_ahead->offset + read_size);
+			if (result < 0) {
+				fprintf(stderr, "Failed to read file ahead!\n");
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			if (result == 0) {
+				break;
+			}
+			read_size += result;
+		}
+		read_ahead->offset += read_size;
+
+		if (read_ahead->md_context != NULL && read_size > 0 &&
+			!EVP_DigestUpdate(read_ahead->md_context, buffer, read_size)) {
+			fprintf(stderr, "Failed to update EVP digest!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+
+		// The chunk is complete before the consumer can see it
+		read_ahead->sizes[slot] = read_size;
+		atomic_store(&read_ahead->head, head + 1);
+		wake_read_ahead_side(read_ahead, &read_ahead->consumer_waiting);
+
+		// A short chunk is the last one
+		if (read_size < read_ahead->chunk_size) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+void start_read_ahead(read_ahead_t *read_ahead, off_t offset,
+					  off_t end_offset, EVP_MD_CTX *md_context) {
+	read_ahead->offset = offset;
+	read_ahead->end_offset = end_offset < offset ? offset : end_offset;
+	read_ahead->md_context = md_context;
+	read_ahead->end_reached = false;
+	atomic_store(&read_ahead->head, 0);
+	atomic_store(&read_ahead->tail, 0);
+	atomic_store(&read_ahead->stopping, false);
+	if (!read_ahead->sequential) {
+		posix_fadvise(read_ahead->file_descriptor, offset, end_offset - offset,
+					  POSIX_FADV_SEQUENTIAL);
+	}
+	if (pthread_create(&read_ahead->thread, NULL, run_read_ahead,
+					   read_ahead)) {
+		fprintf(stderr, "Failed to create read ahead thread!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	read_ahead->running = true;
+}
+
+void stop_read_ahead(read_ahead_t *read_ahead) {
+	if (!read_ahead->running) {
+		return;
+	}
+	atomic_store(&read_ahead->stopping, true);
+	pthread_mutex_lock(&read_ahead->mutex);
+	pthread_cond_broadcast(&read_ahead->condition);
+	pthread_mutex_unlock(&read_ahead->mutex);
+	if (pthread_join(read_ahead->thread, NULL)) {
+		fprintf(stderr, "Failed to join read ahead thread!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	read_ahead->running = false;
+	read_ahead->end_reached = false;
+}
+
+size_t read_ahead_chunk(read_ahead_t *read_ahead, uint8_t *data) {
+	if (read_ahead->end_reached) {
+		return 0;
+	}
+	if (is_read_ahead_ring_empty(read_ahead)) {
+		pthread_mutex_lock(&read_ahead->mutex);
+		atomic_store(&read_ahead->consumer_waiting, true);
+		while (is_read_ahead_ring_empty(read_ahead)) {
+			pthread_cond_wait(&read_ahead->condition, &read_ahead->mutex);
+		}
+		atomic_store(&read_ahead->consumer_waiting, false);
+		pthread_mutex_unlock(&read_ahead->mutex);
+	}
+
+	size_t tail = atomic_load(&read_ahead->tail);
+	size_t slot = tail % read_ahead->depth;
+	size_t size = read_ahead->sizes[slot];
+	memcpy(data, read_ahead->buffers + slot * read_ahead->chunk_size, size);
+	atomic_store(&read_ahead->tail, tail + 1);
+	wake_read_ahead_side(read_ahead, &read_ahead->reader_waiting);
+
+	if (size < read_ahead->chunk_size) {
+		read_ahead->end_reached = true;
+	}
+	return size;
+}
+
+void destroy_read_ahead(read_ahead_t *read_ahead) {
+	stop_read_ahead(read_ahead);
+	pthread_mutex_destroy(&read_ahead->mutex);
+	pthread_cond_destroy(&read_ahead->condition);
+	free(read_ahead->buffers);
+	free(read_ahead->sizes);
+	free(read_ahead);
+}
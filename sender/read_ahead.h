@@ -0,0 +1,63 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define DEFAULT_READ_AHEAD_DEPTH 128
+#define MAX_READ_AHEAD_DEPTH 4096
+
+// Reader thread which reads the file ahead of the send loop, so that a cold
+// disk read or hashing does not hold up the packets. It hands chunks over
+// through a single producer single consumer ring of depth chunk buffers, the
+// indices only ever grow and their difference is the number of ready chunks.
+typedef struct {
+	int file_descriptor;
+	// A pipe is read from where it is rather than at offset, it can be read
+	// only once
+	bool sequential;
+	size_t chunk_size;
+	size_t depth;
+	uint8_t *buffers; // depth chunk sized buffers
+	size_t *sizes;	  // Of the chunks in the buffers, short for the last one
+	atomic_size_t head; // Chunks read, only written by the reader thread
+	atomic_size_t tail; // Chunks consumed, only written by the send loop
+	atomic_bool stopping;
+	// The sides sleep on the condition only when the ring is full or empty
+	// and the other side wakes them only if it sees them waiting
+	atomic_bool reader_waiting;
+	atomic_bool consumer_waiting;
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	pthread_t thread;
+	bool running;
+	off_t offset;	  // Of the next chunk read
+	off_t end_offset; // Nothing from here on is read
+	// Hashes every chunk before handing it over unless NULL
+	EVP_MD_CTX *md_context;
+	bool end_reached; // A short chunk was consumed
+} read_ahead_t;
+
+read_ahead_t *create_read_ahead(int file_descriptor, bool sequential,
+								size_t chunk_size, size_t depth);
+
+// Starts reading at offset, the chunks are hashed into md_context unless it is
+// NULL
+void start_read_ahead(read_ahead_t *read_ahead, off_t offset,
+					  off_t end_offset, EVP_MD_CTX *md_context);
+
+// Stops the reader thread and drops the chunks it has read
+void stop_read_ahead(read_ahead_t *read_ahead);
+
+// Waits for the next chunk and copies it to data, returns its size which is 0
+// past the end
+size_t read_ahead_chunk(read_ahead_t *read_ahead, uint8_t *data);
+
+void destroy_read_ahead(read_ahead_t *read_ahead);
+
+#endif // READ_AHEAD_H
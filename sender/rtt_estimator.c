@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "./packet.h"
+#include "./rtt_estimator.h"
+
+rtt_estimator_t create_rtt_estimator() {
+	rtt_estimator_t estimator;
+	estimator.smoothed_rtt = 0;
+	estimator.rtt_variance = 0;
+	estimator.latest_rtt = 0;
+	estimator.min_rtt = UINT64_MAX;
+	estimator.resend_timeout = INITIAL_RESEND_TIMEOUT;
+	estimator.sample_count = 0;
+	return estimator;
+}
+
+void update_rtt_estimator(rtt_estimator_t *estimator, uint64_t rtt) {
+	estimator->latest_rtt = rtt;
+	if (rtt < estimator->min_rtt) {
+		estimator->min_rtt = rtt;
+	}
+
+	if (estimator->sample_count == 0) {
+		estimator->smoothed_rtt = rtt;
+		estimator->rtt_variance = rtt / 2;
+	} else {
+		uint64_t deviation = estimator->smoothed_rtt > rtt
+								 ? estimator->smoothed_rtt - rtt
+								 : rtt - estimator->smoothed_rtt;
+		// RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - R|
+		estimator->rtt_variance =
+			(3 * estimator->rtt_variance + deviation) / 4;
+		// SRTT = 7/8 * SRTT + 1/8 * R
+		estimator->smoothed_rtt = (7 * estimator->smoothed_rtt + rtt) / 8;
+	}
+	++estimator->sample_count;
+
+	uint64_t variance_term = 4 * estimator->rtt_variance;
+	if (variance_term < CLOCK_GRANULARITY) {
+		variance_term = CLOCK_GRANULARITY;
+	}
+	estimator->resend_timeout =
+		estimator->smoothed_rtt + variance_term + MAX_ACK_DELAY;
+	if (estimator->resend_timeout < MIN_RESEND_TIMEOUT) {
+		estimator->resend_timeout = MIN_RESEND_TIMEOUT;
+	}
+	if (estimator->resend_timeout > MAX_RESEND_TIMEOUT) {
+		estimator->resend_timeout = MAX_RESEND_TIMEOUT;
+	}
+}
+
+uint64_t get_resend_deadline(rtt_estimator_t *estimator,
+							 sent_packet_t *sent_packet) {
+	// Back off exponentially with every resend of the same packet
+	uint32_t exponent = sent_packet->retransmission_count;
+	if (exponent > MAX_BACKOFF_EXPONENT) {
+		exponent = MAX_BACKOFF_EXPONENT;
+	}
+	uint64_t timeout = estimator->resend_timeout << exponent;
+	if (timeout > MAX_RESEND_TIMEOUT) {
+		timeout = MAX_RESEND_TIMEOUT;
+	}
+	return sent_packet->time_stamp + timeout;
+}
+
+void print_rtt_estimator(rtt_estimator_t *estimator) {
+	printf("RTT: smoothed %.3f ms, variance %.3f ms, latest %.3f ms, min %.3f "
+		   "ms, resend timeout %.3f ms (%lu samples)\n",
+		   estimator->smoothed_rtt / 1000.0, estimator->rtt_variance / 1000.0,
+		   estimator->latest_rtt / 1000.0,
+		   estimator->sample_count ? estimator->min_rtt / 1000.0 : 0.0,
+		   estimator->resend_timeout / 1000.0,
+		   (unsigned long)estimator->sample_count);
+}
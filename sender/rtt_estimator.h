@@ -0,0 +1,35 @@
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <stdint.h>
+
+#include "./packet.h"
+
+// All times are in microseconds
+#define INITIAL_RESEND_TIMEOUT 100000 // 0.1s
+#define MIN_RESEND_TIMEOUT 2000		  // 2ms
+#define MAX_RESEND_TIMEOUT 2000000	  // 2s
+#define CLOCK_GRANULARITY 1000		  // 1ms
+#define MAX_ACK_DELAY 5000			  // How long the receiver may delay an ack
+#define MAX_BACKOFF_EXPONENT 6
+
+// Smoothed RTT estimation as described in RFC 6298
+typedef struct {
+	uint64_t smoothed_rtt;
+	uint64_t rtt_variance;
+	uint64_t latest_rtt;
+	uint64_t min_rtt;
+	uint64_t resend_timeout;
+	uint64_t sample_count;
+} rtt_estimator_t;
+
+rtt_estimator_t create_rtt_estimator();
+
+void update_rtt_estimator(rtt_estimator_t *estimator, uint64_t rtt);
+
+uint64_t get_resend_deadline(rtt_estimator_t *estimator,
+							 sent_packet_t *sent_packet);
+
+void print_rtt_estimator(rtt_estimator_t *estimator);
+
+#endif // RTT_ESTIMATOR_H
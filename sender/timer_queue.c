@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./packet.h"
+#include "./timer_queue.h"
+#include "./utils.h"
+
+timer_queue_t create_timer_queue(size_t capacity) {
+	timer_queue_t timer_queue;
+	timer_queue.count = 0;
+	timer_queue.capacity = capacity > 0 ? capacity : 1;
+	timer_queue.packets =
+		malloc(sizeof(sent_packet_t *) * timer_queue.capacity);
+	if (timer_queue.packets == NULL) {
+		fprintf(stderr, "Failed to allocate space for timer queue!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	return timer_queue;
+}
+
+void destroy_timer_queue(timer_queue_t *timer_queue) {
+	free(timer_queue->packets);
+}
+
+static void place_timer(timer_queue_t *timer_queue, size_t position,
+						sent_packet_t *sent_packet) {
+	timer_queue->packets[position] = sent_packet;
+	sent_packet->timer_position = position;
+}
+
+static void sift_up(timer_queue_t *timer_queue, size_t position) {
+	sent_packet_t *sent_packet = timer_queue->packets[position];
+	while (position > 0) {
+		size_t parent = (position - 1) / 2;
+		if (timer_queue->packets[parent]->resend_deadline <=
+			sent_packet->resend_deadline) {
+			break;
+		}
+		place_timer(timer_queue, position, timer_queue->packets[parent]);
+		position = parent;
+	}
+	place_timer(timer_queue, position, sent_packet);
+}
+
+static void sift_down(timer_queue_t *timer_queue, size_t position) {
+	sent_packet_t *sent_packet = timer_queue->packets[position];
+	while (true) {
+		size_t child = 2 * position + 1;
+		if (child >= timer_queue->count) {
+			break;
+		}
+		if (child + 1 < timer_queue->count &&
+			timer_queue->packets[child + 1]->resend_deadline <
+				timer_queue->packets[child]->resend_deadline) {
+			++child;
+		}
+		if (sent_packet->resend_deadline <=
+			timer_queue->packets[child]->resend_deadline) {
+			break;
+		}
+		place_timer(timer_queue, position, timer_queue->packets[child]);
+		position = child;
+	}
+	place_timer(timer_queue, position, sent_packet);
+}
+
+void schedule_timer(timer_queue_t *timer_queue, sent_packet_t *sent_packet,
+					uint64_t deadline) {
+	if (sent_packet->timer_position != TIMER_NOT_SCHEDULED) {
+		// Move an already scheduled timer
+		uint64_t previous_deadline = sent_packet->resend_deadline;
+		sent_packet->resend_deadline = deadline;
+		if (deadline < previous_deadline) {
+			sift_up(timer_queue, sent_packet->timer_position);
+		} else {
+			sift_down(timer_queue, sent_packet->timer_position);
+		}
+		return;
+	}
+
+	if (timer_queue->count == timer_queue->capacity) {
+		timer_queue->capacity *= 2;
+		timer_queue->packets =
+			realloc(timer_queue->packets,
+					sizeof(sent_packet_t *) * timer_queue->capacity);
+		if (timer_queue->packets == NULL) {
+			fprintf(stderr, "Failed to grow timer queue!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+
+	sent_packet->resend_deadline = deadline;
+	timer_queue->packets[timer_queue->count] = sent_packet;
+	sift_up(timer_queue, timer_queue->count++);
+}
+
+void cancel_timer(timer_queue_t *timer_queue, sent_packet_t *sent_packet) {
+	size_t position = sent_packet->timer_position;
+	if (position == TIMER_NOT_SCHEDULED) {
+		return;
+	}
+	sent_packet->timer_position = TIMER_NOT_SCHEDULED;
+
+	sent_packet_t *last = timer_queue->packets[--timer_queue->count];
+	if (last == sent_packet) {
+		return;
+	}
+	// Fill the hole with the last timer and restore the heap order
+	place_timer(timer_queue, position, last);
+	if (position > 0 && timer_queue->packets[(position - 1) / 2]
+								->resend_deadline > last->resend_deadline) {
+		sift_up(timer_queue, position);
+	} else {
+		sift_down(timer_queue, position);
+	}
+}
+
+sent_packet_t *get_next_timer(timer_queue_t *timer_queue) {
+	if (timer_queue->count == 0) {
+		return NULL;
+	}
+	return timer_queue->packets[0];
+}
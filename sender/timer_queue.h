@@ -0,0 +1,31 @@
+#ifndef TIMER_QUEUE_H
+#define TIMER_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./packet.h"
+
+#define TIMER_NOT_SCHEDULED SIZE_MAX
+
+// Binary min-heap of sent packets ordered by their resend deadline. Every
+// packet remembers its position in the heap, so that its timer can be moved or
+// cancelled in O(log n).
+typedef struct {
+	sent_packet_t **packets;
+	size_t count;
+	size_t capacity;
+} timer_queue_t;
+
+timer_queue_t create_timer_queue(size_t capacity);
+
+void destroy_timer_queue(timer_queue_t *timer_queue);
+
+void schedule_timer(timer_queue_t *timer_queue, sent_packet_t *sent_packet,
+					uint64_t deadline);
+
+void cancel_timer(timer_queue_t *timer_queue, sent_packet_t *sent_packet);
+
+sent_packet_t *get_next_timer(timer_queue_t *timer_queue);
+
+#endif // TIMER_QUEUE_H
@@ -5,108 +5,828 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "./congestion_controller.h"
 #include "./connection.h"
 #include "./main.h"
 #include "./packet.h"
+#include "./path_mtu.h"
+#include "./rtt_estimator.h"
+#include "./timer_queue.h"
 #include "./transmission.h"
 #include "./utils.h"
 
-size_t count_unacknowledged_packets(transmission_t *transmission) {
-	size_t unacknowledged_packet_count = 0;
+retransmission_slot_t *get_retransmission_slot(transmission_t *transmission,
+											   size_t index) {
+	return &transmission
+				->retransmission_ring[index % RETRANSMISSION_RING_SIZE];
+}
+
+bool is_packet_acknowledged(transmission_t *transmission, size_t index) {
+	if (index < transmission->cumulative_acknowledged_index) {
+		return true;
+	}
+	return get_retransmission_slot(transmission, index)->acknowledged;
+}
+
+bool acknowledge_packet(transmission_t *transmission, size_t index,
+						uint64_t now) {
+	if (index >= transmission->current_index ||
+		is_packet_acknowledged(transmission, index)) {
+		return false;
+	}
+
+	retransmission_slot_t *slot = get_retransmission_slot(transmission, index);
+	sent_packet_t *sent_packet = &slot->packet;
+	// Karn's algorithm - we cannot tell which copy of a resent packet got
+	// acknowledged, so only packets sent once are sampled
+	if (sent_packet->retransmission_count == 0 &&
+		now >= sent_packet->time_stamp) {
+		update_rtt_estimator(&transmission->rtt_estimator,
+							 now - sent_packet->time_stamp);
+	}
+	slot->acknowledged = true;
+	--transmission->unacknowledged_packet_count;
+	if (index >= transmission->highest_acknowledged_index) {
+		transmission->highest_acknowledged_index = index + 1;
+	}
+	congestion_controller_on_packet_acknowledged(
+		&transmission->congestion_controller, sent_packet, now);
+	cancel_timer(&transmission->timer_queue, sent_packet);
+
+	// Release the slots at the start of the ring
+	while (transmission->cumulative_acknowledged_index <
+			   transmission->current_index &&
+		   get_retransmission_slot(transmission,
+								   transmission->cumulative_acknowledged_index)
+			   ->acknowledged) {
+		++transmission->cumulative_acknowledged_index;
+	}
+	return true;
+}
+
+void resend_data_packet(transmission_t *transmission,
+						sent_packet_t *sent_packet, uint64_t now,
+						loss_cause_t cause) {
+	queue_packet(transmission->connection, &transmission->batch, sent_packet);
+	sent_packet->time_stamp = now;
+	++sent_packet->retransmission_count;
+	congestion_controller_on_packet_sent(
+		&transmission->congestion_controller, sent_packet,
+		transmission->unacknowledged_packet_count);
+	schedule_timer(
+		&transmission->timer_queue, sent_packet,
+		get_resend_deadline(&transmission->rtt_estimator, sent_packet));
+	congestion_controller_on_loss(&transmission->congestion_controller,
+								  sent_packet->index,
+								  transmission->current_index, cause);
+}
+
+void resend_lost_packets(transmission_t *transmission, uint64_t now) {
+	// Every packet is checked once, a fast resend which gets lost as well is
+	// left to its resend timeout
+	if (transmission->lost_index <
+		transmission->cumulative_acknowledged_index) {
+		transmission->lost_index = transmission->cumulative_acknowledged_index;
+	}
+	while (transmission->lost_index + FAST_RETRANSMIT_THRESHOLD <
+		   transmission->highest_acknowledged_index) {
+		if (!is_packet_acknowledged(transmission, transmission->lost_index)) {
+			resend_data_packet(
+				transmission,
+				&get_retransmission_slot(transmission,
+										 transmission->lost_index)
+					 ->packet,
+				now, FAST_RETRANSMIT_LOSS);
+		}
+		++transmission->lost_index;
+	}
+}
+
+void receive_selective_acknowledgement(
+	transmission_t *transmission,
+	selective_acknowledgement_packet_content_t *packet_content) {
+	uint64_t now = get_time_in_microseconds();
+	size_t acknowledged_count = 0;
+
+	// Everything below the cumulative index was received
+	size_t cumulative_index = packet_content->cumulative_index;
+	if (cumulative_index > transmission->current_index) {
+		cumulative_index = transmission->current_index;
+	}
+	for (size_t i = transmission->cumulative_acknowledged_index;
+		 i < cumulative_index; ++i) {
+		acknowledged_count += acknowledge_packet(transmission, i, now);
+	}
 
-	for (size_t i = 0; i < transmission->current_index; ++i) {
-		if (transmission->packets[i].acknowledgement == NONE) {
-			++unacknowledged_packet_count;
+	// And the bitmap tells us about the packets received out of order
+	for (size_t i = 0; i < (size_t)packet_content->bitmap_size * 8; ++i) {
+		if (packet_content->bitmap[i / 8] & (1 << (i % 8))) {
+			acknowledged_count += acknowledge_packet(
+				transmission, packet_content->bitmap_start_index + i, now);
 		}
 	}
 
-	return unacknowledged_packet_count;
+	congestion_controller_on_acknowledgement(
+		&transmission->congestion_controller, acknowledged_count, now,
+		&transmission->rtt_estimator);
 }
 
-bool receive_acknowledgement_packet(transmission_t *transmission) {
-	packet_t packet;
-	if (receive_packet(transmission->connection, &packet)) {
-		switch (packet.packet_type) {
-		case ACKNOWLEDGEMENT_PACKET_TYPE:;
-			acknowledgement_packet_content_t *packet_content =
-				(acknowledgement_packet_content_t *)packet.content;
-			if (packet_content->packet_type != TRANSMISSION_DATA_PACKET_TYPE) {
-				return false;
-			}
-			if (packet_content->status) {
-				transmission->packets[packet_content->index].acknowledgement =
-					POSITIVE;
-			} else if (packet_content->index < transmission->current_index) {
-				transmission->packets[packet_content->index].acknowledgement =
-					NEGATIVE;
-			}
-			return true;
-			break;
+uint64_t get_handshake_resend_timeout(uint64_t resend_timeout) {
+	resend_timeout *= 2;
+	if (resend_timeout > MAX_HANDSHAKE_RESEND_TIMEOUT) {
+		resend_timeout = MAX_HANDSHAKE_RESEND_TIMEOUT;
+	}
+	return resend_timeout;
+}
+
+bool receive_pending_end_packet(pending_end_t *pending_end,
+								packet_view_t *packet) {
+	if (pending_end == NULL ||
+		packet->transmission_id != pending_end->transmission_id) {
+		return false;
+	}
+
+	if (packet->packet_type == TRANSMISSION_END_RESPONSE_PACKET_TYPE &&
+		!pending_end->answered) {
+		pending_end->answered = true;
+		pending_end->success = packet->content.end_response.status;
+	} else if (packet->packet_type == ACKNOWLEDGEMENT_PACKET_TYPE) {
+		acknowledgement_packet_content_t *packet_content =
+			&packet->content.acknowledgement;
+		if (packet_content->packet_type == TRANSMISSION_END_PACKET_TYPE &&
+			packet_content->status) {
+			pending_end->acknowledged = true;
 		}
 	}
+	return true;
+}
 
-	return false;
+void resend_pending_end_packet(connection_t connection,
+							   pending_end_t *pending_end, uint64_t now) {
+	if (pending_end == NULL || pending_end->answered ||
+		now - pending_end->sent_time < pending_end->resend_timeout) {
+		return;
+	}
+	send_packet_data(connection, pending_end->packet.packet_data,
+					 pending_end->packet.packet_data_size);
+	pending_end->sent_time = now;
+	pending_end->resend_timeout =
+		get_handshake_resend_timeout(pending_end->resend_timeout);
 }
 
-bool transmission_loop(transmission_t *transmission, uint8_t *data_buffer) {
-	size_t unacknowledged_packets_count =
-		count_unacknowledged_packets(transmission);
-	bool end_of_file = feof(transmission->file);
+bool process_acknowledgement_packet(transmission_t *transmission,
+									packet_view_t *packet) {
+	if (receive_pending_end_packet(transmission->pending_end, packet)) {
+		return false;
+	}
 
-	if (end_of_file && unacknowledged_packets_count == 0) {
-		printf("All data successfully received by the receiver.\n");
+	switch (packet->packet_type) {
+	case SELECTIVE_ACKNOWLEDGEMENT_PACKET_TYPE:
+		if (packet->transmission_id != transmission->transmission_id) {
+			return false;
+		}
+		receive_selective_acknowledgement(
+			transmission, &packet->content.selective_acknowledgement);
+		return true;
+	case ACKNOWLEDGEMENT_PACKET_TYPE:;
+		acknowledgement_packet_content_t *packet_content =
+			&packet->content.acknowledgement;
+		if (packet_content->packet_type != TRANSMISSION_DATA_PACKET_TYPE) {
+			return false;
+		}
+		if (packet_content->status) {
+			uint64_t now = get_time_in_microseconds();
+			congestion_controller_on_acknowledgement(
+				&transmission->congestion_controller,
+				acknowledge_packet(transmission, packet_content->index, now),
+				now, &transmission->rtt_estimator);
+		} else if (packet_content->index < transmission->current_index &&
+				   !is_packet_acknowledged(transmission,
+										   packet_content->index)) {
+			// The packet got corrupted on the way - resend it right away
+			schedule_timer(
+				&transmission->timer_queue,
+				&get_retransmission_slot(transmission, packet_content->index)
+					 ->packet,
+				get_time_in_microseconds());
+		}
 		return true;
 	}
 
-	struct timeval now_struct;
-	gettimeofday(&now_struct, NULL);
-	uint64_t now = now_struct.tv_sec * 1000000 + now_struct.tv_usec;
+	return false;
+}
+
+size_t receive_acknowledgement_packets(transmission_t *transmission) {
+	packet_view_t packets[MAX_BATCH_SIZE];
+	size_t acknowledgement_count = 0;
 
-	for (size_t i = 0; i < transmission->current_index; ++i) {
-		sent_packet_t *sent_packet = &transmission->packets[i];
-		if (sent_packet->acknowledgement != POSITIVE &&
-			now - sent_packet->time_stamp > RESEND_TIMEOUT) {
-			// Resend packet
-			send_packet_data(transmission->connection, sent_packet->packet_data,
-							 sent_packet->packet_data_size);
-			sent_packet->time_stamp = now;
+	// Drain the socket, one recvmmsg call per batch
+	size_t received_count;
+	do {
+		size_t packet_count;
+		received_count =
+			receive_packet_batch(transmission->connection, &transmission->batch,
+								 packets, &packet_count);
+		for (size_t i = 0; i < packet_count; ++i) {
+			acknowledgement_count +=
+				process_acknowledgement_packet(transmission, &packets[i]);
 		}
+	} while (received_count == transmission->batch.size);
+
+	return acknowledgement_count;
+}
+
+bool is_end_of_file(transmission_t *transmission) {
+	if (transmission->current_index >= transmission->end_index) {
+		return true;
+	}
+	if (transmission->file_mapping != NULL) {
+		return transmission->file_offset >= transmission->file_size;
 	}
-	if (unacknowledged_packets_count > MAX_UNACKNOWLEDGED_PACKETS ||
-		end_of_file) {
-		if (!receive_acknowledgement_packet(transmission)) {
-			sleep_for_milliseconds(WAIT_TIME);
+	if (transmission->read_ahead != NULL) {
+		return transmission->read_ahead->end_reached;
+	}
+	return feof(transmission->file);
+}
+
+// Returns the size of the next chunk of the file read into data, 0 at its end
+size_t read_next_chunk(transmission_t *transmission, uint8_t *data) {
+	if (transmission->read_ahead == NULL) {
+		return fread(data, 1, transmission->chunk_size, transmission->file);
+	}
+	// The reader thread starts at the data packet to be sent next and hashes
+	// the file on the first pass in the send loop's stead
+	read_ahead_t *read_ahead = transmission->read_ahead;
+	if (!read_ahead->running) {
+		off_t end_offset =
+			(off_t)transmission->end_index * transmission->chunk_size;
+		if (!transmission->stream &&
+			end_offset > (off_t)transmission->file_size) {
+			end_offset = transmission->file_size;
 		}
-		return false;
+		bool hashing =
+			transmission->tree_hash == NULL && !transmission->hash_finished;
+		start_read_ahead(
+			read_ahead,
+			(off_t)transmission->current_index * transmission->chunk_size,
+			end_offset, hashing ? transmission->md_context : NULL);
 	}
-	// Send new packet
+	return read_ahead_chunk(read_ahead, data);
+}
+
+void release_parity_packets(transmission_t *transmission) {
+	for (size_t i = 0; i < transmission->parity_packet_count; ++i) {
+		free(transmission->parity_packets[i].packet_data);
+	}
+	transmission->parity_packet_count = 0;
+}
+
+void queue_parity_packets(transmission_t *transmission) {
+	if (transmission->parity_packet_count +
+			transmission->fec_encoder.parity_count >
+		transmission->parity_packet_capacity) {
+		flush_packet_batch(transmission->connection, &transmission->batch);
+		release_parity_packets(transmission);
+	}
+
+	sent_packet_t *parity_packets =
+		&transmission->parity_packets[transmission->parity_packet_count];
+	size_t parity_packet_count =
+		finish_fec_group(&transmission->fec_encoder,
+						 transmission->transmission_id, parity_packets);
+	for (size_t i = 0; i < parity_packet_count; ++i) {
+		queue_packet(transmission->connection, &transmission->batch,
+					 &parity_packets[i]);
+	}
+	transmission->parity_packet_count += parity_packet_count;
+}
+
+bool is_retransmission_ring_full(transmission_t *transmission) {
+	return transmission->current_index -
+			   transmission->cumulative_acknowledged_index >=
+		   RETRANSMISSION_RING_SIZE;
+}
+
+bool queue_next_data_packet(transmission_t *transmission) {
+	// The slot is free, its previous packet was acknowledged
+	retransmission_slot_t *slot =
+		get_retransmission_slot(transmission, transmission->current_index);
+	sent_packet_t *sent_packet = &slot->packet;
+	const uint8_t *data;
 	size_t data_size;
-	if ((data_size =
-			 fread(data_buffer, 1, MAX_DATA_SIZE, transmission->file)) <= 0) {
-		printf("All of the data transmitted.\n");
-		return false;
+
+	if (transmission->file_mapping != NULL) {
+		data = transmission->file_mapping + transmission->file_offset;
+		data_size = transmission->file_size - transmission->file_offset;
+		if (data_size > transmission->chunk_size) {
+			data_size = transmission->chunk_size;
+		}
+		transmission->file_offset += data_size;
+	} else {
+		if ((data_size = read_next_chunk(transmission, slot->data)) == 0) {
+			printf("All of the data transmitted.\n");
+			if (transmission->fec) {
+				queue_parity_packets(transmission);
+			}
+			return false;
+		}
+		data = slot->data;
+		if (transmission->stream) {
+			transmission->original_file_size += data_size;
+		}
+	}
+	// The compressed chunk has to save at least its compression method byte,
+	// otherwise it is sent raw
+	size_t compressed_size = 0;
+	if (transmission->compressor != NULL && data_size > 1) {
+		compressed_size = compress_chunk(
+			transmission->compressor, data, data_size,
+			slot->compressed_data + 1, data_size - 2);
 	}
+	if (compressed_size > 0) {
+		slot->compressed_data[0] = transmission->compressor->algorithm;
+		*sent_packet = prepare_transmission_data_packet(
+			COMPRESSED_DATA_PACKET_TYPE, transmission->transmission_id,
+			transmission->current_index, slot->compressed_data,
+			compressed_size + 1);
+	} else {
+		*sent_packet = prepare_transmission_data_packet(
+			TRANSMISSION_DATA_PACKET_TYPE, transmission->transmission_id,
+			transmission->current_index, data, data_size);
+	}
+	sent_packet->index = transmission->current_index;
+	slot->acknowledged = false;
 
-	transmission->packets[transmission->current_index] =
-		send_transmission_data_packet(
-			transmission->connection, transmission->transmission_id,
-			transmission->current_index, data_buffer, data_size);
-	if (!EVP_DigestUpdate(transmission->md_context, data_buffer, data_size)) {
+	congestion_controller_on_packet_sent(
+		&transmission->congestion_controller, sent_packet,
+		transmission->unacknowledged_packet_count);
+	queue_packet(transmission->connection, &transmission->batch, sent_packet);
+	schedule_timer(
+		&transmission->timer_queue, sent_packet,
+		get_resend_deadline(&transmission->rtt_estimator, sent_packet));
+	++transmission->unacknowledged_packet_count;
+	// The tree hash is computed by its workers in the meantime, the reader
+	// thread hashes what it reads and a repair resends data which has already
+	// been hashed
+	if (transmission->tree_hash == NULL && !transmission->hash_finished &&
+		transmission->read_ahead == NULL &&
+		!EVP_DigestUpdate(transmission->md_context, data, data_size)) {
 		fprintf(stderr, "Failed to update EVP digest!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
+	// Parity packets of a group are sent right after its last data packet,
+	// a repair resends ranges which do not line up with the groups
+	if (transmission->fec && transmission->repair_round == 0 &&
+		(add_fec_data_packet(&transmission->fec_encoder,
+							 transmission->current_index, data, data_size) ||
+		 is_end_of_file(transmission))) {
+		queue_parity_packets(transmission);
+	}
 
 	++transmission->current_index;
+	return true;
+}
+
+uint64_t get_next_deadline(transmission_t *transmission, uint64_t now) {
+	// Wake up now and then to check whether the receiver is still there
+	uint64_t deadline = now + MAX_WAIT_TIME;
+	sent_packet_t *sent_packet = get_next_timer(&transmission->timer_queue);
+	if (sent_packet != NULL && sent_packet->resend_deadline < deadline) {
+		deadline = sent_packet->resend_deadline;
+	}
+	pending_end_t *pending_end = transmission->pending_end;
+	if (pending_end != NULL && !pending_end->answered &&
+		pending_end->sent_time + pending_end->resend_timeout < deadline) {
+		deadline = pending_end->sent_time + pending_end->resend_timeout;
+	}
+	return deadline;
+}
+
+bool transmission_loop(transmission_t *transmission) {
+	// Process every acknowledgement that has arrived so far before deciding
+	// what to resend
+	bool received_acknowledgement =
+		receive_acknowledgement_packets(transmission) > 0;
+
+	bool end_of_file = is_end_of_file(transmission);
+
+	if (end_of_file && transmission->unacknowledged_packet_count == 0) {
+		printf("All data successfully received by the receiver.\n");
+		return true;
+	}
+
+	uint64_t now = get_time_in_microseconds();
+	uint64_t sent_packet_count = transmission->batch.sent_packet_count +
+								 transmission->batch.queued_count;
+
+	resend_pending_end_packet(transmission->connection,
+							  transmission->pending_end, now);
+
+	// The batch is shared with the receiving, so lost packets are queued only
+	// once the acknowledgements are processed
+	resend_lost_packets(transmission, now);
+
+	// Only the packets whose timers have fired are touched
+	sent_packet_t *sent_packet;
+	while ((sent_packet = get_next_timer(&transmission->timer_queue)) !=
+			   NULL &&
+		   sent_packet->resend_deadline <= now) {
+		// The resend timeout may have grown since the timer was set
+		uint64_t resend_deadline =
+			get_resend_deadline(&transmission->rtt_estimator, sent_packet);
+		if (resend_deadline > now) {
+			schedule_timer(&transmission->timer_queue, sent_packet,
+						   resend_deadline);
+			continue;
+		}
+
+		resend_data_packet(transmission, sent_packet, now,
+						   RESEND_TIMEOUT_LOSS);
+	}
+
+	// Fill the congestion window with new packets
+	size_t congestion_window =
+		get_congestion_window(&transmission->congestion_controller);
+	while (!is_end_of_file(transmission) &&
+		   !is_retransmission_ring_full(transmission) &&
+		   transmission->unacknowledged_packet_count < congestion_window) {
+		if (!queue_next_data_packet(transmission)) {
+			break;
+		}
+	}
+
+	flush_packet_batch(transmission->connection, &transmission->batch);
+	release_parity_packets(transmission);
+	bool sent_packets = transmission->batch.sent_packet_count != sent_packet_count;
+	bool finished = is_end_of_file(transmission) &&
+					transmission->unacknowledged_packet_count == 0;
+	if (!sent_packets && !received_acknowledgement && !finished) {
+		wait_for_packet(transmission->connection,
+						get_next_deadline(transmission, now));
+	}
 
 	return false;
 }
 
-transmission_t create_transmission(connection_t connection, char *file_path) {
+uint32_t create_transmission_id() {
+	// Path MTU probes are sent with 0
+	uint32_t transmission_id;
+	do {
+		transmission_id = get_random_number();
+	} while (transmission_id == 0);
+	return transmission_id;
+}
+
+bool receive_block_signatures_packet(
+	block_signatures_packet_content_t *packet_content,
+	block_signatures_t *signatures, bool *answered, size_t request_count) {
+	size_t request = packet_content->first_block_index / SIGNATURES_PER_PACKET;
+	if (packet_content->first_block_index % SIGNATURES_PER_PACKET != 0 ||
+		request >= request_count || answered[request] ||
+		packet_content->file_size != signatures->file_size) {
+		return false;
+	}
+	size_t block_count =
+		signatures->block_count - packet_content->first_block_index;
+	if (block_count > SIGNATURES_PER_PACKET) {
+		block_count = SIGNATURES_PER_PACKET;
+	}
+	if (packet_content->block_count != block_count) {
+		return false;
+	}
+
+	for (size_t i = 0; i < block_count; ++i) {
+		const uint8_t *signature =
+			packet_content->signatures + i * BLOCK_SIGNATURE_SIZE;
+		block_signature_t *block_signature =
+			&signatures->signatures[packet_content->first_block_index + i];
+		uint32_t weak_checksum;
+		memcpy(&weak_checksum, signature, sizeof(weak_checksum));
+		block_signature->weak_checksum = ntohl(weak_checksum);
+		block_signature->strong_checksum = 0;
+		for (size_t j = 0; j < STRONG_CHECKSUM_SIZE; ++j) {
+			block_signature->strong_checksum =
+				block_signature->strong_checksum << 8 | signature[4 + j];
+		}
+	}
+	answered[request] = true;
+	return true;
+}
+
+bool receive_block_signatures(connection_t connection,
+							  uint32_t transmission_id,
+							  pending_end_t *pending_end,
+							  const char *file_name, size_t block_size,
+							  uint64_t resend_timeout,
+							  block_signatures_t *signatures) {
+	// The first answer tells the size of the receiver's copy and so how many
+	// signature requests there are
+	size_t request_count = 1;
+	uint64_t *sent_times = calloc(1, sizeof(uint64_t));
+	bool *answered = calloc(1, sizeof(bool));
+	if (sent_times == NULL || answered == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	bool size_known = false;
+
+	size_t first_unanswered = 0;
+	size_t answered_count = 0;
+	uint64_t last_answer_time = get_time_in_microseconds();
+	bool success = true;
+	while (answered_count < request_count) {
+		if (timeout_elapsed(last_answer_time, TIMEOUT_SECONDS)) {
+			printf("The receiver has not answered the signature requests in "
+				   "too long.\n");
+			success = false;
+			break;
+		}
+
+		// Keep a window of signature requests in flight and resend the
+		// unanswered ones once their resend timeout elapses
+		while (answered[first_unanswered]) {
+			++first_unanswered;
+		}
+		uint64_t now = get_time_in_microseconds();
+		uint64_t deadline = last_answer_time + TIMEOUT_SECONDS * 1000000ULL;
+		for (size_t i = first_unanswered;
+			 i < request_count && i < first_unanswered + REPAIR_DIGEST_WINDOW;
+			 ++i) {
+			if (answered[i]) {
+				continue;
+			}
+			if (sent_times[i] != 0 && now < sent_times[i] + resend_timeout) {
+				if (sent_times[i] + resend_timeout < deadline) {
+					deadline = sent_times[i] + resend_timeout;
+				}
+				continue;
+			}
+			send_signature_request_packet(connection, transmission_id,
+										  i * SIGNATURES_PER_PACKET,
+										  block_size, file_name);
+			sent_times[i] = now;
+			if (now + resend_timeout < deadline) {
+				deadline = now + resend_timeout;
+			}
+		}
+
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t packet;
+		bool received_packet = false;
+		while (receive_packet(connection, buffer, &packet)) {
+			received_packet = true;
+			if (receive_pending_end_packet(pending_end, &packet) ||
+				packet.packet_type != BLOCK_SIGNATURES_PACKET_TYPE ||
+				packet.transmission_id != transmission_id) {
+				continue;
+			}
+			block_signatures_packet_content_t *packet_content =
+				&packet.content.block_signatures;
+			if (!size_known) {
+				create_block_signatures(signatures, packet_content->file_size,
+										block_size);
+				size_known = true;
+				if (signatures->block_count > SIGNATURES_PER_PACKET) {
+					request_count =
+						(signatures->block_count + SIGNATURES_PER_PACKET - 1) /
+						SIGNATURES_PER_PACKET;
+					sent_times = realloc(sent_times,
+										 request_count * sizeof(uint64_t));
+					answered = realloc(answered, request_count * sizeof(bool));
+					if (sent_times == NULL || answered == NULL) {
+						fprintf(stderr, "Malloc failed!\n");
+						exit(NON_RECOVERABLE_ERROR_CODE);
+					}
+					memset(sent_times + 1, 0,
+						   (request_count - 1) * sizeof(uint64_t));
+					memset(answered + 1, 0, (request_count - 1) * sizeof(bool));
+				}
+			}
+			if (receive_block_signatures_packet(packet_content, signatures,
+												answered, request_count)) {
+				++answered_count;
+				last_answer_time = get_time_in_microseconds();
+			}
+		}
+		if (!received_packet) {
+			wait_for_packet(connection, deadline);
+		}
+	}
+
+	free(sent_times);
+	free(answered);
+	if (!success && size_known) {
+		destroy_block_signatures(signatures);
+	}
+	return success;
+}
+
+bool prepare_delta(connection_t connection, char *file_path,
+				   uint32_t transmission_id, pending_end_t *pending_end,
+				   uint64_t resend_timeout, size_t block_size,
+				   delta_t *delta) {
+	printf("Requesting the signatures of the receiver's copy of %s.\n",
+		   file_path);
+	block_signatures_t signatures;
+	if (!receive_block_signatures(connection, transmission_id, pending_end,
+								  get_file_name(file_path), block_size,
+								  resend_timeout, &signatures)) {
+		printf("Sending the whole file instead of a delta.\n");
+		return false;
+	}
+	if (signatures.block_count == 0) {
+		printf("The receiver has no copy of the file, sending the whole "
+			   "file.\n");
+		destroy_block_signatures(&signatures);
+		return false;
+	}
+	index_block_signatures(&signatures);
+
+	FILE *file = fopen(file_path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	bool success =
+		create_delta(file, get_file_size(file_path), &signatures, delta);
+	fclose(file);
+	destroy_block_signatures(&signatures);
+	if (!success) {
+		printf("No block of the receiver's copy matches, sending the whole "
+			   "file.\n");
+		return false;
+	}
+	print_delta(delta);
+	return true;
+}
+
+bool receive_missing_chunks_packet(
+	missing_chunks_packet_content_t *packet_content, cdc_chunks_t *chunks,
+	bool *answered, size_t query_count) {
+	size_t query = packet_content->first_chunk_index / CHUNK_HASHES_PER_PACKET;
+	if (packet_content->first_chunk_index % CHUNK_HASHES_PER_PACKET != 0 ||
+		query >= query_count || answered[query]) {
+		return false;
+	}
+	size_t chunk_count =
+		chunks->unique_count - packet_content->first_chunk_index;
+	if (chunk_count > CHUNK_HASHES_PER_PACKET) {
+		chunk_count = CHUNK_HASHES_PER_PACKET;
+	}
+	if (packet_content->chunk_count != chunk_count) {
+		return false;
+	}
+
+	for (size_t i = 0; i < chunk_count; ++i) {
+		size_t chunk =
+			chunks->unique_chunks[packet_content->first_chunk_index + i];
+		chunks->chunks[chunk].missing =
+			(packet_content->bitmap[i / 8] >> (i % 8)) & 1;
+	}
+	answered[query] = true;
+	return true;
+}
+
+bool receive_missing_chunks(connection_t connection, uint32_t transmission_id,
+							pending_end_t *pending_end, uint64_t resend_timeout,
+							cdc_chunks_t *chunks) {
+	size_t query_count = (chunks->unique_count + CHUNK_HASHES_PER_PACKET - 1) /
+						 CHUNK_HASHES_PER_PACKET;
+	uint64_t *sent_times = calloc(query_count, sizeof(uint64_t));
+	bool *answered = calloc(query_count + 1, sizeof(bool));
+	if (sent_times == NULL || answered == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	size_t first_unanswered = 0;
+	size_t answered_count = 0;
+	uint64_t last_answer_time = get_time_in_microseconds();
+	bool success = true;
+	while (answered_count < query_count) {
+		if (timeout_elapsed(last_answer_time, TIMEOUT_SECONDS)) {
+			printf("The receiver has not answered the chunk queries in too "
+				   "long.\n");
+			success = false;
+			break;
+		}
+
+		// Keep a window of chunk queries in flight and resend the unanswered
+		// ones once their resend timeout elapses
+		while (answered[first_unanswered]) {
+			++first_unanswered;
+		}
+		uint64_t now = get_time_in_microseconds();
+		uint64_t deadline = last_answer_time + TIMEOUT_SECONDS * 1000000ULL;
+		for (size_t i = first_unanswered;
+			 i < query_count && i < first_unanswered + REPAIR_DIGEST_WINDOW;
+			 ++i) {
+			if (answered[i]) {
+				continue;
+			}
+			if (sent_times[i] != 0 && now < sent_times[i] + resend_timeout) {
+				if (sent_times[i] + resend_timeout < deadline) {
+					deadline = sent_times[i] + resend_timeout;
+				}
+				continue;
+			}
+			uint8_t hashes[CHUNK_HASHES_PER_PACKET][HASH_SIZE];
+			size_t first_chunk_index = i * CHUNK_HASHES_PER_PACKET;
+			size_t chunk_count = 0;
+			for (; chunk_count < CHUNK_HASHES_PER_PACKET &&
+				   first_chunk_index + chunk_count < chunks->unique_count;
+				 ++chunk_count) {
+				size_t chunk =
+					chunks->unique_chunks[first_chunk_index + chunk_count];
+				memcpy(hashes[chunk_count], chunks->chunks[chunk].hash,
+					   HASH_SIZE);
+			}
+			send_chunk_query_packet(connection, transmission_id,
+									first_chunk_index, chunk_count,
+									(const uint8_t(*)[HASH_SIZE])hashes);
+			sent_times[i] = now;
+			if (now + resend_timeout < deadline) {
+				deadline = now + resend_timeout;
+			}
+		}
+
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t packet;
+		bool received_packet = false;
+		while (receive_packet(connection, buffer, &packet)) {
+			received_packet = true;
+			if (receive_pending_end_packet(pending_end, &packet) ||
+				packet.packet_type != MISSING_CHUNKS_PACKET_TYPE ||
+				packet.transmission_id != transmission_id) {
+				continue;
+			}
+			if (receive_missing_chunks_packet(&packet.content.missing_chunks,
+											  chunks, answered, query_count)) {
+				++answered_count;
+				last_answer_time = get_time_in_microseconds();
+			}
+		}
+		if (!received_packet && answered_count < query_count) {
+			wait_for_packet(connection, deadline);
+		}
+	}
+
+	free(sent_times);
+	free(answered);
+	return success;
+}
+
+bool prepare_dedup(connection_t connection, char *file_path,
+				   uint32_t transmission_id, pending_end_t *pending_end,
+				   uint64_t resend_timeout, delta_t *delta) {
+	size_t file_size = get_file_size(file_path);
+	if (file_size == 0) {
+		return false;
+	}
+	FILE *file = fopen(file_path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	const uint8_t *data =
+		mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Failed to memory map file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	madvise((void *)data, file_size, MADV_SEQUENTIAL);
+
+	cdc_chunks_t chunks = split_into_cdc_chunks(data, file_size);
+	printf("Querying the receiver's chunk store for %zu chunks of %s.\n",
+		   chunks.unique_count, file_path);
+	bool success = receive_missing_chunks(connection, transmission_id,
+										  pending_end, resend_timeout, &chunks);
+	if (success) {
+		// Even a file of missing chunks is sent as chunks, so that the
+		// receiver stores them for the next one
+		create_dedup_delta(data, file_size, &chunks, delta);
+		print_delta(delta);
+	} else {
+		printf("Sending the whole file instead of its chunks.\n");
+	}
+
+	destroy_cdc_chunks(&chunks);
+	if (munmap((void *)data, file_size)) {
+		fprintf(stderr, "Failed to unmap file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	fclose(file);
+	return success;
+}
+
+transmission_t create_transmission(connection_t connection, char *file_path,
+								   uint32_t transmission_id, delta_t *delta,
+								   transmission_options_t options) {
 	// Prepare SHA-256
 	EVP_MD_CTX *md_context = EVP_MD_CTX_new();
 	if (!md_context) {
@@ -118,8 +838,11 @@ transmission_t create_transmission(connection_t connection, char *file_path) {
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
-	// Prepare file reading
-	FILE *file = fopen(file_path, "rb");
+	// Prepare file reading, a delta is read from its temporary file instead
+	bool stream = options.stream_name != NULL;
+	FILE *file = delta != NULL ? delta->file
+				 : stream	   ? stdin
+							   : fopen(file_path, "rb");
 	if (file == NULL) {
 		fprintf(stderr, "Failed to open file!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
@@ -127,62 +850,220 @@ transmission_t create_transmission(connection_t connection, char *file_path) {
 
 	transmission_t transmission;
 	transmission.current_index = 0;
+	transmission.hash_finished = false;
+	transmission.repair_round = 0;
+	transmission.cumulative_acknowledged_index = 0;
+	transmission.highest_acknowledged_index = 0;
+	transmission.lost_index = 0;
 	transmission.file = file;
-	transmission.file_name = (char *)get_file_name(file_path);
-	transmission.file_size = get_file_size(file_path);
-	transmission.length = transmission.file_size / MAX_DATA_SIZE + 1;
+	transmission.stream = stream;
+	transmission.file_name = stream ? (char *)options.stream_name
+									: (char *)get_file_name(file_path);
+	// The size of a stream is counted as it is read
+	transmission.file_size = delta != NULL ? delta->size
+							 : stream	   ? 0
+										   : get_file_size(file_path);
+	transmission.original_file_size = stream ? 0 : get_file_size(file_path);
+	transmission.delta_flag = delta != NULL ? delta->flag : 0;
+	transmission.large_file = options.large_file || stream;
+	// The receiver checks the file it rebuilds by its SHA-256, which is known
+	// from the delta already
+	if (delta != NULL) {
+		memcpy(transmission.hash, delta->original_hash, HASH_SIZE);
+		transmission.hash_finished = true;
+		transmission.original_file_size = delta->original_file_size;
+	}
+	transmission.file_mapping = NULL;
+	transmission.file_offset = 0;
+	// An empty file cannot be mapped, but there is nothing to copy anyway
+	if (options.memory_map && transmission.file_size > 0) {
+		void *file_mapping = mmap(NULL, transmission.file_size, PROT_READ,
+								  MAP_PRIVATE, fileno(file), 0);
+		if (file_mapping == MAP_FAILED) {
+			fprintf(stderr, "Failed to memory map file!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		madvise(file_mapping, transmission.file_size, MADV_SEQUENTIAL);
+		transmission.file_mapping = file_mapping;
+	}
+	transmission.chunk_size = options.chunk_size;
+	transmission.length = transmission.file_size / transmission.chunk_size + 1;
+	// A stream may go on for as many data packets as can be indexed
+	if (stream) {
+		transmission.length = UINT32_MAX;
+	}
+	// Data packets are indexed by 32 bits, which covers 2 TiB even with the
+	// smallest chunks
+	if (transmission.length > UINT32_MAX) {
+		fprintf(stderr, "File is too large to be sent in chunks of %zu bytes!\n",
+				transmission.chunk_size);
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	transmission.end_index = transmission.length;
+	transmission.stripe_length = transmission.length;
+	if (options.stripe_count > 1 && delta == NULL) {
+		// Stripes consist of whole repair ranges and parity groups
+		size_t alignment = REPAIR_RANGE_PACKET_COUNT;
+		if (options.fec_group_size > 0) {
+			alignment *= options.fec_group_size;
+		}
+		size_t stripe_length =
+			(transmission.length + options.stripe_count - 1) /
+			options.stripe_count;
+		transmission.stripe_length =
+			(stripe_length + alignment - 1) / alignment * alignment;
+	}
 	transmission.connection = connection;
 	transmission.md_context = md_context;
-	// transmission.transmission_id = get_random_number();
-	transmission.transmission_id = 42;
-	transmission.packets = malloc(sizeof(sent_packet_t) * transmission.length);
-	if (transmission.packets == NULL) {
+	transmission.tree_hash = NULL;
+	if (options.tree_hash && delta == NULL) {
+		transmission.tree_hash =
+			start_tree_hash(fileno(file), transmission.file_size,
+							TREE_HASH_LEAF_PACKET_COUNT * transmission.chunk_size);
+	}
+	transmission.rtt_estimator = create_rtt_estimator();
+	transmission.congestion_controller =
+		create_congestion_controller(options.congestion_control);
+	transmission.batch = create_packet_batch(options.batch_size);
+	transmission.unacknowledged_packet_count = 0;
+	transmission.timer_queue = create_timer_queue(RETRANSMISSION_RING_SIZE);
+	transmission.transmission_id = transmission_id;
+	transmission.pending_end = NULL;
+	transmission.retransmission_ring =
+		malloc(sizeof(retransmission_slot_t) * RETRANSMISSION_RING_SIZE);
+	if (transmission.retransmission_ring == NULL) {
 		fprintf(stderr, "Failed to allocate space for packets!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
+	transmission.fec = options.fec_group_size > 0;
+	transmission.parity_packet_count = 0;
+	transmission.parity_packet_capacity = 0;
+	transmission.parity_packets = NULL;
+	if (transmission.fec) {
+		transmission.fec_encoder =
+			create_fec_encoder(options.fec_group_size,
+							   options.fec_parity_count, transmission.chunk_size);
+		transmission.parity_packet_capacity =
+			options.batch_size + options.fec_parity_count;
+		transmission.parity_packets = malloc(
+			sizeof(sent_packet_t) * transmission.parity_packet_capacity);
+		if (transmission.parity_packets == NULL) {
+			fprintf(stderr, "Failed to allocate space for packets!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+	transmission.read_ahead = NULL;
+	if (options.read_ahead_depth > 0 && transmission.file_mapping == NULL) {
+		transmission.read_ahead =
+			create_read_ahead(fileno(file), stream, transmission.chunk_size,
+							  options.read_ahead_depth);
+	}
+	transmission.compressor = NULL;
+	transmission.compressed_data = NULL;
+	if (options.compression != NO_COMPRESSION) {
+		transmission.compressor = malloc(sizeof(compressor_t));
+		if (transmission.compressor == NULL) {
+			fprintf(stderr, "Failed to allocate space for the compressor!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		create_compressor(transmission.compressor, options.compression);
+		transmission.compressed_data =
+			malloc(transmission.chunk_size * RETRANSMISSION_RING_SIZE);
+		if (transmission.compressed_data == NULL) {
+			fprintf(stderr, "Failed to allocate space for packets!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		for (size_t i = 0; i < RETRANSMISSION_RING_SIZE; ++i) {
+			transmission.retransmission_ring[i].compressed_data =
+				transmission.compressed_data + i * transmission.chunk_size;
+		}
+	}
+	// Memory mapped chunks are sent from the mapping
+	transmission.retransmission_data = NULL;
+	if (transmission.file_mapping == NULL) {
+		transmission.retransmission_data =
+			malloc(transmission.chunk_size * RETRANSMISSION_RING_SIZE);
+		if (transmission.retransmission_data == NULL) {
+			fprintf(stderr, "Failed to allocate space for packets!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		for (size_t i = 0; i < RETRANSMISSION_RING_SIZE; ++i) {
+			transmission.retransmission_ring[i].data =
+				transmission.retransmission_data + i * transmission.chunk_size;
+		}
+	}
 
 	return transmission;
 }
 
 void destroy_transmission(transmission_t *transmission) {
-	for (size_t i = 0; i < transmission->current_index; ++i) {
-		free(transmission->packets[i].packet_data);
+	if (transmission->read_ahead != NULL) {
+		destroy_read_ahead(transmission->read_ahead);
+	}
+	free(transmission->retransmission_ring);
+	free(transmission->retransmission_data);
+	if (transmission->compressor != NULL) {
+		free(transmission->compressed_data);
+		destroy_compressor(transmission->compressor);
+		free(transmission->compressor);
+	}
+	if (transmission->fec) {
+		release_parity_packets(transmission);
+		free(transmission->parity_packets);
+		destroy_fec_encoder(&transmission->fec_encoder);
 	}
 	EVP_MD_CTX_free(transmission->md_context);
+	if (transmission->tree_hash != NULL) {
+		destroy_tree_hash(transmission->tree_hash);
+	}
+	destroy_packet_batch(&transmission->batch);
+	destroy_timer_queue(&transmission->timer_queue);
+	if (transmission->file_mapping != NULL &&
+		munmap((void *)transmission->file_mapping, transmission->file_size)) {
+		fprintf(stderr, "Failed to unmap file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
 	if (fclose(transmission->file)) {
 		fprintf(stderr, "Failed to close file!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 }
 
-bool resend_until_success_or_timeout(transmission_t *transmission,
+bool resend_until_success_or_timeout(connection_t connection,
+									 uint32_t transmission_id,
+									 pending_end_t *pending_end,
 									 uint8_t packet_type, sent_packet_t packet,
-									 packet_t *haha, bool *hihi) {
-	struct timeval outter_start;
-	gettimeofday(&outter_start, NULL);
-	struct timeval inner_start;
+									 uint64_t resend_timeout,
+									 packet_view_t *haha,
+									 bool *hihi) {
+	uint64_t outter_start = get_time_in_microseconds();
 	while (true) {
-		gettimeofday(&inner_start, NULL);
+		uint64_t inner_start = get_time_in_microseconds();
+		// The acknowledgement content is read after the loop
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t received_packet;
 		acknowledgement_packet_content_t *content = NULL;
 		printf(
 			"Waiting for acknowledgement of start/end transmission packet.\n");
 		while (true) {
-			if (timeout_elapsed(&inner_start, 1)) {
+			if (get_time_in_microseconds() - inner_start >= resend_timeout) {
 				printf("Have not received an acknowledgement - resending.\n");
 				break;
 			}
-			if (timeout_elapsed(&outter_start, TIMEOUT_SECONDS)) {
+			if (timeout_elapsed(outter_start, TIMEOUT_SECONDS)) {
 				printf(
 					"Waiting for start/end transmission packet timed-out.\n");
 				return false;
 			}
 
-			packet_t received_packet;
-			if (!receive_packet(transmission->connection, &received_packet)) {
-				sleep_for_milliseconds(WAIT_TIME);
+			if (!receive_packet(connection, buffer, &received_packet)) {
+				wait_for_packet(connection, inner_start + resend_timeout);
 				continue;
 			}
-			if (transmission->transmission_id ==
+			if (receive_pending_end_packet(pending_end, &received_packet)) {
+				continue;
+			}
+			if (transmission_id ==
 					received_packet.transmission_id &&
 				received_packet.packet_type ==
 					TRANSMISSION_END_RESPONSE_PACKET_TYPE) {
@@ -192,19 +1073,17 @@ bool resend_until_success_or_timeout(transmission_t *transmission,
 				return true;
 			}
 			if (received_packet.transmission_id !=
-					transmission->transmission_id ||
+					transmission_id ||
 				received_packet.packet_type != ACKNOWLEDGEMENT_PACKET_TYPE) {
 				printf("Transmission ID or packet type mismatch!\n");
 				printf("Packet type: %x\n", received_packet.packet_type);
 				printf("Transmission id: %x != %x\n",
 					   received_packet.transmission_id,
-					   transmission->transmission_id);
-				sleep_for_milliseconds(WAIT_TIME);
+					   transmission_id);
 				continue;
 			}
-			content = received_packet.content;
+			content = &received_packet.content.acknowledgement;
 			if (content->packet_type != packet_type) {
-				sleep_for_milliseconds(WAIT_TIME);
 				continue;
 			}
 
@@ -222,129 +1101,645 @@ bool resend_until_success_or_timeout(transmission_t *transmission,
 			content = NULL;
 		}
 
-		send_packet_data(transmission->connection, packet.packet_data,
+		send_packet_data(connection, packet.packet_data,
 						 packet.packet_data_size);
+		resend_timeout = get_handshake_resend_timeout(resend_timeout);
 	}
 	return true;
 }
 
+bool is_striped(transmission_t *transmission) {
+	return transmission->stripe_length < transmission->length;
+}
+
 bool start_transmission(transmission_t *transmission) {
+	uint8_t flags = 0;
+	if (transmission->tree_hash != NULL) {
+		flags |= TREE_HASH_FLAG;
+	}
+	if (is_striped(transmission)) {
+		flags |= STRIPE_FLAG;
+	}
+	flags |= transmission->delta_flag;
+	if (transmission->large_file) {
+		flags |= LARGE_FILE_FLAG;
+	}
+	// The start packet of a stream carries no length
+	if (transmission->stream) {
+		flags |= STREAM_FLAG;
+	}
 	sent_packet_t packet = send_transmission_start_packet(
 		transmission->connection, transmission->transmission_id,
-		transmission->length, transmission->file_name);
+		transmission->stream ? 0 : transmission->length,
+		transmission->chunk_size, flags,
+		transmission->stripe_length, transmission->file_name);
 	printf("Sent transmission start packet.\n");
-	return resend_until_success_or_timeout(
-		transmission, TRANSMISSION_START_PACKET_TYPE, packet, NULL, NULL);
+	bool success = resend_until_success_or_timeout(
+		transmission->connection, transmission->transmission_id,
+		transmission->pending_end, TRANSMISSION_START_PACKET_TYPE, packet,
+		transmission->rtt_estimator.resend_timeout, NULL, NULL);
+	free(packet.packet_data);
+	return success;
 }
 
-bool transmit_data(transmission_t *transmission) {
-	printf("Starting to transmit data.\n");
-	uint8_t *data_buffer = malloc(sizeof(uint8_t) * MAX_DATA_SIZE);
-	if (data_buffer == NULL) {
-		fprintf(stderr, "Malloc failed!\n");
-		exit(NON_RECOVERABLE_ERROR_CODE);
-	}
-
-	uint32_t last_index = 0;
-	struct timeval last_index_update_time;
-	gettimeofday(&last_index_update_time, NULL);
+bool run_transmission_loop(transmission_t *transmission) {
+	uint32_t last_index = transmission->current_index;
+	uint64_t last_index_update_time = get_time_in_microseconds();
 	while (true) {
-		if (timeout_elapsed(&last_index_update_time, TIMEOUT_SECONDS)) {
+		if (timeout_elapsed(last_index_update_time, TIMEOUT_SECONDS)) {
 			printf("Data transmission has failed - the receiver has not "
 				   "answered in too long.\n");
 			return false;
 		}
 
-		if (transmission_loop(transmission, data_buffer)) {
+		if (transmission_loop(transmission)) {
 			break;
 		}
 		if (transmission->current_index != last_index) {
 			last_index = transmission->current_index;
-			gettimeofday(&last_index_update_time, NULL);
+			last_index_update_time = get_time_in_microseconds();
 		}
 	}
-	free(data_buffer);
 	return true;
 }
 
-bool end_transmission(transmission_t *transmission) {
-	// Finalise hash
-	uint8_t hash[HASH_SIZE];
-	unsigned int hash_size = HASH_SIZE;
-	if (!EVP_DigestFinal_ex(transmission->md_context, hash, &hash_size)) {
-		fprintf(stderr, "Failed to final EVP digest!\n");
+bool transmit_data(transmission_t *transmission) {
+	printf("Starting to transmit data.\n");
+	if (!run_transmission_loop(transmission)) {
+		return false;
+	}
+	print_rtt_estimator(&transmission->rtt_estimator);
+	print_congestion_controller(&transmission->congestion_controller);
+	print_packet_batch_statistics(&transmission->batch);
+	if (transmission->fec) {
+		print_fec_encoder(&transmission->fec_encoder);
+	}
+	if (transmission->compressor != NULL) {
+		print_compressor(transmission->compressor);
+	}
+	return true;
+}
+
+void set_data_range(transmission_t *transmission, size_t begin_index,
+					size_t end_index) {
+	transmission->current_index = begin_index;
+	transmission->cumulative_acknowledged_index = begin_index;
+	transmission->highest_acknowledged_index = begin_index;
+	transmission->lost_index = begin_index;
+	transmission->end_index = end_index;
+	if (transmission->file_mapping != NULL) {
+		transmission->file_offset = begin_index * transmission->chunk_size;
+	} else if (transmission->read_ahead != NULL) {
+		// Restarted from begin_index by the next data packet
+		stop_read_ahead(transmission->read_ahead);
+	} else if (fseeko(transmission->file,
+					  (off_t)begin_index * transmission->chunk_size,
+					  SEEK_SET)) {
+		fprintf(stderr, "Failed to seek file!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+}
+
+bool transmit_data_range(transmission_t *transmission, size_t begin_index,
+						 size_t end_index) {
+	set_data_range(transmission, begin_index, end_index);
+	return run_transmission_loop(transmission);
+}
+
+void *run_stripe_worker(void *argument) {
+	stripe_worker_t *worker = argument;
+	worker->success = run_transmission_loop(&worker->transmission);
+	return NULL;
+}
+
+bool transmit_stripes(transmission_t *transmission,
+					  connection_t *stripe_connections, char *file_path,
+					  transmission_options_t options) {
+	size_t stripe_count =
+		(transmission->length + transmission->stripe_length - 1) /
+		transmission->stripe_length;
+	printf("Starting to transmit data in %zu stripes.\n", stripe_count);
+
+	stripe_worker_t *workers = malloc(sizeof(stripe_worker_t) * stripe_count);
+	if (workers == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	// Each stripe has its own file handle, window and acknowledgements, the
+	// tree hash of the whole file is computed by the transmission itself
+	options.tree_hash = false;
+	for (size_t i = 0; i < stripe_count; ++i) {
+		transmission_t *stripe = &workers[i].transmission;
+		*stripe = create_transmission(stripe_connections[i], file_path,
+									  transmission->transmission_id, NULL,
+									  options);
+		stripe->rtt_estimator = transmission->rtt_estimator;
+		stripe->hash_finished = true;
+
+		size_t end_index = (i + 1) * transmission->stripe_length;
+		if (end_index > transmission->length) {
+			end_index = transmission->length;
+		}
+		set_data_range(stripe, i * transmission->stripe_length, end_index);
+		if (pthread_create(&workers[i].thread, NULL, run_stripe_worker,
+						   &workers[i])) {
+			fprintf(stderr, "Failed to create stripe thread!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+
+	bool success = true;
+	for (size_t i = 0; i < stripe_count; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		success = success && workers[i].success;
+		printf("Stripe %zu:\n", i);
+		print_congestion_controller(
+			&workers[i].transmission.congestion_controller);
+		if (workers[i].transmission.compressor != NULL) {
+			print_compressor(workers[i].transmission.compressor);
+		}
+	}
+	print_rtt_estimator(&workers[0].transmission.rtt_estimator);
+	transmission->rtt_estimator = workers[0].transmission.rtt_estimator;
+	for (size_t i = 0; i < stripe_count; ++i) {
+		destroy_transmission(&workers[i].transmission);
+	}
+	free(workers);
+	return success;
+}
+
+void receive_repair_request(transmission_t *transmission,
+							repair_request_packet_content_t *packet_content,
+							bool *answered, size_t *answered_count,
+							bool *damaged_ranges) {
+	size_t range_count = transmission->tree_hash->leaf_count;
+	if (packet_content->repair_round != transmission->repair_round ||
+		packet_content->first_range_index % RANGE_DIGESTS_PER_PACKET != 0 ||
+		packet_content->first_range_index >= range_count) {
+		return;
+	}
+
+	size_t digests_packet_index =
+		packet_content->first_range_index / RANGE_DIGESTS_PER_PACKET;
+	if (answered[digests_packet_index]) {
+		return;
+	}
+	answered[digests_packet_index] = true;
+	++*answered_count;
+
+	for (size_t i = 0; i < packet_content->range_count; ++i) {
+		size_t range = packet_content->first_range_index + i;
+		if (range < range_count &&
+			(packet_content->bitmap[i / 8] & (1 << (i % 8)))) {
+			damaged_ranges[range] = true;
+		}
+	}
+}
+
+bool exchange_range_digests(transmission_t *transmission,
+							bool *damaged_ranges) {
+	size_t range_count = transmission->tree_hash->leaf_count;
+	size_t digests_packet_count =
+		(range_count + RANGE_DIGESTS_PER_PACKET - 1) / RANGE_DIGESTS_PER_PACKET;
+	uint64_t *sent_times = calloc(digests_packet_count, sizeof(uint64_t));
+	bool *answered = calloc(digests_packet_count, sizeof(bool));
+	if (sent_times == NULL || answered == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
 		exit(NON_RECOVERABLE_ERROR_CODE);
 	}
 
+	size_t first_unanswered = 0;
+	size_t answered_count = 0;
+	uint64_t last_answer_time = get_time_in_microseconds();
+	bool success = true;
+	while (answered_count < digests_packet_count) {
+		if (timeout_elapsed(last_answer_time, TIMEOUT_SECONDS)) {
+			printf("Repair has failed - the receiver has not answered in too "
+				   "long.\n");
+			success = false;
+			break;
+		}
+
+		// Keep a window of range digests packets in flight and resend the
+		// unanswered ones once their resend timeout elapses
+		while (answered[first_unanswered]) {
+			++first_unanswered;
+		}
+		uint64_t now = get_time_in_microseconds();
+		uint64_t deadline = last_answer_time + TIMEOUT_SECONDS * 1000000ULL;
+		for (size_t i = first_unanswered;
+			 i < digests_packet_count &&
+			 i < first_unanswered + REPAIR_DIGEST_WINDOW;
+			 ++i) {
+			if (answered[i]) {
+				continue;
+			}
+			uint64_t resend_deadline =
+				sent_times[i] + transmission->rtt_estimator.resend_timeout;
+			if (sent_times[i] != 0 && now < resend_deadline) {
+				if (resend_deadline < deadline) {
+					deadline = resend_deadline;
+				}
+				continue;
+			}
+			size_t first_range_index = i * RANGE_DIGESTS_PER_PACKET;
+			size_t digest_count = range_count - first_range_index;
+			if (digest_count > RANGE_DIGESTS_PER_PACKET) {
+				digest_count = RANGE_DIGESTS_PER_PACKET;
+			}
+			send_range_digests_packet(
+				transmission->connection, transmission->transmission_id,
+				transmission->repair_round, first_range_index, digest_count,
+				&transmission->tree_hash->leaf_hashes[first_range_index]);
+			sent_times[i] = now;
+			if (now + transmission->rtt_estimator.resend_timeout < deadline) {
+				deadline = now + transmission->rtt_estimator.resend_timeout;
+			}
+		}
+
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t packet;
+		bool received_packet = false;
+		while (receive_packet(transmission->connection, buffer, &packet)) {
+			received_packet = true;
+			if (packet.packet_type == REPAIR_REQUEST_PACKET_TYPE &&
+				packet.transmission_id == transmission->transmission_id) {
+				size_t previous_answered_count = answered_count;
+				receive_repair_request(transmission,
+									   &packet.content.repair_request, answered,
+									   &answered_count, damaged_ranges);
+				if (answered_count != previous_answered_count) {
+					last_answer_time = get_time_in_microseconds();
+				}
+			}
+		}
+		if (!received_packet) {
+			wait_for_packet(transmission->connection, deadline);
+		}
+	}
+
+	free(sent_times);
+	free(answered);
+	return success;
+}
+
+bool repair_transmission(transmission_t *transmission) {
+	++transmission->repair_round;
+	printf("Starting repair round %u.\n", transmission->repair_round);
+
+	// The range digests are the tree hash leaves, which have to be computed
+	// now if the file was verified by SHA-256
+	if (transmission->tree_hash == NULL) {
+		transmission->tree_hash = start_tree_hash(
+			fileno(transmission->file), transmission->file_size,
+			REPAIR_RANGE_PACKET_COUNT * transmission->chunk_size);
+	}
+	wait_for_tree_hash_leaves(transmission->tree_hash);
+
+	size_t range_count = transmission->tree_hash->leaf_count;
+	bool *damaged_ranges = calloc(range_count, sizeof(bool));
+	if (damaged_ranges == NULL) {
+		fprintf(stderr, "Malloc failed!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	if (!exchange_range_digests(transmission, damaged_ranges)) {
+		free(damaged_ranges);
+		return false;
+	}
+
+	// Resend the damaged ranges in order, neighbouring ones at once
+	size_t range = 0;
+	while (range < range_count) {
+		if (!damaged_ranges[range]) {
+			++range;
+			continue;
+		}
+		size_t end_range = range;
+		while (end_range < range_count && damaged_ranges[end_range]) {
+			++end_range;
+		}
+
+		size_t begin_index = range * REPAIR_RANGE_PACKET_COUNT;
+		size_t end_index = end_range * REPAIR_RANGE_PACKET_COUNT;
+		// The receiver acknowledges every stripe on its own
+		size_t stripe_end_index = (begin_index / transmission->stripe_length + 1) *
+								  transmission->stripe_length;
+		if (end_index > stripe_end_index) {
+			end_index = stripe_end_index;
+			// Without stripes the end is that of the last, shorter range
+			end_range = (end_index + REPAIR_RANGE_PACKET_COUNT - 1) /
+						REPAIR_RANGE_PACKET_COUNT;
+		}
+		if (end_index > transmission->length) {
+			end_index = transmission->length;
+		}
+		printf("Resending data packets %zu to %zu.\n", begin_index,
+			   end_index - 1);
+		if (!transmit_data_range(transmission, begin_index, end_index)) {
+			free(damaged_ranges);
+			return false;
+		}
+		range = end_range;
+	}
+
+	free(damaged_ranges);
+	return true;
+}
+
+void finish_transmission_hash(transmission_t *transmission) {
+	// Only once as a repair ends the transmission again
+	if (!transmission->hash_finished) {
+		unsigned int hash_size = HASH_SIZE;
+		// The reader thread has hashed the whole file once the send loop got
+		// its last chunk
+		if (transmission->read_ahead != NULL) {
+			stop_read_ahead(transmission->read_ahead);
+		}
+		if (transmission->tree_hash != NULL) {
+			finish_tree_hash(transmission->tree_hash, transmission->hash);
+		} else if (!EVP_DigestFinal_ex(transmission->md_context,
+									   transmission->hash, &hash_size)) {
+			fprintf(stderr, "Failed to final EVP digest!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		transmission->hash_finished = true;
+	}
+}
+
+bool end_transmission(transmission_t *transmission) {
+	finish_transmission_hash(transmission);
 	sent_packet_t packet = send_transmission_end_packet(
 		transmission->connection, transmission->transmission_id,
-		transmission->file_size, hash);
+		transmission->original_file_size, transmission->large_file,
+		transmission->hash);
 
-	packet_t received_packet;
+	uint8_t buffer[MAX_PACKET_SIZE];
+	packet_view_t received_packet;
 	bool hihi = false;
-	if (!resend_until_success_or_timeout(transmission,
-										 TRANSMISSION_END_PACKET_TYPE, packet,
-										 &received_packet, &hihi)) {
+	bool acknowledged = resend_until_success_or_timeout(
+		transmission->connection, transmission->transmission_id,
+		transmission->pending_end, TRANSMISSION_END_PACKET_TYPE, packet,
+		transmission->rtt_estimator.resend_timeout, &received_packet, &hihi);
+	free(packet.packet_data);
+	if (!acknowledged) {
 		return false;
 	}
 	if (hihi) {
-		transmission_end_response_packet_content_t *content =
-			received_packet.content;
-		return content->status;
+		return received_packet.content.end_response.status;
 	}
 
 	printf("Received acknowledgement of end of transmission packet.\n");
 
-	struct timeval start;
-	gettimeofday(&start, NULL);
+	uint64_t start = get_time_in_microseconds();
 	while (true) {
-		if (timeout_elapsed(&start, TIMEOUT_SECONDS)) {
+		if (timeout_elapsed(start, TIMEOUT_SECONDS)) {
 			printf(
 				"We have not received a confirmation but the receiver is going "
 				"to close their socket now, so there is not much we can do.\n");
 			return true;
 		}
 
-		if (!receive_packet(transmission->connection, &received_packet)) {
-			sleep_for_milliseconds(WAIT_TIME);
+		if (!receive_packet(transmission->connection, buffer,
+							&received_packet)) {
+			wait_for_packet(transmission->connection,
+							start + TIMEOUT_SECONDS * 1000000ULL);
 			continue;
 		}
 		if (received_packet.packet_type !=
 			TRANSMISSION_END_RESPONSE_PACKET_TYPE) {
-			sleep_for_milliseconds(WAIT_TIME);
 			continue;
 		}
-		transmission_end_response_packet_content_t *content =
-			received_packet.content;
-		if (content->status) {
+		bool status = received_packet.content.end_response.status;
+		if (status) {
 			printf("Transmission was successful.\n");
 		} else {
 			printf("Hash does not match - attempting to retransmit.\n");
 		}
-		return content->status;
+		return status;
+	}
+}
+
+void end_transmission_later(transmission_t *transmission,
+							pending_end_t *pending_end) {
+	finish_transmission_hash(transmission);
+	pending_end->transmission_id = transmission->transmission_id;
+	pending_end->packet = send_transmission_end_packet(
+		transmission->connection, transmission->transmission_id,
+		transmission->original_file_size, transmission->large_file,
+		transmission->hash);
+	pending_end->sent_time = get_time_in_microseconds();
+	pending_end->resend_timeout = transmission->rtt_estimator.resend_timeout;
+	pending_end->acknowledged = false;
+	pending_end->answered = false;
+	pending_end->success = false;
+	printf("Sent transmission end packet, its response is collected while "
+		   "sending the next file.\n");
+}
+
+bool wait_for_pending_end(connection_t connection, pending_end_t *pending_end) {
+	uint64_t start = get_time_in_microseconds();
+	while (!pending_end->answered) {
+		if (timeout_elapsed(start, TIMEOUT_SECONDS)) {
+			break;
+		}
+
+		uint8_t buffer[MAX_PACKET_SIZE];
+		packet_view_t packet;
+		if (receive_packet(connection, buffer, &packet)) {
+			receive_pending_end_packet(pending_end, &packet);
+			continue;
+		}
+		resend_pending_end_packet(connection, pending_end,
+								  get_time_in_microseconds());
+		uint64_t deadline = start + TIMEOUT_SECONDS * 1000000ULL;
+		if (pending_end->sent_time + pending_end->resend_timeout < deadline) {
+			deadline = pending_end->sent_time + pending_end->resend_timeout;
+		}
+		wait_for_packet(connection, deadline);
 	}
+	free(pending_end->packet.packet_data);
+
+	if (!pending_end->answered) {
+		if (!pending_end->acknowledged) {
+			printf("Waiting for end transmission packet timed-out.\n");
+			return false;
+		}
+		printf(
+			"We have not received a confirmation but the receiver is going "
+			"to close their socket now, so there is not much we can do.\n");
+		return true;
+	}
+	if (pending_end->success) {
+		printf("Transmission was successful.\n");
+	} else {
+		printf("Hash does not match - attempting to retransmit.\n");
+	}
+	return pending_end->success;
 }
 
-void transmit_file(connection_t connection, char *file_path) {
+bool repair_until_success(transmission_t *transmission) {
+	if (transmission->stream) {
+		printf("A stream cannot be read again to be repaired.\n");
+		return false;
+	}
+	bool success = false;
+	// Repair the ranges which differ rather than sending the whole file once
+	// again
+	for (size_t round = 0; !success && round < MAX_REPAIR_ROUNDS; ++round) {
+		if (!repair_transmission(transmission)) {
+			break;
+		}
+		success = end_transmission(transmission);
+	}
+	return success;
+}
+
+transmission_t create_file_transmission(connection_t connection,
+										char *file_path,
+										uint32_t transmission_id,
+										pending_end_t *pending_end,
+										uint64_t resend_timeout,
+										transmission_options_t options) {
+	// The receiver rebuilds a delta in memory, so a large file is always sent
+	// whole
+	if (options.stream_name == NULL && get_file_size(file_path) > UINT32_MAX) {
+		options.large_file = true;
+	}
+	if (options.large_file) {
+		options.delta = false;
+		options.dedup = false;
+	}
+
+	// A delta against the receiver's copy is preferred, without a copy the
+	// chunk store may still have some of the file
+	delta_t delta;
+	bool has_delta = options.delta &&
+					 prepare_delta(connection, file_path, transmission_id,
+								   pending_end, resend_timeout,
+								   options.chunk_size, &delta);
+	if (!has_delta && options.dedup) {
+		has_delta = prepare_dedup(connection, file_path, transmission_id,
+								  pending_end, resend_timeout, &delta);
+	}
+	return create_transmission(connection, file_path, transmission_id,
+							   has_delta ? &delta : NULL, options);
+}
+
+bool transmit_file(connection_t connection, char *file_path,
+				   uint32_t transmission_id, transmission_options_t options) {
 	while (true) {
 		transmission_t transmission =
-			create_transmission(connection, file_path);
+			create_file_transmission(connection, file_path, transmission_id,
+									 NULL, INITIAL_RESEND_TIMEOUT, options);
 
 		if (!start_transmission(&transmission)) {
 			printf("We failed to start the transmission - there is not much we "
 				   "can do.\n");
 			destroy_transmission(&transmission);
-			break;
+			return false;
 		}
 		if (!transmit_data(&transmission)) {
-			break;
+			destroy_transmission(&transmission);
+			return false;
 		}
-		if (end_transmission(&transmission)) {
+		bool success = end_transmission(&transmission) ||
+					   repair_until_success(&transmission);
+		destroy_transmission(&transmission);
+		if (success || options.stream_name != NULL) {
+			return success;
+		}
+	}
+}
+
+bool finish_previous_file(connection_t connection, transmission_t *previous,
+						  pending_end_t *pending_end, char *file_path,
+						  transmission_options_t options) {
+	bool success = wait_for_pending_end(connection, pending_end) ||
+				   repair_until_success(previous);
+	uint32_t transmission_id = previous->transmission_id;
+	destroy_transmission(previous);
+	if (success || options.stream_name != NULL) {
+		return success;
+	}
+
+	// Under the same transmission ID so that the receiver drops what it has,
+	// over the main connection alone
+	printf("Sending %s once again.\n", file_path);
+	options.stripe_count = 1;
+	return transmit_file(connection, file_path, transmission_id, options);
+}
+
+bool send_manifest(connection_t connection, uint32_t file_count) {
+	uint32_t session_id = create_transmission_id();
+	sent_packet_t packet =
+		send_manifest_packet(connection, session_id, file_count);
+	printf("Sent manifest of %u files.\n", file_count);
+	bool success = resend_until_success_or_timeout(
+		connection, session_id, NULL, MANIFEST_PACKET_TYPE, packet,
+		INITIAL_RESEND_TIMEOUT, NULL, NULL);
+	free(packet.packet_data);
+	return success;
+}
+
+void transmit_files(connection_t connection, connection_t *stripe_connections,
+					char **file_paths, size_t file_count,
+					transmission_options_t options) {
+	if (options.probe_path_mtu) {
+		options.chunk_size =
+			probe_chunk_size(connection, MIN_CHUNK_SIZE, options.chunk_size);
+	}
+
+	// A single file is sent without a manifest
+	if (file_count > 1 && !send_manifest(connection, file_count)) {
+		printf("We failed to start the session - there is not much we can "
+			   "do.\n");
+		return;
+	}
+
+	// The end of each file is confirmed while the next one is being sent, the
+	// RTT estimate is carried over so that each file does not start from the
+	// initial resend timeout
+	transmission_t previous;
+	pending_end_t pending_end;
+	bool has_previous = false;
+	rtt_estimator_t rtt_estimator = create_rtt_estimator();
+	for (size_t i = 0; i < file_count; ++i) {
+		transmission_t transmission = create_file_transmission(
+			connection, file_paths[i], create_transmission_id(),
+			has_previous ? &pending_end : NULL, rtt_estimator.resend_timeout,
+			options);
+		transmission.rtt_estimator = rtt_estimator;
+		transmission.pending_end = has_previous ? &pending_end : NULL;
+		bool sent = start_transmission(&transmission) &&
+					(is_striped(&transmission)
+						 ? transmit_stripes(&transmission, stripe_connections,
+											file_paths[i], options)
+						 : transmit_data(&transmission));
+		transmission.pending_end = NULL;
+		rtt_estimator = transmission.rtt_estimator;
+
+		if (has_previous) {
+			has_previous = false;
+			if (!finish_previous_file(connection, &previous, &pending_end,
+									  file_paths[i - 1], options)) {
+				destroy_transmission(&transmission);
+				break;
+			}
+		}
+		if (!sent) {
+			printf("We failed to send %s - there is not much we can do.\n",
+				   file_paths[i]);
 			destroy_transmission(&transmission);
 			break;
 		}
 
-		destroy_transmission(&transmission);
+		end_transmission_later(&transmission, &pending_end);
+		previous = transmission;
+		has_previous = true;
+	}
+	if (has_previous) {
+		finish_previous_file(connection, &previous, &pending_end,
+							 file_paths[file_count - 1], options);
 	}
 	printf("Transmission ended.\n");
 }
@@ -1,27 +1,148 @@
 #ifndef TRANSMISSION_H
 #define TRANSMISSION_H
 
+#include "./compression.h"
+#include "./congestion_controller.h"
 #include "./connection.h"
+#include "./delta.h"
+#include "./fec.h"
+#include "./read_ahead.h"
+#include "./rtt_estimator.h"
+#include "./timer_queue.h"
+#include "./tree_hash.h"
 #include <openssl/evp.h>
+#include <pthread.h>
 
-#define MAX_DATA_SIZE 1000 // 1 kB
-#define MAX_UNACKNOWLEDGED_PACKETS 10
-#define TIMEOUT_SECONDS 10	  // 10s
-#define RESEND_TIMEOUT 100000 // 0.1s
-#define WAIT_TIME 10		  // 10ms
+#define DEFAULT_CHUNK_SIZE 1000 // 1 kB
+// A 576 byte datagram has to get through any IPv4 path unfragmented
+#define MIN_CHUNK_SIZE 512
+// Fills a 9000 byte jumbo frame
+#define MAX_CHUNK_SIZE 8959
+#define TIMEOUT_SECONDS 10 // 10s
+// Longest sleep of the send loop between checks of the receiver's liveness
+#define MAX_WAIT_TIME 1000000 // 1s
+// Start and end packets are resent from the resend timeout with exponential
+// backoff up to this
+#define MAX_HANDSHAKE_RESEND_TIMEOUT 1000000 // 1s
+// A data packet is deemed lost once a packet this many indices past it was
+// acknowledged, it is resent without waiting for its resend timeout
+#define FAST_RETRANSMIT_THRESHOLD 3
+// Data packets which may be in flight at once, the selective acknowledgements
+// can leave holes behind the congestion window
+#define RETRANSMISSION_RING_SIZE (2 * MAX_CONGESTION_WINDOW)
+// Data packets covered by one range digest of a repair
+#define REPAIR_RANGE_PACKET_COUNT TREE_HASH_LEAF_PACKET_COUNT
+#define REPAIR_DIGEST_WINDOW 64 // Unanswered range digests packets
+#define MAX_REPAIR_ROUNDS 3
+// Stripe k is sent from sender_port + 1 + k
+#define MAX_STRIPE_COUNT 8
+// Stands for standard input in the list of files to send
+#define STREAM_FILE_PATH "-"
 
 typedef struct {
-	sent_packet_t *packets;
+	congestion_control_algorithm_t congestion_control;
+	bool memory_map; // Send data packets straight from the mapped file
+	size_t batch_size;
+	size_t chunk_size;	 // Data size of a data packet
+	bool probe_path_mtu; // Lower chunk_size to what the path MTU allows
+	size_t fec_group_size; // No parity packets are sent if 0
+	size_t fec_parity_count;
+	bool tree_hash; // Verify the file by a tree hash instead of SHA-256
+	size_t stripe_count; // Send the file in stripes by as many threads if > 1
+	compression_algorithm_t compression; // Of every data packet on its own
+	// Send a delta against the receiver's copy of the file if it has one
+	bool delta;
+	// Send only the chunks of the file missing from the receiver's chunk store
+	bool dedup;
+	// Chunks read ahead of the send loop by a reader thread, the file is read
+	// by the send loop itself if 0 or memory mapped
+	size_t read_ahead_depth;
+	// Have the receiver write the file to disk as it arrives, always on for
+	// files over 4 GiB whose size does not fit the 32 bits of the end packet
+	bool large_file;
+	// Standard input is sent as a stream under this name unless NULL, it can be
+	// read only once, so it is neither repaired nor sent once again
+	const char *stream_name;
+} transmission_options_t;
+
+// Data packet with index i occupies slot i % RETRANSMISSION_RING_SIZE until it
+// is acknowledged
+typedef struct {
+	sent_packet_t packet;
+	uint8_t *data; // Unless the file is memory mapped
+	// Compression method followed by the compressed data, only with compression
+	uint8_t *compressed_data;
+	bool acknowledged;
+} retransmission_slot_t;
+
+// End packet of the previous file of a batch, its response is collected while
+// the next file is being sent
+typedef struct {
+	uint32_t transmission_id;
+	sent_packet_t packet;
+	uint64_t sent_time;
+	uint64_t resend_timeout;
+	bool acknowledged;
+	bool answered;
+	bool success;
+} pending_end_t;
+
+typedef struct {
+	retransmission_slot_t *retransmission_ring;
+	uint8_t *retransmission_data; // Chunk buffers of the slots
+	uint8_t *compressed_data;	  // Compressed chunk buffers of the slots
+	size_t chunk_size;
 	size_t length;
+	size_t stripe_length; // Data packets per stripe, the length without stripes
 	connection_t connection;
 	FILE *file;
+	const uint8_t *file_mapping; // NULL unless the file is memory mapped
+	size_t file_offset;			 // Of the next data packet in file_mapping
+	read_ahead_t *read_ahead;	 // NULL unless the file is read ahead
 	size_t file_size;
+	// Differs from file_size if the data packets carry delta instructions
+	// instead of the file, the end packet describes the file
+	size_t original_file_size;
+	uint8_t delta_flag; // DELTA_FLAG or DEDUP_FLAG of a delta, 0 otherwise
+	bool large_file;	// Sent with LARGE_FILE_FLAG
+	// Read from standard input, whose size is known only once it ends
+	bool stream;
 	char *file_name;
 	EVP_MD_CTX *md_context;
+	tree_hash_t *tree_hash; // NULL unless the file is verified by a tree hash
+	uint8_t hash[HASH_SIZE];
+	bool hash_finished;
+	uint8_t repair_round; // 0 until the first repair
 	size_t current_index;
+	size_t end_index; // Data packets from here on are not sent
+	size_t cumulative_acknowledged_index; // All packets below were acknowledged
+	size_t highest_acknowledged_index; // One past the highest acknowledged
+	size_t lost_index; // Packets below were resent if deemed lost
+	size_t unacknowledged_packet_count;
+	timer_queue_t timer_queue; // Resend timers of unacknowledged packets
 	uint32_t transmission_id;
+	rtt_estimator_t rtt_estimator;
+	congestion_controller_t congestion_controller;
+	packet_batch_t batch;
+	bool fec;
+	fec_encoder_t fec_encoder;
+	compressor_t *compressor; // NULL without compression
+	// Parity packets waiting in the batch, they are freed once it is flushed
+	sent_packet_t *parity_packets;
+	size_t parity_packet_count;
+	size_t parity_packet_capacity;
+	pending_end_t *pending_end; // NULL unless the previous file awaits it
 } transmission_t;
 
-void transmit_file(connection_t connection, char *file_path);
+// Contiguous part of a file sent by its own thread on its own connection
+typedef struct {
+	transmission_t transmission;
+	pthread_t thread;
+	bool success;
+} stripe_worker_t;
+
+void transmit_files(connection_t connection, connection_t *stripe_connections,
+					char **file_paths, size_t file_count,
+					transmission_options_t options);
 
 #endif // TRANSMISSION_H
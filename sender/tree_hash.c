@@ -0,0 +1,185 @@
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./packet.h"
+#include "./tree_hash.h"
+#include "./utils.h"
+
+// Leaves and inner nodes are hashed with a different prefix, so that a leaf
+// can never be mistaken for an inner node
+#define TREE_HASH_LEAF_PREFIX 0x0
+#define TREE_HASH_NODE_PREFIX 0x1
+
+void hash_tree_hash_leaf(EVP_MD_CTX *md_context, const uint8_t *data,
+						 size_t data_size, uint8_t hash[HASH_SIZE]) {
+	uint8_t prefix = TREE_HASH_LEAF_PREFIX;
+	if (!EVP_DigestInit_ex(md_context, EVP_sha256(), NULL) ||
+		!EVP_DigestUpdate(md_context, &prefix, sizeof(prefix)) ||
+		!EVP_DigestUpdate(md_context, data, data_size) ||
+		!EVP_DigestFinal_ex(md_context, hash, NULL)) {
+		fprintf(stderr, "Failed to hash tree hash leaf!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+}
+
+void hash_tree_hash_node(EVP_MD_CTX *md_context, const uint8_t left[HASH_SIZE],
+						 const uint8_t right[HASH_SIZE],
+						 uint8_t hash[HASH_SIZE]) {
+	uint8_t prefix = TREE_HASH_NODE_PREFIX;
+	if (!EVP_DigestInit_ex(md_context, EVP_sha256(), NULL) ||
+		!EVP_DigestUpdate(md_context, &prefix, sizeof(prefix)) ||
+		!EVP_DigestUpdate(md_context, left, HASH_SIZE) ||
+		!EVP_DigestUpdate(md_context, right, HASH_SIZE) ||
+		!EVP_DigestFinal_ex(md_context, hash, NULL)) {
+		fprintf(stderr, "Failed to hash tree hash node!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+}
+
+void *run_tree_hash_worker(void *argument) {
+	tree_hash_worker_t *worker = argument;
+	tree_hash_t *tree_hash = worker->tree_hash;
+
+	EVP_MD_CTX *md_context = EVP_MD_CTX_new();
+	uint8_t *buffer = malloc(tree_hash->leaf_size);
+	if (md_context == NULL || buffer == NULL) {
+		fprintf(stderr, "Failed to prepare tree hash worker!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	// Workers take every worker_count-th leaf
+	for (size_t leaf = worker->worker_index; leaf < tree_hash->leaf_count;
+		 leaf += tree_hash->worker_count) {
+		off_t offset = (off_t)leaf * tree_hash->leaf_size;
+		size_t leaf_size = tree_hash->file_size - offset;
+		if (leaf_size > tree_hash->leaf_size) {
+			leaf_size = tree_hash->leaf_size;
+		}
+
+		size_t read_size = 0;
+		while (read_size < leaf_size) {
+			ssize_t result =
+				pread(tree_hash->file_descriptor, buffer + read_size,
+					  leaf_size - read_size, offset + read_size);
+			if (result <= 0) {
+				fprintf(stderr, "Failed to read file for the tree hash!\n");
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			read_size += result;
+		}
+
+		hash_tree_hash_leaf(md_context, buffer, leaf_size,
+							tree_hash->leaf_hashes[leaf]);
+	}
+
+	free(buffer);
+	EVP_MD_CTX_free(md_context);
+	return NULL;
+}
+
+tree_hash_t *start_tree_hash(int file_descriptor, size_t file_size,
+							 size_t leaf_size) {
+	// The workers point to it, so it must not move
+	tree_hash_t *tree_hash = malloc(sizeof(tree_hash_t));
+	if (tree_hash == NULL) {
+		fprintf(stderr, "Failed to allocate space for the tree hash!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	tree_hash->file_descriptor = file_descriptor;
+	tree_hash->file_size = file_size;
+	tree_hash->leaf_size = leaf_size;
+	// One leaf per TREE_HASH_LEAF_PACKET_COUNT data packets of the
+	// transmission, the last one may be empty
+	tree_hash->leaf_count = file_size / leaf_size + 1;
+	tree_hash->joined = false;
+
+	long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+	tree_hash->worker_count =
+		processor_count < 1 ? 1 : (size_t)processor_count;
+	if (tree_hash->worker_count > MAX_TREE_HASH_WORKER_COUNT) {
+		tree_hash->worker_count = MAX_TREE_HASH_WORKER_COUNT;
+	}
+	if (tree_hash->worker_count > tree_hash->leaf_count) {
+		tree_hash->worker_count = tree_hash->leaf_count;
+	}
+
+	tree_hash->leaf_hashes = malloc(HASH_SIZE * tree_hash->leaf_count);
+	tree_hash->threads = malloc(sizeof(pthread_t) * tree_hash->worker_count);
+	tree_hash->workers =
+		malloc(sizeof(tree_hash_worker_t) * tree_hash->worker_count);
+	if (tree_hash->leaf_hashes == NULL || tree_hash->threads == NULL ||
+		tree_hash->workers == NULL) {
+		fprintf(stderr, "Failed to allocate space for the tree hash!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	for (size_t i = 0; i < tree_hash->worker_count; ++i) {
+		tree_hash->workers[i].tree_hash = tree_hash;
+		tree_hash->workers[i].worker_index = i;
+		if (pthread_create(&tree_hash->threads[i], NULL, run_tree_hash_worker,
+						   &tree_hash->workers[i])) {
+			fprintf(stderr, "Failed to start tree hash worker!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+
+	return tree_hash;
+}
+
+void wait_for_tree_hash_leaves(tree_hash_t *tree_hash) {
+	if (tree_hash->joined) {
+		return;
+	}
+	for (size_t i = 0; i < tree_hash->worker_count; ++i) {
+		pthread_join(tree_hash->threads[i], NULL);
+	}
+	tree_hash->joined = true;
+}
+
+void finish_tree_hash(tree_hash_t *tree_hash, uint8_t root[HASH_SIZE]) {
+	wait_for_tree_hash_leaves(tree_hash);
+
+	EVP_MD_CTX *md_context = EVP_MD_CTX_new();
+	if (md_context == NULL) {
+		fprintf(stderr, "Failed to create EVP context!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+
+	// Combine pairs level by level, an odd node is carried up as is. The
+	// leaves are kept as they double as the range digests of a repair.
+	size_t node_count = tree_hash->leaf_count;
+	uint8_t(*nodes)[HASH_SIZE] = malloc(HASH_SIZE * node_count);
+	if (nodes == NULL) {
+		fprintf(stderr, "Failed to allocate space for the tree hash!\n");
+		exit(NON_RECOVERABLE_ERROR_CODE);
+	}
+	memcpy(nodes, tree_hash->leaf_hashes, HASH_SIZE * node_count);
+	while (node_count > 1) {
+		for (size_t i = 0; i < node_count / 2; ++i) {
+			hash_tree_hash_node(md_context, nodes[2 * i], nodes[2 * i + 1],
+								nodes[i]);
+		}
+		if (node_count % 2) {
+			memcpy(nodes[node_count / 2], nodes[node_count - 1], HASH_SIZE);
+		}
+		node_count = (node_count + 1) / 2;
+	}
+	memcpy(root, nodes[0], HASH_SIZE);
+
+	free(nodes);
+	EVP_MD_CTX_free(md_context);
+}
+
+void destroy_tree_hash(tree_hash_t *tree_hash) {
+	wait_for_tree_hash_leaves(tree_hash);
+	free(tree_hash->leaf_hashes);
+	free(tree_hash->threads);
+	free(tree_hash->workers);
+	free(tree_hash);
+}
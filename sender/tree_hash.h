@@ -0,0 +1,48 @@
+#ifndef TREE_HASH_H
+#define TREE_HASH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./packet.h"
+
+// Data packets hashed together into one leaf
+#define TREE_HASH_LEAF_PACKET_COUNT 64
+#define MAX_TREE_HASH_WORKER_COUNT 8
+
+struct tree_hash_t;
+
+typedef struct {
+	struct tree_hash_t *tree_hash;
+	size_t worker_index;
+} tree_hash_worker_t;
+
+// Binary Merkle tree over the file. Leaves are SHA-256 hashes of
+// leaf_size bytes long file pieces, computed by worker threads which read the
+// file on their own while it is being sent.
+typedef struct tree_hash_t {
+	int file_descriptor;
+	size_t file_size;
+	size_t leaf_size;
+	size_t leaf_count;
+	uint8_t (*leaf_hashes)[HASH_SIZE];
+	pthread_t *threads;
+	tree_hash_worker_t *workers;
+	size_t worker_count;
+	bool joined;
+} tree_hash_t;
+
+// Starts hashing the leaves in the background
+tree_hash_t *start_tree_hash(int file_descriptor, size_t file_size,
+							size_t leaf_size);
+
+void wait_for_tree_hash_leaves(tree_hash_t *tree_hash);
+
+// Waits for the leaves and combines them into the root
+void finish_tree_hash(tree_hash_t *tree_hash, uint8_t root[HASH_SIZE]);
+
+void destroy_tree_hash(tree_hash_t *tree_hash);
+
+#endif // TREE_HASH_H
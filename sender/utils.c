@@ -1,15 +1,24 @@
+#include <dirent.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
 #include <sys/stat.h>
-#include <sys/time.h>
 #include <time.h>
 
 #include "utils.h"
 
-uint32_t get_random_number() { return (uint32_t)rand() << 16 | rand(); }
+uint32_t get_random_number() {
+	// Senders started within the same second would share rand()'s time seed
+	// and thus their transmission IDs
+	uint32_t number;
+	if (getrandom(&number, sizeof(number), 0) == sizeof(number)) {
+		return number;
+	}
+	return (uint32_t)rand() << 16 | rand();
+}
 
 const char *get_file_name(const char *file_path) {
 	const char *filename = strrchr(file_path, '/');
@@ -19,24 +28,89 @@ const char *get_file_name(const char *file_path) {
 	return file_path;
 }
 
-uint32_t get_file_size(const char *file_path) {
+uint64_t get_file_size(const char *file_path) {
 	struct stat st;
 	stat(file_path, &st);
 	return st.st_size;
 }
 
-void sleep_for_milliseconds(uint32_t milliseconds) {
-	struct timespec ts = {0, milliseconds * 1000000L}; // 500 ms
-	nanosleep(&ts, NULL);
+// Immune to changes of the wall clock
+uint64_t get_time_in_microseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+bool timeout_elapsed(uint64_t start, int seconds) {
+	return get_time_in_microseconds() - start >= (uint64_t)seconds * 1000000;
+}
+
+int compare_file_paths(const void *first, const void *second) {
+	return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+void append_file_path(char ***file_paths, size_t *file_count,
+					  size_t *capacity, char *file_path) {
+	if (*file_count == *capacity) {
+		*capacity = *capacity > 0 ? *capacity * 2 : 16;
+		*file_paths = realloc(*file_paths, sizeof(char *) * *capacity);
+		if (*file_paths == NULL) {
+			fprintf(stderr, "Malloc failed!\n");
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+	}
+	(*file_paths)[(*file_count)++] = file_path;
+}
+
+char **collect_file_paths(char **paths, size_t path_count, size_t *file_count) {
+	char **file_paths = NULL;
+	size_t capacity = 0;
+	*file_count = 0;
+	for (size_t i = 0; i < path_count; ++i) {
+		struct stat st;
+		if (stat(paths[i], &st)) {
+			fprintf(stderr, "Failed to stat %s!\n", paths[i]);
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			append_file_path(&file_paths, file_count, &capacity,
+							 strdup(paths[i]));
+			continue;
+		}
+
+		// Only the regular files directly inside, sorted by name, as the
+		// receiver writes every file under its name alone
+		DIR *directory = opendir(paths[i]);
+		if (directory == NULL) {
+			fprintf(stderr, "Failed to open directory %s!\n", paths[i]);
+			exit(NON_RECOVERABLE_ERROR_CODE);
+		}
+		size_t first_file = *file_count;
+		struct dirent *entry;
+		while ((entry = readdir(directory)) != NULL) {
+			char *file_path =
+				malloc(strlen(paths[i]) + strlen(entry->d_name) + 2);
+			if (file_path == NULL) {
+				fprintf(stderr, "Malloc failed!\n");
+				exit(NON_RECOVERABLE_ERROR_CODE);
+			}
+			sprintf(file_path, "%s/%s", paths[i], entry->d_name);
+			if (stat(file_path, &st) || !S_ISREG(st.st_mode)) {
+				free(file_path);
+				continue;
+			}
+			append_file_path(&file_paths, file_count, &capacity, file_path);
+		}
+		closedir(directory);
+		qsort(file_paths + first_file, *file_count - first_file,
+			  sizeof(char *), compare_file_paths);
+	}
+	return file_paths;
 }
 
-bool timeout_elapsed(struct timeval *start, int seconds) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	int elapsed = now.tv_sec - start->tv_sec;
-	if (elapsed < 0) {
-		printf("Something went awry with time.\n");
-		exit(NON_RECOVERABLE_ERROR_CODE);
+void free_file_paths(char **file_paths, size_t file_count) {
+	for (size_t i = 0; i < file_count; ++i) {
+		free(file_paths[i]);
 	}
-	return elapsed >= seconds;
+	free(file_paths);
 }
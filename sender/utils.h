@@ -1,14 +1,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define NON_RECOVERABLE_ERROR_CODE -1
 
 uint32_t get_random_number();
 const char *get_file_name(const char *filepath);
-uint32_t get_file_size(const char *file_path);
-void sleep_for_milliseconds(uint32_t);
-bool timeout_elapsed(struct timeval *start, int seconds);
+uint64_t get_file_size(const char *file_path);
+bool timeout_elapsed(uint64_t start, int seconds);
+uint64_t get_time_in_microseconds();
+// Lists the given files and the regular files inside the given directories,
+// the returned paths are to be freed by free_file_paths
+char **collect_file_paths(char **paths, size_t path_count, size_t *file_count);
+void free_file_paths(char **file_paths, size_t file_count);
 
 #endif // UTILS_H
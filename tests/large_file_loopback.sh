@@ -0,0 +1,62 @@
+#!/bin/sh
+# Streams a sparse file over 4 GiB over loopback in large-file mode and checks
+# that the receiver writes the same bytes
+# Usage: large_file_loopback.sh <receiver binary> [file size, default 5G]
+set -eu
+
+RECEIVER=$(realpath "$1")
+FILE_SIZE=${2:-5G}
+REPOSITORY=$(realpath "$(dirname "$0")/..")
+# Ports of their own, so that the test does not collide with a running pair
+RECEIVER_PORT=47100
+SENDER_PORT=47101
+REPLY_PORT=47199
+
+RECEIVER_PID=
+WORK_DIRECTORY=$(mktemp -d)
+trap 'kill $RECEIVER_PID 2>/dev/null || true; rm -rf "$WORK_DIRECTORY"' EXIT
+
+# The sender has no build of its own
+${CC:-cc} -std=gnu99 -O2 -o "$WORK_DIRECTORY/sender" "$REPOSITORY"/sender/*.c \
+	"$REPOSITORY"/common/*.c -lcrypto -lz -lpthread -lm
+
+# Mostly holes, with data at the start, across the 4 GiB boundary and at the
+# end, so that misplaced writes show in the checksum
+mkdir "$WORK_DIRECTORY/sent" "$WORK_DIRECTORY/received"
+SENT_FILE="$WORK_DIRECTORY/sent/sparse.bin"
+truncate -s "$FILE_SIZE" "$SENT_FILE"
+BLOCK_COUNT=$(($(stat -c %s "$SENT_FILE") / 1048576))
+for BLOCK in 0 4095 4096 $((BLOCK_COUNT - 1)); do
+	[ "$BLOCK" -lt "$BLOCK_COUNT" ] || continue
+	dd if=/dev/urandom of="$SENT_FILE" bs=1M seek="$BLOCK" count=1 \
+		conv=notrunc status=none
+done
+
+cd "$WORK_DIRECTORY/received"
+"$RECEIVER" -e "$RECEIVER_PORT" "$REPLY_PORT" > receiver.log 2>&1 &
+RECEIVER_PID=$!
+sleep 1
+
+"$WORK_DIRECTORY/sender" "$SENT_FILE" "$RECEIVER_PORT" 127.0.0.1 \
+	"$SENDER_PORT" > sender.log 2>&1 || {
+	tail -n 20 sender.log
+	exit 1
+}
+# The receiver exits on its own once it stops answering resent end packets
+wait "$RECEIVER_PID" || {
+	tail -n 20 receiver.log
+	exit 1
+}
+RECEIVER_PID=
+
+SENT_CHECKSUM=$(sha256sum < "$SENT_FILE")
+RECEIVED_CHECKSUM=$(sha256sum < sparse.bin)
+if [ "$SENT_CHECKSUM" != "$RECEIVED_CHECKSUM" ]; then
+	echo "Received file differs from the sent one"
+	exit 1
+fi
+if ls ./*.part > /dev/null 2>&1; then
+	echo "Part file left behind"
+	exit 1
+fi
+echo "Received $FILE_SIZE file matches"